@@ -2,9 +2,17 @@
 #define ARGS_H_kFlmYm1tW9p5npzDr2opQJ9jM8
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "selector.h"
+#include "dns.h"
 
 #define MAX_USERS 10
 
+/** cantidad máxima de workers (hilos con selector propio) */
+#define MAX_WORKERS 64
+
 struct users
 {
     char* name;
@@ -21,7 +29,83 @@ struct socks5args
 
     bool disectors_enabled;
 
+    /**
+     * retransmite los túneles con splice(2), sin copiar los datos al
+     * proceso. Solo aplica a las sesiones que ningún disector necesita ver.
+     */
+    bool splice_relay;
+
     struct users users[MAX_USERS];
+    /**
+     * protege `users': el servidor de monitoreo lo modifica mientras los
+     * workers lo consultan al autenticar
+     */
+    pthread_rwlock_t users_lock;
+
+    /** cantidad de workers, cada uno con su selector y socket pasivo */
+    unsigned workers;
+
+    /** multiplexor de I/O pedido para los selectors */
+    selector_backend io_backend;
+
+    /**
+     * plazos de una sesión, en segundos (0 = sin límite): para completar la
+     * negociación SOCKS, para conectar (y resolver) el origen, y de
+     * inactividad una vez establecido el túnel.
+     */
+    unsigned handshake_timeout;
+    unsigned connect_timeout;
+    unsigned idle_timeout;
+
+    /**
+     * buffers de los túneles: tamaño máximo por dirección de cada sesión, y
+     * total entre todas las sesiones (0 = sin límite), en bytes
+     */
+    size_t relay_buffer_max;
+    size_t relay_buffer_total;
+
+    /**
+     * los envíos de los túneles de al menos estos bytes usan MSG_ZEROCOPY
+     * (0 = nunca). Por debajo, fijar las páginas cuesta más que copiarlas.
+     */
+    size_t zerocopy_threshold;
+
+    /**
+     * sesiones que cada worker reserva (y toca) al iniciar, para que la
+     * primera ráfaga de conexiones no pague page faults ni mmap(2). También
+     * es lo mínimo que conserva libre cuando baja la carga.
+     */
+    unsigned session_prealloc;
+
+    /** reserva la memoria de las sesiones en páginas de 2 MB */
+    bool session_hugepages;
+
+    /**
+     * hilos que resuelven nombres, y consultas que pueden esperar a alguno
+     * libre; con la cola llena el pedido se rechaza en el momento
+     */
+    unsigned resolver_threads;
+    unsigned resolver_queue;
+
+    /**
+     * resuelve con getaddrinfo(3) en los hilos de arriba en lugar de
+     * consultar a los servidores de nombres desde el selector de cada worker
+     */
+    bool system_resolver;
+
+    /** servidores de nombres pedidos; sin ninguno se usa /etc/resolv.conf */
+    char* nameservers[DNS_MAX_SERVERS];
+    unsigned nameserver_count;
+
+    /** nombres que guarda el caché de resoluciones (0 = sin caché) */
+    unsigned dns_cache_entries;
+
+    /**
+     * aciertos del caché con los que un nombre se renueva en segundo plano
+     * al pedirse en el último `dns_prefetch_window' % de su TTL (0 = nunca)
+     */
+    unsigned dns_prefetch_hot;
+    unsigned dns_prefetch_window;
     
     /** Archivo de log de accesos (NULL = solo stdout) */
     char* log_file;
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <unistd.h>  // size_t, ssize_t
 #include <stdint.h>
+#include <sys/uio.h> // struct iovec
 
 /**
  * buffer.c - buffer con acceso directo (útil para I/O) que mantiene
@@ -73,5 +74,72 @@ buffer_can_read(buffer *b);
 bool
 buffer_can_write(buffer *b);
 
+/**
+ * ring_buffer - buffer circular para I/O con readv/writev.
+ *
+ * A diferencia de `buffer', el espacio que libera una lectura se puede volver
+ * a escribir enseguida aunque queden bytes sin leer: los datos dan la vuelta
+ * al final de la memoria en lugar de compactarse. Por eso tanto los bytes
+ * para leer como el espacio libre se exponen como hasta dos segmentos.
+ */
+typedef struct ring_buffer ring_buffer;
+struct ring_buffer {
+    uint8_t *data;
+
+    /** tamaño de `data'. cambia solo con ring_move(), junto con `data' */
+    size_t size;
+
+    /** posición del primer byte sin leer */
+    size_t read;
+
+    /** cantidad de bytes sin leer */
+    size_t len;
+};
+
+/**
+ * inicializa el anillo sobre la memoria de `b' sin utilizar el heap,
+ * conservando los bytes que `b' tenía sin leer.
+ */
+void
+ring_adopt(ring_buffer *r, buffer *b);
+
+/**
+ * completa `iov' con los segmentos donde se puede escribir (0, 1 o 2) y
+ * retorna cuántos son. Se debe notificar mediante `ring_write_adv'.
+ */
+int
+ring_write_iov(ring_buffer *r, struct iovec iov[2]);
+void
+ring_write_adv(ring_buffer *r, const ssize_t bytes);
+
+/** como ring_write_iov, con los segmentos que quedan por leer */
+int
+ring_read_iov(ring_buffer *r, struct iovec iov[2]);
+void
+ring_read_adv(ring_buffer *r, const ssize_t bytes);
+
+/**
+ * como ring_read_iov, salteando los primeros `skip' bytes sin leer. Para
+ * enviar más datos mientras los anteriores siguen en uso (sin consumirlos).
+ */
+int
+ring_peek_iov(const ring_buffer *r, const size_t skip, struct iovec iov[2]);
+
+/**
+ * mueve el contenido del anillo a `data' (de `size' bytes, al menos los que
+ * hay sin leer), dejándolo contiguo al principio. Para agrandar o achicar el
+ * anillo; liberar la memoria anterior queda a cargo de quien la reservó.
+ */
+void
+ring_move(ring_buffer *r, uint8_t *data, const size_t size);
+
+/** retorna true si hay bytes para leer del anillo */
+bool
+ring_can_read(const ring_buffer *r);
+
+/** retorna true si se pueden escribir bytes en el anillo */
+bool
+ring_can_write(const ring_buffer *r);
+
 #endif
 
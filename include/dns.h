@@ -0,0 +1,59 @@
+#ifndef DNS_H_Hq4nVx8TzLc2PwKs6RbJm9YfDg
+#define DNS_H_Hq4nVx8TzLc2PwKs6RbJm9YfDg
+
+#include <stdbool.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include "selector.h"
+
+/**
+ * dns.c - cliente DNS no bloqueante que corre en el selector
+ *
+ * Cada worker consulta a los servidores de nombres por UDP desde su propio
+ * selector, sin hilos: las preguntas A y AAAA de un nombre salen juntas, se
+ * reintentan rotando de servidor al vencer el plazo y, si la respuesta llega
+ * truncada, se repiten por TCP. Los nombres de /etc/hosts y las direcciones
+ * literales se responden sin consultar, y los pedidos de un nombre que ya se
+ * está consultando esperan esa consulta en lugar de hacer otra.
+ */
+
+/** servidores de nombres que se consultan como máximo (como en resolv.conf) */
+#define DNS_MAX_SERVERS 3
+
+/**
+ * carga la configuración: los servidores de /etc/resolv.conf (o los
+ * `count' de `servers', como "dirección" o "dirección:puerto", con la IPv6
+ * entre corchetes si lleva puerto), sus opciones timeout y attempts (que
+ * RES_OPTIONS puede pisar), y /etc/hosts. false si algún servidor de
+ * `servers' es inválido.
+ */
+bool
+dns_init(char *const *servers, unsigned count);
+
+/**
+ * consulta `host' (terminado en '\0') para conectarse por TCP al puerto
+ * `port' (en network byte order). Mismo contrato que resolver_submit(): al
+ * terminar deja las direcciones en `*result' (NULL si no hay) y avisa con
+ * selector_notify_block(s, fd). Debe llamarse desde el hilo del selector `s'.
+ *
+ * false si no se pudo encolar (sin memoria, sin servidores a los que
+ * consultar o demasiadas consultas en curso): no habrá aviso.
+ */
+bool
+dns_submit(fd_selector s, int fd, const char *host, in_port_t port,
+           struct addrinfo **result);
+
+/**
+ * consulta `host' en segundo plano para renovar su entrada del caché, sin
+ * aviso. Los pedidos del nombre que lleguen mientras tanto la esperan. Debe
+ * llamarse desde el hilo del selector `s'. false si no se pudo encolar.
+ */
+bool
+dns_prefetch(fd_selector s, const char *host);
+
+/** libera la configuración cargada por dns_init() */
+void
+dns_destroy(void);
+
+#endif
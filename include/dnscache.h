@@ -0,0 +1,137 @@
+#ifndef DNSCACHE_H_Wc3kLp8RzTq5NmVx2HbYf7GjDs
+#define DNSCACHE_H_Wc3kLp8RzTq5NmVx2HbYf7GjDs
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+/**
+ * dnscache.c - caché de resoluciones compartido por los workers
+ *
+ * Guarda las direcciones de cada nombre (sin el puerto) mientras dure su
+ * TTL, y también los nombres que no existen o que no se pudieron resolver,
+ * por un plazo corto. Con la capacidad llena se descarta el usado hace más
+ * tiempo. Lo llenan quienes resuelven (dns.c, resolver.c) y lo consultan las
+ * sesiones antes de resolver: un acierto se conecta sin pasar por
+ * REQUEST_RESOLVING.
+ *
+ * Los nombres más pedidos se renuevan antes de vencer: el acierto que lo
+ * indica (DNSCACHE_REFRESH) lanza una consulta en segundo plano, y lo que
+ * ésta guarde reemplaza a la entrada.
+ */
+
+/** direcciones que se guardan por nombre */
+#define DNSCACHE_MAX_ADDRS    8
+/** tope del TTL de las respuestas, en segundos */
+#define DNSCACHE_MAX_TTL      3600
+/** TTL de las respuestas de getaddrinfo(3), que no lo informa */
+#define DNSCACHE_DEFAULT_TTL  60
+/** el nombre no existe o no tiene direcciones (NXDOMAIN, NODATA) */
+#define DNSCACHE_NEGATIVE_TTL 10
+/** no se pudo resolver (sin respuesta, SERVFAIL) */
+#define DNSCACHE_FAILURE_TTL  2
+/** aciertos durante el TTL de un nombre para renovarlo antes de que venza */
+#define DNSCACHE_DEFAULT_HOT    3
+/** parte final del TTL (en %) en la que un acierto lo renueva */
+#define DNSCACHE_DEFAULT_WINDOW 10
+
+enum dnscache_result {
+    DNSCACHE_MISS,
+    /** `*result' tiene las direcciones */
+    DNSCACHE_HIT,
+    /** se sabe que el nombre no resuelve */
+    DNSCACHE_NEGATIVE,
+    /**
+     * como DNSCACHE_HIT, pero el nombre está por vencer y es de los más
+     * pedidos: el que consulta debe resolverlo en segundo plano, o llamar a
+     * dnscache_refresh_abort() si no pudo
+     */
+    DNSCACHE_REFRESH,
+};
+
+struct dnscache_stats {
+    uint64_t capacity;
+    uint64_t entries;
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    uint64_t evictions;
+    /** renovaciones pedidas */
+    uint64_t prefetches;
+    /** entradas renovadas que se usaron después de cuando habrían vencido */
+    uint64_t prefetch_hits;
+    /** entradas renovadas que se descartaron sin usarse así */
+    uint64_t prefetch_wasted;
+};
+
+/** una dirección guardada, sin puerto */
+struct dnscache_addr {
+    sa_family_t family;
+    union {
+        struct in_addr  v4;
+        struct in6_addr v6;
+    }           ip;
+};
+
+/** una entrada, para recorrer el caché */
+struct dnscache_info {
+    const char                 *name;
+    /** segundos que le quedan */
+    unsigned                    ttl;
+    bool                        negative;
+    unsigned                    naddrs;
+    const struct dnscache_addr *addrs;
+};
+
+/**
+ * reserva lugar para `capacity' nombres (0 deshabilita el caché). Se
+ * renuevan los nombres con al menos `hot' aciertos (0: ninguno) que se piden
+ * en el último `window' % de su TTL.
+ */
+bool
+dnscache_init(unsigned capacity, unsigned hot, unsigned window);
+
+/**
+ * busca `host'. Si hay un acierto deja en `*result' una lista nueva (a
+ * liberar con freeaddrinfo) con las direcciones y el puerto `port' (en
+ * network byte order). Si retorna DNSCACHE_REFRESH no lo vuelve a hacer
+ * para la entrada hasta que se la reemplace.
+ */
+enum dnscache_result
+dnscache_lookup(const char *host, in_port_t port, struct addrinfo **result);
+
+/**
+ * la renovación de `host' que pidió dnscache_lookup() no se pudo lanzar: un
+ * acierto posterior la vuelve a pedir
+ */
+void
+dnscache_refresh_abort(const char *host);
+
+/**
+ * guarda las direcciones de `addrs' (el puerto se ignora) para `host'
+ * durante `ttl' segundos, o, si `addrs' es NULL, que `host' no resuelve.
+ * Con `ttl' 0 no guarda nada.
+ */
+void
+dnscache_store(const char *host, const struct addrinfo *addrs, unsigned ttl);
+
+/** descarta `host', o todo si es NULL. Retorna cuántas entradas descartó */
+unsigned
+dnscache_flush(const char *host);
+
+void
+dnscache_stats(struct dnscache_stats *stats);
+
+/**
+ * llama a `visit' con cada entrada vigente, de la usada más recientemente a
+ * la más vieja, hasta que retorne false. `visit' no debe usar el caché.
+ */
+void
+dnscache_foreach(bool (*visit)(const struct dnscache_info *info, void *data),
+                 void *data);
+
+void
+dnscache_destroy(void);
+
+#endif
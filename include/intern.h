@@ -0,0 +1,40 @@
+#ifndef INTERN_H_QwErTyUiOpAsDfGhJkLzXcVbNmPlMk
+#define INTERN_H_QwErTyUiOpAsDfGhJkLzXcVbNmPlMk
+
+#include <stddef.h>
+
+/**
+ * intern.c - strings compartidos entre sesiones
+ *
+ * Las sesiones que guardan el mismo string (el usuario autenticado, el
+ * destino) referencian una única copia con contador de referencias en lugar
+ * de llevar cada una un arreglo del tamaño máximo. Cada worker tiene su
+ * propia tabla, sin locks: un string se obtiene y se devuelve en el mismo
+ * hilo.
+ */
+
+/**
+ * retorna la copia compartida de los `len' bytes de `s' (que no necesitan
+ * estar terminados en '\0'), creándola si hace falta. El resultado está
+ * terminado en '\0' y vive hasta el intern_put() correspondiente. NULL si no
+ * hay memoria.
+ */
+const char *
+intern_get(const char *s, size_t len);
+
+/**
+ * devuelve una referencia obtenida con intern_get(). Acepta NULL. Si el
+ * string es de la tabla de otro hilo (pasa al destruir un worker desde el
+ * hilo principal) no hace nada: esa memoria se libera con el proceso.
+ */
+void
+intern_put(const char *s);
+
+/**
+ * libera la tabla del hilo actual. Los strings todavía referenciados no se
+ * liberan: quedan hasta que termine el proceso.
+ */
+void
+intern_destroy(void);
+
+#endif
@@ -74,7 +74,8 @@ void log_auth(const char *username,
               int success);
 
 /**
- * Registra una nueva conexión entrante
+ * Registra una nueva conexión entrante. Es de nivel DEBUG: se llama una vez
+ * por conexión aceptada y con el nivel por defecto no escribe nada.
  */
 void log_connection(const struct sockaddr *client_addr, int fd);
 
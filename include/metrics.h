@@ -7,7 +7,8 @@
 /**
  * Estructura de métricas del servidor SOCKSv5
  * 
- * Accesible globalmente como singleton thread-safe
+ * Cada hilo que registra métricas (un worker) escribe en su propio shard, sin
+ * locks ni contención. Las lecturas suman todos los shards.
  */
 struct socks5_metrics {
     /** conexiones históricas (total de conexiones aceptadas) */
@@ -44,10 +45,13 @@ struct socks5_metrics {
     uint64_t auth_failed;
 };
 
+/** cantidad máxima de hilos con shard propio (los demás comparten el último) */
+#define METRICS_MAX_SHARDS 64
+
 /**
- * Obtiene el singleton de métricas
+ * Obtiene las métricas agregadas de todos los workers
  */
-struct socks5_metrics *metrics_get(void);
+void metrics_snapshot(struct socks5_metrics *out);
 
 /**
  * Incrementa el contador de conexiones históricas y concurrentes
@@ -10,6 +10,7 @@
  * - Obtener métricas del servidor
  * - Listar usuarios
  * - Agregar/Eliminar usuarios
+ * - Inspeccionar y vaciar el caché de resoluciones DNS
  *
  * Formato de mensaje:
  * +------+--------+------+----------+
@@ -26,6 +27,9 @@
  *   0x02 - ADD_USER        - Agregar usuario (DATA: ulen + user + plen + pass)
  *   0x03 - REMOVE_USER     - Eliminar usuario (DATA: ulen + user)
  *   0x04 - TOGGLE_DISECTOR - Habilitar/deshabilitar disector
+ *   0x05 - GET_DNS_CACHE   - Estadísticas y entradas del caché DNS
+ *   0x06 - FLUSH_DNS_CACHE - Vaciar el caché DNS (DATA: nombre, o vacío
+ *                            para todo)
  *
  * Respuesta:
  * +------+--------+------+----------+
@@ -41,6 +45,16 @@
  *   0x03 - Usuario no encontrado
  *   0x04 - Usuario ya existe
  *   0x05 - Límite de usuarios alcanzado
+ *
+ * Respuesta de GET_DNS_CACHE: capacidad, entradas, aciertos, aciertos
+ * negativos, fallos, descartes, renovaciones, renovaciones usadas y
+ * renovaciones desperdiciadas (8 bytes cada uno), la cantidad de entradas
+ * que siguen (2 bytes) y, por cada una, de la usada más recientemente a la
+ * más vieja mientras entren: TTL restante (4 bytes), negativa (1), largo del
+ * nombre (1), nombre, cantidad de direcciones (1) y cada dirección como
+ * familia (1: 4 o 6) y 4 o 16 bytes.
+ *
+ * Respuesta de FLUSH_DNS_CACHE: entradas descartadas (4 bytes).
  */
 
 #define MONITORING_VERSION 0x01
@@ -52,6 +66,8 @@ enum monitoring_cmd {
     MONITORING_CMD_ADD_USER        = 0x02,
     MONITORING_CMD_REMOVE_USER     = 0x03,
     MONITORING_CMD_TOGGLE_DISECTOR = 0x04,
+    MONITORING_CMD_GET_DNS_CACHE   = 0x05,
+    MONITORING_CMD_FLUSH_DNS_CACHE = 0x06,
 };
 
 /** Códigos de respuesta */
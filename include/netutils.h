@@ -2,6 +2,7 @@
 #define NETUTILS_H_CTCyWGhkVt1pazNytqIRptmAi5U
 
 #include <netinet/in.h>
+#include <netdb.h>
 
 #include "buffer.h"
 
@@ -40,5 +41,17 @@ sock_blocking_write(const int fd, buffer *b);
 int
 sock_blocking_copy(const int source, const int dest);
 
+/**
+ * copia las direcciones IPv4 e IPv6 de `list' con el puerto `port' (en
+ * network byte order), cada una en un solo bloque: se liberan con
+ * freeaddrinfo(3). NULL si no hay ninguna o no hay memoria.
+ */
+struct addrinfo *
+addrinfo_copy(const struct addrinfo *list, const in_port_t port);
+
+/** pone el puerto `port' (en network byte order) a las direcciones de `list' */
+void
+addrinfo_set_port(struct addrinfo *list, const in_port_t port);
+
 #endif
 
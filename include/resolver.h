@@ -0,0 +1,58 @@
+#ifndef RESOLVER_H_Rz7mQ2vKp9WxNc4TbLs8YdHj3F
+#define RESOLVER_H_Rz7mQ2vKp9WxNc4TbLs8YdHj3F
+
+#include <stdbool.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include "selector.h"
+
+/**
+ * resolver.c - resolución de nombres en un pool fijo de hilos
+ *
+ * getaddrinfo(3) es bloqueante, así que corre fuera de los selectors: un
+ * grupo de hilos toma las consultas de una cola acotada. Con la cola llena
+ * la consulta se rechaza en el momento en lugar de crear más hilos. La cola
+ * cuenta nombres, no pedidos: los de un mismo nombre comparten la consulta.
+ */
+
+/**
+ * inicia `threads' hilos que atienden una cola de hasta `queue_depth'
+ * consultas en espera. false si no se pudo crear alguno.
+ */
+bool
+resolver_init(unsigned threads, unsigned queue_depth);
+
+/**
+ * encola la resolución de `host' (terminado en '\0') para conectarse por
+ * TCP al puerto `port' (en network byte order). Al terminar un hilo deja el
+ * resultado en `*result' (NULL si falló) y avisa con
+ * selector_notify_block(s, fd), reintentando si la cola de `s' está llena.
+ * Hasta entonces `*result' no debe liberarse.
+ *
+ * Si `host' ya está en la cola o resolviéndose, el pedido espera esa misma
+ * consulta (aun con la cola llena) y recibe su copia del resultado.
+ *
+ * false si la cola está llena o el pool no está iniciado: no se encola nada
+ * y no habrá aviso.
+ */
+bool
+resolver_submit(fd_selector s, int fd, const char *host, in_port_t port,
+                struct addrinfo **result);
+
+/**
+ * encola la resolución de `host' para renovar su entrada del caché, sin
+ * aviso. Los pedidos del nombre que lleguen mientras tanto la esperan.
+ * false si la cola está llena o el pool no está iniciado.
+ */
+bool
+resolver_prefetch(const char *host);
+
+/**
+ * detiene los hilos (esperando las consultas en curso) y descarta las que
+ * quedaban en la cola, sin avisar. Los selectors deben seguir vivos.
+ */
+void
+resolver_destroy(void);
+
+#endif
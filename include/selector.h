@@ -32,13 +32,33 @@ typedef enum {
 const char *
 selector_error(const selector_status status);
 
+/** implementación del multiplexor que usa el selector */
+typedef enum {
+    /** la mejor disponible en la plataforma (epoll si está, si no pselect) */
+    SELECTOR_BACKEND_AUTO   = 0,
+    /** pselect(2): portable, limitado a FD_SETSIZE descriptores */
+    SELECTOR_BACKEND_SELECT = 1,
+    /** epoll(7): sin más límite de descriptores que RLIMIT_NOFILE */
+    SELECTOR_BACKEND_EPOLL  = 2,
+    /**
+     * io_uring(7) usado solo como multiplexor: como epoll, pero los cambios
+     * de interés (polls de un disparo) se encolan y se envían al kernel
+     * junto con la espera, en una sola syscall. accept, recv y send siguen
+     * siendo syscalls de los handlers.
+     */
+    SELECTOR_BACKEND_URING  = 3,
+} selector_backend;
+
 /** opciones de inicialización del selector */
 struct selector_init {
-    /** señal a utilizar para notificaciones internas */
-    const int signal;
-
     /** tiempo máximo de bloqueo durante `selector_iteratate' */
     struct timespec select_timeout;
+
+    /**
+     * multiplexor a utilizar. Por defecto SELECTOR_BACKEND_AUTO. Si el pedido
+     * no está disponible se usa el siguiente: io_uring, epoll, pselect.
+     */
+    selector_backend backend;
 };
 
 /** inicializa la librería */
@@ -57,12 +77,27 @@ selector_new(const size_t initial_elements);
 void
 selector_destroy(fd_selector s);
 
+/** multiplexor efectivamente utilizado por el selector */
+selector_backend
+selector_get_backend(fd_selector s);
+
+/** nombre legible de un multiplexor */
+const char *
+selector_backend_name(const selector_backend backend);
+
 /**
  * Intereses sobre un file descriptor (quiero leer, quiero escribir, …)
  */
 typedef enum {
     OP_NOOP    = 0,
     OP_READ    = 1 << 0,
+    /**
+     * errores y hangups del fd (POLLERR/POLLHUP), por ejemplo completados en
+     * la cola de errores de un socket. Con OP_READ u OP_WRITE un error
+     * también despierta a esos handlers; este interés sirve para enterarse
+     * sin pedir ninguno de los dos.
+     */
+    OP_ERROR   = 1 << 1,
     OP_WRITE   = 1 << 2,
 } fd_interest ;
 
@@ -91,6 +126,12 @@ typedef struct fd_handler {
   void (*handle_write)     (struct selector_key *key);
   void (*handle_block)     (struct selector_key *key);
 
+  /** llamado cuando vence el timer del fd (ver selector_set_timeout) */
+  void (*handle_timeout)   (struct selector_key *key);
+
+  /** llamado ante un error o hangup del fd, si se pidió OP_ERROR */
+  void (*handle_error)     (struct selector_key *key);
+
   /**
    * llamado cuando se se desregistra el fd
    * Seguramente deba liberar los recusos alocados en data.
@@ -124,6 +165,29 @@ selector_set_interest(fd_selector s, int fd, fd_interest i);
 selector_status
 selector_set_interest_key(struct selector_key *key, fd_interest i);
 
+/**
+ * arma el timer de un file descriptor registrado: dentro de `ms'
+ * milisegundos se invoca handle_timeout. Cada fd tiene a lo sumo un timer,
+ * volver a armarlo reemplaza el vencimiento anterior. Desregistrar el fd lo
+ * cancela.
+ *
+ * Los timers viven en una rueda jerárquica con resolución de 1 ms: armar,
+ * re-armar y cancelar son O(1), y el próximo vencimiento acota el tiempo
+ * de bloqueo de selector_select.
+ */
+selector_status
+selector_set_timeout(fd_selector s, int fd, unsigned ms);
+
+selector_status
+selector_set_timeout_key(struct selector_key *key, unsigned ms);
+
+/** cancela el timer de un file descriptor. No es error si no estaba armado */
+selector_status
+selector_cancel_timeout(fd_selector s, int fd);
+
+selector_status
+selector_cancel_timeout_key(struct selector_key *key);
+
 
 /**
  * se bloquea hasta que hay eventos disponible y los despacha.
@@ -140,10 +204,26 @@ selector_select(fd_selector s);
 int
 selector_fd_set_nio(const int fd);
 
-/** notifica que un trabajo bloqueante terminó */
+/**
+ * notifica que un trabajo bloqueante terminó. Puede llamarse desde
+ * cualquier hilo, incluso el del selector; el handle_block correspondiente
+ * se ejecuta en el hilo del selector.
+ *
+ * Si la cola de notificaciones está llena no espera: retorna
+ * SELECTOR_ENOMEM y no habrá handle_block. Quien avisa conserva el
+ * resultado y vuelve a intentar más tarde.
+ */
 selector_status
 selector_notify_block(fd_selector s,
                  const int   fd);
 
+/**
+ * despierta al selector si está bloqueado en selector_select(). Puede
+ * llamarse desde cualquier hilo y desde un signal handler: varias llamadas
+ * antes de que el selector despierte se colapsan en una sola.
+ */
+void
+selector_wakeup(fd_selector s);
+
 #endif
 
@@ -2,6 +2,7 @@
 #define SOCKS5NIO_H_FLpPQJoHvLcDkRdTyYsMnUpAeWiZbXgG
 
 #include <netdb.h>
+#include <stdbool.h>
 #include "selector.h"
 
 /**
@@ -9,6 +10,12 @@
  */
 void socksv5_passive_accept(struct selector_key *key);
 
+/**
+ * Prepara el pool de sesiones del worker que la llama, reservando las
+ * sesiones pedidas con -A. Retorna false si no pudo reservarlas todas.
+ */
+bool socksv5_pool_init(void);
+
 /**
  * Libera recursos del pool de conexiones
  */
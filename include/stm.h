@@ -41,6 +41,10 @@ struct state_definition {
     unsigned (*on_write_ready)(struct selector_key *key);
     /** ejecutado cuando hay una resolución de nombres lista */
     unsigned (*on_block_ready)(struct selector_key *key);
+    /** ejecutado cuando vence el timer del fd */
+    unsigned (*on_timeout)    (struct selector_key *key);
+    /** ejecutado ante un error del socket (cola de errores, hangup) */
+    unsigned (*on_error_ready)(struct selector_key *key);
 };
 
 
@@ -64,6 +68,14 @@ stm_handler_write(struct state_machine *stm, struct selector_key *key);
 unsigned
 stm_handler_block(struct state_machine *stm, struct selector_key *key);
 
+/** indica que ocurrió el evento error. retorna nuevo id de nuevo estado. */
+unsigned
+stm_handler_error(struct state_machine *stm, struct selector_key *key);
+
+/** indica que venció un timer. retorna nuevo id de nuevo estado. */
+unsigned
+stm_handler_timeout(struct state_machine *stm, struct selector_key *key);
+
 /** indica que ocurrió el evento close. retorna nuevo id de nuevo estado. */
 void
 stm_handler_close(struct state_machine *stm, struct selector_key *key);
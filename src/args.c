@@ -6,6 +6,7 @@
 #include <getopt.h>
 
 #include "args.h"
+#include "dnscache.h"
 
 static unsigned short
 port(const char* s)
@@ -24,6 +25,74 @@ port(const char* s)
     return (unsigned short)sl;
 }
 
+static unsigned
+workers(const char* s)
+{
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 1 || sl > MAX_WORKERS)
+    {
+        fprintf(stderr, "workers should be in the range of 1-%d: %s\n", MAX_WORKERS, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static selector_backend
+backend(const char* s)
+{
+    const selector_backend all[] = {
+        SELECTOR_BACKEND_AUTO,
+        SELECTOR_BACKEND_SELECT,
+        SELECTOR_BACKEND_EPOLL,
+        SELECTOR_BACKEND_URING,
+    };
+    for (unsigned i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+    {
+        if (strcmp(s, selector_backend_name(all[i])) == 0)
+        {
+            return all[i];
+        }
+    }
+    fprintf(stderr, "I/O multiplexer should be one of auto, epoll, io_uring, pselect: %s\n", s);
+    exit(1);
+    return SELECTOR_BACKEND_AUTO;
+}
+
+static unsigned
+seconds(const char* s)
+{
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < 0 || sl > 86400)
+    {
+        fprintf(stderr, "timeout should be in the range of 0-86400 seconds: %s\n", s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+/** `s' unidades de `unit' bytes, entre `min' y `max' unidades */
+static size_t
+size(const char* s, const char* what, const size_t unit,
+     const long min, const long max)
+{
+    char* end = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || sl < min || sl > max)
+    {
+        fprintf(stderr, "%s should be in the range of %ld-%ld: %s\n", what, min, max, s);
+        exit(1);
+        return 1;
+    }
+    return (size_t)sl * unit;
+}
+
 static void
 user(char* s, struct users* user)
 {
@@ -57,13 +126,29 @@ usage(const char* progname)
             "Usage: %s [OPTION]...\n"
             "\n"
             "   -h               Imprime la ayuda y termina.\n"
+            "   -H               Reserva la memoria de las sesiones en hugepages (2 MB).\n"
+            "   -A <sesiones>    Sesiones que cada worker reserva al iniciar. Por defecto 0.\n"
+            "   -b <multiplexor> Multiplexor de I/O: auto, epoll, io_uring o pselect. Por defecto auto (epoll).\n"
+            "   -B <KB>          Tamaño máximo del buffer de cada dirección de un túnel. Por defecto 256.\n"
             "   -l <SOCKS addr>  Dirección donde servirá el proxy SOCKS.\n"
             "   -L <conf  addr>  Dirección donde servirá el servicio de management.\n"
             "   -p <SOCKS port>  Puerto entrante conexiones SOCKS.\n"
             "   -P <conf port>   Puerto entrante conexiones configuracion\n"
+            "   -C <nombres>     Nombres que guarda el caché de resoluciones. 0 = sin caché. Por defecto 4096.\n"
+            "   -F <aciertos>    Aciertos del caché con los que un nombre se renueva antes de vencer. 0 = nunca. Por defecto 3.\n"
+            "   -W <porcentaje>  Parte final del TTL en la que se renuevan esos nombres. Por defecto 10.\n"
+            "   -n <addr[:port]> Servidor de nombres a consultar, en lugar de los de /etc/resolv.conf. Hasta 3.\n"
+            "   -D               Resuelve con getaddrinfo(3) en un pool de hilos (ver -r y -q).\n"
+            "   -q <consultas>   Con -D, consultas que pueden esperar un resolver libre. Por defecto 1024.\n"
+            "   -r <threads>     Con -D, hilos que resuelven nombres. Por defecto 16.\n"
             "   -u <name>:<pass> Usuario y contraseña de usuario que puede usar el proxy. Hasta 10.\n"
             "   -o <log file>    Archivo de registro de accesos.\n"
+            "   -M <MB>          Memoria total para buffers de túneles. 0 = sin límite. Por defecto 512.\n"
             "   -N               Deshabilita disectores de protocolos.\n"
+            "   -S               Retransmite los túneles con splice(2) (requiere -N).\n"
+            "   -Z <KB>          Envía con MSG_ZEROCOPY las escrituras de túneles de al menos este tamaño. 0 = nunca. Por defecto 0.\n"
+            "   -w <threads>     Cantidad de workers (selectors en paralelo). Por defecto 1.\n"
+            "   -t <segundos>    Cierra los túneles inactivos por más de este tiempo. 0 = sin límite. Por defecto 300.\n"
             "   -v               Imprime información sobre la versión versión y termina.\n"
 
             "\n",
@@ -84,6 +169,19 @@ parse_args(const int argc, char** argv, struct socks5args* args)
 
     args->disectors_enabled = true;
     args->log_file = NULL;
+    args->workers = 1;
+    args->io_backend = SELECTOR_BACKEND_AUTO;
+    args->handshake_timeout = 10;
+    args->connect_timeout = 10;
+    args->idle_timeout = 300;
+    args->relay_buffer_max = 256 * 1024;
+    args->relay_buffer_total = 512 * 1024 * 1024;
+    args->resolver_threads = 16;
+    args->resolver_queue = 1024;
+    args->dns_cache_entries = 4096;
+    args->dns_prefetch_hot = DNSCACHE_DEFAULT_HOT;
+    args->dns_prefetch_window = DNSCACHE_DEFAULT_WINDOW;
+    pthread_rwlock_init(&args->users_lock, NULL);
 
     int c;
     int nusers = 0;
@@ -95,21 +193,53 @@ parse_args(const int argc, char** argv, struct socks5args* args)
             {0, 0, 0, 0}
         };
 
-        c = getopt_long(argc, argv, "hl:L:No:p:P:u:v", long_options, &option_index);
+        c = getopt_long(argc, argv, "A:b:B:C:DF:hHl:L:M:n:No:p:P:q:r:St:u:vw:W:Z:", long_options, &option_index);
         if (c == -1)
             break;
 
         switch (c)
         {
+        case 'A':
+            args->session_prealloc = size(optarg, "preallocated sessions", 1, 0, 1000000);
+            break;
+        case 'b':
+            args->io_backend = backend(optarg);
+            break;
+        case 'B':
+            args->relay_buffer_max = size(optarg, "buffer size (KB)", 1024, 1, 16384);
+            break;
+        case 'C':
+            args->dns_cache_entries = size(optarg, "DNS cache entries", 1, 0, 1000000);
+            break;
+        case 'D':
+            args->system_resolver = true;
+            break;
+        case 'F':
+            args->dns_prefetch_hot = size(optarg, "DNS prefetch hits", 1, 0, 1000000);
+            break;
         case 'h':
             usage(argv[0]);
             break;
+        case 'H':
+            args->session_hugepages = true;
+            break;
         case 'l':
             args->socks_addr = optarg;
             break;
         case 'L':
             args->mng_addr = optarg;
             break;
+        case 'M':
+            args->relay_buffer_total = size(optarg, "buffer memory (MB)", 1024 * 1024, 0, 1048576);
+            break;
+        case 'n':
+            if (args->nameserver_count >= DNS_MAX_SERVERS)
+            {
+                fprintf(stderr, "maximun number of name servers reached: %d.\n", DNS_MAX_SERVERS);
+                exit(1);
+            }
+            args->nameservers[args->nameserver_count++] = optarg;
+            break;
         case 'N':
             args->disectors_enabled = false;
             break;
@@ -122,6 +252,18 @@ parse_args(const int argc, char** argv, struct socks5args* args)
         case 'P':
             args->mng_port = port(optarg);
             break;
+        case 'q':
+            args->resolver_queue = size(optarg, "resolver queue", 1, 1, 1000000);
+            break;
+        case 'r':
+            args->resolver_threads = size(optarg, "resolver threads", 1, 1, 1024);
+            break;
+        case 'S':
+            args->splice_relay = true;
+            break;
+        case 't':
+            args->idle_timeout = seconds(optarg);
+            break;
         case 'u':
             if (nusers >= MAX_USERS)
             {
@@ -137,6 +279,15 @@ parse_args(const int argc, char** argv, struct socks5args* args)
         case 'v':
             version();
             exit(0);
+        case 'w':
+            args->workers = workers(optarg);
+            break;
+        case 'W':
+            args->dns_prefetch_window = size(optarg, "DNS prefetch window (%)", 1, 1, 100);
+            break;
+        case 'Z':
+            args->zerocopy_threshold = size(optarg, "zerocopy threshold (KB)", 1024, 0, 16384);
+            break;
         default:
             fprintf(stderr, "unknown argument %d.\n", c);
             exit(1);
@@ -10,8 +10,15 @@
 
 void 
 auth_parser_init(struct auth_parser *p) {
-    memset(p, 0, sizeof(*p));
-    p->state = auth_version;
+    // los arreglos de credenciales no se limpian: el parser los termina en
+    // '\0' al completarlos y auth_parser_close borra lo que se escribió
+    p->state        = auth_version;
+    p->remaining    = 0;
+    p->idx          = 0;
+    p->username[0]  = '\0';
+    p->username_len = 0;
+    p->password[0]  = '\0';
+    p->password_len = 0;
 }
 
 enum auth_state 
@@ -137,8 +144,9 @@ auth_marshall(buffer *b, const uint8_t status) {
 
 void 
 auth_parser_close(struct auth_parser *p) {
-    // limpiamos las credenciales de memoria por seguridad
-    memset(p->username, 0, sizeof(p->username));
-    memset(p->password, 0, sizeof(p->password));
+    // limpiamos las credenciales de memoria por seguridad. El parser nunca
+    // escribe más allá del largo declarado (y su '\0')
+    memset(p->username, 0, p->username_len + 1);
+    memset(p->password, 0, p->password_len + 1);
 }
 
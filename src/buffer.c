@@ -102,3 +102,109 @@ buffer_compact(buffer *b) {
     }
 }
 
+
+void
+ring_adopt(ring_buffer *r, buffer *b) {
+    r->data = b->data;
+    r->size = b->limit - b->data;
+    r->read = b->read  - b->data;
+    r->len  = b->write - b->read;
+}
+
+void
+ring_move(ring_buffer *r, uint8_t *data, const size_t size) {
+    assert(r->len <= size);
+    struct iovec iov[2];
+    const int n = ring_read_iov(r, iov);
+    size_t off = 0;
+    for(int i = 0; i < n; i++) {
+        memmove(data + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    r->data = data;
+    r->size = size;
+    r->read = 0;
+}
+
+inline bool
+ring_can_read(const ring_buffer *r) {
+    return r->len > 0;
+}
+
+inline bool
+ring_can_write(const ring_buffer *r) {
+    return r->len < r->size;
+}
+
+int
+ring_write_iov(ring_buffer *r, struct iovec iov[2]) {
+    const size_t space = r->size - r->len;
+    size_t write = r->read + r->len;
+    if(write >= r->size) {
+        write -= r->size;
+    }
+    if(space == 0) {
+        return 0;
+    }
+    // el espacio libre va desde `write' hasta el final, y sigue al principio
+    const size_t first = r->size - write < space ? r->size - write : space;
+    iov[0].iov_base = r->data + write;
+    iov[0].iov_len  = first;
+    if(first == space) {
+        return 1;
+    }
+    iov[1].iov_base = r->data;
+    iov[1].iov_len  = space - first;
+    return 2;
+}
+
+inline void
+ring_write_adv(ring_buffer *r, const ssize_t bytes) {
+    if(bytes > -1) {
+        r->len += (size_t) bytes;
+        assert(r->len <= r->size);
+    }
+}
+
+int
+ring_read_iov(ring_buffer *r, struct iovec iov[2]) {
+    return ring_peek_iov(r, 0, iov);
+}
+
+int
+ring_peek_iov(const ring_buffer *r, const size_t skip, struct iovec iov[2]) {
+    assert(skip <= r->len);
+    const size_t len = r->len - skip;
+    if(len == 0) {
+        return 0;
+    }
+    size_t start = r->read + skip;
+    if(start >= r->size) {
+        start -= r->size;
+    }
+    const size_t first = r->size - start < len ? r->size - start : len;
+    iov[0].iov_base = r->data + start;
+    iov[0].iov_len  = first;
+    if(first == len) {
+        return 1;
+    }
+    iov[1].iov_base = r->data;
+    iov[1].iov_len  = len - first;
+    return 2;
+}
+
+inline void
+ring_read_adv(ring_buffer *r, const ssize_t bytes) {
+    if(bytes > -1) {
+        assert((size_t) bytes <= r->len);
+        r->len  -= (size_t) bytes;
+        r->read += (size_t) bytes;
+        if(r->read >= r->size) {
+            r->read -= r->size;
+        }
+        if(r->len == 0) {
+            // vacío: volver al principio mantiene los segmentos contiguos
+            r->read = 0;
+        }
+    }
+}
@@ -0,0 +1,1353 @@
+/**
+ * dns.c - cliente DNS no bloqueante que corre en el selector
+ *
+ * Cada intento de una consulta sale de un socket UDP propio, con el puerto de
+ * origen que el kernel elige al azar, y lleva dos preguntas (A y AAAA) con
+ * ids al azar: una respuesta falsificada tiene que acertar los dos. De la
+ * respuesta solo se toman las direcciones del nombre preguntado o de los
+ * CNAME que salen de él. Las consultas en curso esperan en una lista
+ * ordenada por vencimiento: todos los intentos tienen el mismo plazo, así que
+ * alcanza con agregar al final. El timer de un eventfd del worker se arma
+ * para la primera de la lista.
+ *
+ * Los pedidos de un nombre que ya se está consultando en el worker esperan
+ * esa misma consulta, y al terminar cada uno recibe su copia del resultado.
+ *
+ * No se usan los dominios de búsqueda (`search') de resolv.conf: los nombres
+ * que pide un cliente SOCKS son absolutos.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+#include "dnscache.h"
+#include "netutils.h"
+
+#define DNS_PORT           53
+/** plazo de cada intento e intentos por servidor si resolv.conf no dice */
+#define DNS_TIMEOUT_MS     5000
+#define DNS_ATTEMPTS       2
+/** topes de las opciones timeout y attempts (ver resolv.conf(5)) */
+#define DNS_TIMEOUT_MAX    30
+#define DNS_ATTEMPTS_MAX   5
+
+/** mensaje más largo por UDP, sin EDNS */
+#define DNS_UDP_MAX        512
+#define DNS_HEADER_LEN     12
+/** nombre más largo en texto, sin el punto final */
+#define DNS_NAME_MAX       253
+
+#define DNS_TYPE_A         1
+#define DNS_TYPE_CNAME     5
+#define DNS_TYPE_AAAA      28
+#define DNS_CLASS_IN       1
+#define DNS_FLAG_QR        0x8000
+#define DNS_FLAG_TC        0x0200
+#define DNS_FLAG_RD        0x0100
+#define DNS_RCODE_MASK     0x000f
+#define DNS_RCODE_NXDOMAIN 3
+
+/** buckets de la tabla de nombres. Potencia de 2 */
+#define DNS_BUCKETS        4096
+/** consultas en curso por worker: cada una ocupa un socket */
+#define DNS_MAX_INFLIGHT   16384
+/** direcciones que se conservan por pregunta */
+#define DNS_MAX_ADDRS      16
+/** CNAME encadenados que se siguen dentro de una respuesta */
+#define DNS_CNAME_MAX      8
+
+////////////////////////////////////////////////////////////////////////////////
+// CONFIGURACIÓN
+////////////////////////////////////////////////////////////////////////////////
+
+/** una dirección de /etc/hosts */
+struct dns_host {
+    struct dns_host *next;
+    int              family;
+    union {
+        struct in_addr  v4;
+        struct in6_addr v6;
+    }                addr;
+    char             name[];
+};
+
+static struct {
+    struct sockaddr_storage servers[DNS_MAX_SERVERS];
+    socklen_t               server_lens[DNS_MAX_SERVERS];
+    unsigned                count;
+    unsigned                timeout_ms;
+    unsigned                attempts;
+    struct dns_host        *hosts;
+} config;
+
+/**
+ * interpreta "dirección", "dirección:puerto" o "[IPv6]:puerto". false si no
+ * es una dirección IP válida.
+ */
+static bool
+dns_parse_server(const char *s, struct sockaddr_storage *ss, socklen_t *len) {
+    char        host[INET6_ADDRSTRLEN];
+    const char *rest;
+    size_t      n;
+
+    if(*s == '[') {
+        const char *end = strchr(s, ']');
+        if(end == NULL) {
+            return false;
+        }
+        n    = end - (s + 1);
+        s   += 1;
+        rest = end + 1;
+    } else {
+        const char *colon = strchr(s, ':');
+        if(colon != NULL && strchr(colon + 1, ':') == NULL) {
+            n    = colon - s;
+            rest = colon;
+        } else {
+            n    = strlen(s);
+            rest = s + n;
+        }
+    }
+    if(n >= sizeof(host)) {
+        return false;
+    }
+    memcpy(host, s, n);
+    host[n] = '\0';
+
+    long port = DNS_PORT;
+    if(*rest == ':') {
+        char *end;
+        port = strtol(rest + 1, &end, 10);
+        if(end == rest + 1 || *end != '\0' || port < 1 || port > 65535) {
+            return false;
+        }
+    } else if(*rest != '\0') {
+        return false;
+    }
+
+    memset(ss, 0, sizeof(*ss));
+    struct sockaddr_in  *in  = (struct sockaddr_in *)  ss;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) ss;
+    if(inet_pton(AF_INET, host, &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+        in->sin_port   = htons(port);
+        *len = sizeof(*in);
+    } else if(inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port   = htons(port);
+        *len = sizeof(*in6);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool
+dns_add_server(const char *s) {
+    if(config.count == DNS_MAX_SERVERS) {
+        return true;
+    }
+    if(!dns_parse_server(s, &config.servers[config.count],
+                         &config.server_lens[config.count])) {
+        return false;
+    }
+    config.count++;
+    return true;
+}
+
+/** opciones timeout:N y attempts:N, separadas por blancos */
+static void
+dns_parse_options(char *options) {
+    char *save = NULL;
+    const char *value;
+    for(value = strtok_r(options, " \t\r\n", &save); value != NULL;
+        value = strtok_r(NULL, " \t\r\n", &save)) {
+        unsigned n;
+        if(sscanf(value, "timeout:%u", &n) == 1) {
+            n = n < 1 ? 1 : n > DNS_TIMEOUT_MAX ? DNS_TIMEOUT_MAX : n;
+            config.timeout_ms = n * 1000;
+        } else if(sscanf(value, "attempts:%u", &n) == 1) {
+            config.attempts = n < 1 ? 1 : n > DNS_ATTEMPTS_MAX ? DNS_ATTEMPTS_MAX : n;
+        }
+    }
+}
+
+/** servidores (si `load_servers') y opciones de /etc/resolv.conf */
+static void
+dns_load_resolv_conf(const bool load_servers) {
+    FILE *f = fopen("/etc/resolv.conf", "r");
+    if(f == NULL) {
+        return;
+    }
+    char line[512];
+    while(fgets(line, sizeof(line), f) != NULL) {
+        const size_t len = strcspn(line, " \t\r\n");
+        char *rest = line[len] == '\0' ? line + len : line + len + 1;
+        line[len] = '\0';
+        if(strcmp(line, "nameserver") == 0 && load_servers) {
+            char *save = NULL;
+            const char *value = strtok_r(rest, " \t\r\n", &save);
+            if(value != NULL) {
+                // las que no entiende (con zona IPv6, por ejemplo) se ignoran
+                dns_add_server(value);
+            }
+        } else if(strcmp(line, "options") == 0) {
+            dns_parse_options(rest);
+        }
+    }
+    fclose(f);
+}
+
+static void
+dns_load_hosts(void) {
+    FILE *f = fopen("/etc/hosts", "r");
+    if(f == NULL) {
+        return;
+    }
+    char line[1024];
+    while(fgets(line, sizeof(line), f) != NULL) {
+        char *comment = strchr(line, '#');
+        if(comment != NULL) {
+            *comment = '\0';
+        }
+        char *save = NULL;
+        const char *addr = strtok_r(line, " \t\r\n", &save);
+        if(addr == NULL) {
+            continue;
+        }
+        struct dns_host proto;
+        if(inet_pton(AF_INET, addr, &proto.addr.v4) == 1) {
+            proto.family = AF_INET;
+        } else if(inet_pton(AF_INET6, addr, &proto.addr.v6) == 1) {
+            proto.family = AF_INET6;
+        } else {
+            continue;
+        }
+        const char *name;
+        while((name = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            const size_t len = strlen(name);
+            struct dns_host *h = malloc(sizeof(*h) + len + 1);
+            if(h == NULL) {
+                break;
+            }
+            h->family = proto.family;
+            h->addr   = proto.addr;
+            for(size_t i = 0; i <= len; i++) {
+                h->name[i] = tolower((unsigned char) name[i]);
+            }
+            h->next      = config.hosts;
+            config.hosts = h;
+        }
+    }
+    fclose(f);
+}
+
+bool
+dns_init(char *const *servers, const unsigned count) {
+    config.count      = 0;
+    config.timeout_ms = DNS_TIMEOUT_MS;
+    config.attempts   = DNS_ATTEMPTS;
+
+    for(unsigned i = 0; i < count; i++) {
+        if(!dns_add_server(servers[i])) {
+            return false;
+        }
+    }
+    dns_load_resolv_conf(count == 0);
+    // como en glibc, RES_OPTIONS pisa las opciones de resolv.conf
+    const char *env = getenv("RES_OPTIONS");
+    if(env != NULL) {
+        char options[256];
+        snprintf(options, sizeof(options), "%s", env);
+        dns_parse_options(options);
+    }
+    if(config.count == 0) {
+        // sin servidores configurados se consulta al local (ver resolv.conf(5))
+        dns_add_server("127.0.0.1");
+    }
+    dns_load_hosts();
+    return true;
+}
+
+void
+dns_destroy(void) {
+    struct dns_host *next;
+    for(struct dns_host *h = config.hosts; h != NULL; h = next) {
+        next = h->next;
+        free(h);
+    }
+    config.hosts = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ESTADO DE CADA WORKER
+////////////////////////////////////////////////////////////////////////////////
+
+struct dns_client;
+struct dns_query;
+struct dns_tcp;
+
+/** una de las dos preguntas de una consulta */
+struct dns_question {
+    struct dns_query    *query;
+    uint16_t             id, type;
+    /** ya llegó la respuesta (o no se va a esperar más) */
+    bool                 done;
+    /** la respuesta llegó truncada y se está repitiendo por TCP */
+    struct dns_tcp      *tcp;
+    struct addrinfo     *answers;
+    unsigned             count;
+};
+
+/** un pedido que espera el resultado de una consulta */
+struct dns_waiter {
+    /** siguiente de la consulta, o en la lista de avisos pendientes */
+    struct dns_waiter   *next;
+    int                  fd;
+    in_port_t            port;
+    struct addrinfo    **result;
+};
+
+struct dns_query {
+    struct dns_client   *client;
+    /** vecinas en la lista de vencimientos */
+    struct dns_query    *prev, *next;
+    /** siguiente en el bucket de su nombre */
+    struct dns_query    *hnext;
+    /** el primero es quien la inició: sus direcciones llevan su puerto */
+    struct dns_waiter   *waiters;
+    in_port_t            port;
+    /** intentos hechos (0: nunca se envió) y servidor del último */
+    unsigned             tries, server;
+    /** socket UDP del último intento; -1 si no tiene */
+    int                  fd;
+    uint64_t             deadline;
+    /** menor TTL de las respuestas, en segundos */
+    uint32_t             ttl;
+    /** alguna pregunta quedó sin respuesta (no es lo mismo que NXDOMAIN) */
+    bool                 failed;
+    struct dns_question  questions[2];
+    char                 name[DNS_NAME_MAX + 1];
+};
+
+/** una pregunta repetida por TCP */
+struct dns_tcp {
+    struct dns_client   *client;
+    /** NULL si la consulta terminó antes */
+    struct dns_question *question;
+    int                  fd;
+    unsigned             server;
+    /** la pregunta, con su largo adelante */
+    uint8_t              out[2 + DNS_UDP_MAX];
+    size_t               out_len, sent;
+    /** la respuesta: primero su largo, después el mensaje */
+    uint8_t              in_len_bytes[2];
+    uint8_t             *in;
+    size_t               in_len, got;
+};
+
+struct dns_client {
+    fd_selector          selector;
+    /** eventfd cuyo timer se usa; -1 si ya se cerró */
+    int                  clock;
+    bool                 armed;
+    /**
+     * descriptores registrados (el del timer, los UDP de las consultas y los
+     * TCP); al cerrarse el último se libera
+     */
+    unsigned             open;
+    /** consultas en curso, por nombre */
+    struct dns_query    *names[DNS_BUCKETS];
+    /** consultas en curso, por vencimiento */
+    struct dns_query    *head, *tail;
+    /** pedidos cuyo aviso no entró en la cola del selector */
+    struct dns_waiter   *undelivered;
+    unsigned             inflight;
+    uint32_t             rng;
+};
+
+static _Thread_local struct dns_client *worker_client = NULL;
+
+static uint64_t
+dns_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** xorshift32: los ids no tienen que ser criptográficos, solo impredecibles */
+static uint16_t
+dns_rand(struct dns_client *c) {
+    uint32_t x = c->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->rng = x;
+    return (uint16_t) (x >> 8);
+}
+
+static struct dns_query **
+dns_name_slot(struct dns_client *c, const char *name) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(const char *p = name; *p != '\0'; p++) {
+        h = (h ^ (uint8_t) *p) * 16777619u;
+    }
+    struct dns_query **slot = &c->names[h & (DNS_BUCKETS - 1)];
+    while(*slot != NULL && strcmp((*slot)->name, name) != 0) {
+        slot = &(*slot)->hnext;
+    }
+    return slot;
+}
+
+static void
+dns_list_remove(struct dns_client *c, struct dns_query *q) {
+    if(q->prev != NULL) {
+        q->prev->next = q->next;
+    } else {
+        c->head = q->next;
+    }
+    if(q->next != NULL) {
+        q->next->prev = q->prev;
+    } else {
+        c->tail = q->prev;
+    }
+    q->prev = q->next = NULL;
+}
+
+static void
+dns_list_append(struct dns_client *c, struct dns_query *q) {
+    q->next = NULL;
+    q->prev = c->tail;
+    if(c->tail != NULL) {
+        c->tail->next = q;
+    } else {
+        c->head = q;
+    }
+    c->tail = q;
+}
+
+/** arma el timer para la primera consulta, si no está armado */
+static void
+dns_arm(struct dns_client *c) {
+    if(c->armed || c->clock == -1) {
+        return;
+    }
+    unsigned ms;
+    if(c->undelivered != NULL) {
+        ms = 1;
+    } else if(c->head != NULL) {
+        const uint64_t now = dns_now_ms();
+        ms = c->head->deadline > now ? c->head->deadline - now : 1;
+    } else {
+        return;
+    }
+    if(SELECTOR_SUCCESS == selector_set_timeout(c->selector, c->clock, ms)) {
+        c->armed = true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MENSAJES
+////////////////////////////////////////////////////////////////////////////////
+
+/** arma la pregunta por `name' (ya validado) en `buf'. Retorna su largo */
+static size_t
+dns_build(uint8_t *buf, const uint16_t id, const char *name, const uint16_t type) {
+    uint8_t *p = buf;
+
+    *p++ = id >> 8;
+    *p++ = id & 0xff;
+    *p++ = DNS_FLAG_RD >> 8;
+    *p++ = 0;
+    *p++ = 0;           // una pregunta
+    *p++ = 1;
+    memset(p, 0, 6);    // sin respuestas ni registros adicionales
+    p += 6;
+
+    const char *label = name;
+    while(*label != '\0') {
+        const char  *dot = strchr(label, '.');
+        const size_t len = dot == NULL ? strlen(label) : (size_t) (dot - label);
+        *p++ = len;
+        memcpy(p, label, len);
+        p     += len;
+        label += len + (dot != NULL);
+    }
+    *p++ = 0;
+
+    *p++ = type >> 8;
+    *p++ = type & 0xff;
+    *p++ = 0;
+    *p++ = DNS_CLASS_IN;
+    return p - buf;
+}
+
+/**
+ * lee el nombre que empieza en `off' como texto en minúsculas y sin punto
+ * final. Retorna el offset siguiente al nombre, o 0 si es inválido.
+ */
+static size_t
+dns_read_name(const uint8_t *msg, const size_t len, size_t off, char out[DNS_NAME_MAX + 1]) {
+    size_t   next  = 0;
+    size_t   n     = 0;
+    unsigned jumps = 0;
+
+    for(;;) {
+        if(off >= len) {
+            return 0;
+        }
+        const uint8_t l = msg[off];
+        if(l == 0) {
+            off++;
+            break;
+        }
+        if((l & 0xc0) == 0xc0) {
+            // puntero de compresión
+            if(off + 1 >= len || ++jumps > 16) {
+                return 0;
+            }
+            if(next == 0) {
+                next = off + 2;
+            }
+            off = ((l & 0x3f) << 8) | msg[off + 1];
+            continue;
+        }
+        // el punto que lo separa del anterior también ocupa lugar
+        if((l & 0xc0) != 0 || off + 1 + l > len || n + (n > 0) + l > DNS_NAME_MAX) {
+            return 0;
+        }
+        if(n > 0) {
+            out[n++] = '.';
+        }
+        for(unsigned i = 0; i < l; i++) {
+            out[n++] = tolower(msg[off + 1 + i]);
+        }
+        off += 1 + l;
+    }
+    out[n] = '\0';
+    return next != 0 ? next : off;
+}
+
+static struct addrinfo *
+dns_addrinfo(const int family, const void *addr, const in_port_t port) {
+    struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in6));
+    if(ai == NULL) {
+        return NULL;
+    }
+    ai->ai_family   = family;
+    ai->ai_socktype = SOCK_STREAM;
+    ai->ai_protocol = IPPROTO_TCP;
+    ai->ai_addr     = (struct sockaddr *)(ai + 1);
+    if(family == AF_INET) {
+        struct sockaddr_in *in = (struct sockaddr_in *) ai->ai_addr;
+        in->sin_family = AF_INET;
+        in->sin_port   = port;
+        memcpy(&in->sin_addr, addr, sizeof(in->sin_addr));
+        ai->ai_addrlen = sizeof(*in);
+    } else {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) ai->ai_addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port   = port;
+        memcpy(&in6->sin6_addr, addr, sizeof(in6->sin6_addr));
+        ai->ai_addrlen = sizeof(*in6);
+    }
+    return ai;
+}
+
+/** agrega una dirección al final de las de la pregunta */
+static void
+dns_question_add(struct dns_question *q, const void *addr) {
+    if(q->count == DNS_MAX_ADDRS) {
+        return;
+    }
+    const int family = q->type == DNS_TYPE_A ? AF_INET : AF_INET6;
+    struct addrinfo *ai = dns_addrinfo(family, addr, q->query->port);
+    if(ai == NULL) {
+        return;
+    }
+    struct addrinfo **p = &q->answers;
+    while(*p != NULL) {
+        p = &(*p)->ai_next;
+    }
+    *p = ai;
+    q->count++;
+}
+
+/** un registro de la sección de respuestas */
+struct dns_rr {
+    char     owner[DNS_NAME_MAX + 1];
+    uint16_t type, class;
+    uint32_t ttl;
+    /** dónde empiezan los datos, y su largo */
+    size_t   data, n;
+};
+
+/** lee el registro que empieza en `off'. Retorna el offset del siguiente, o 0 */
+static size_t
+dns_read_rr(const uint8_t *msg, const size_t len, size_t off, struct dns_rr *rr) {
+    if((off = dns_read_name(msg, len, off, rr->owner)) == 0 || off + 10 > len) {
+        return 0;
+    }
+    rr->type  = (msg[off] << 8) | msg[off + 1];
+    rr->class = (msg[off + 2] << 8) | msg[off + 3];
+    rr->ttl   = ((uint32_t) msg[off + 4] << 24) | (msg[off + 5] << 16)
+              | (msg[off + 6] << 8) | msg[off + 7];
+    rr->n     = (msg[off + 8] << 8) | msg[off + 9];
+    rr->data  = off + 10;
+    return rr->data + rr->n > len ? 0 : rr->data + rr->n;
+}
+
+/**
+ * registros A o AAAA (según la pregunta) de la sección de respuestas, a
+ * nombre del preguntado o de la cadena de CNAME que sale de él: los de otros
+ * nombres no son respuesta a la pregunta y se ignoran. El TTL de la consulta
+ * es el menor de los registros que se usaron, CNAME incluidos.
+ */
+static void
+dns_parse_answers(struct dns_question *q, const uint8_t *msg, const size_t len,
+                  const size_t start, const unsigned answers) {
+    const size_t rdlen = q->type == DNS_TYPE_A ? 4 : 16;
+    char          chain[DNS_CNAME_MAX + 1][DNS_NAME_MAX + 1];
+    unsigned      names = 1;
+    uint32_t      ttl   = UINT32_MAX;
+    struct dns_rr rr;
+    size_t        off;
+
+    // la cadena se arma en el orden que sea: se recorre hasta que no crezca.
+    // Un ciclo solo repite nombres hasta el tope
+    strcpy(chain[0], q->query->name);
+    for(bool grew = true; grew; ) {
+        grew = false;
+        off  = start;
+        for(unsigned i = 0; i < answers && names <= DNS_CNAME_MAX; i++) {
+            if((off = dns_read_rr(msg, len, off, &rr)) == 0) {
+                break;
+            }
+            if(rr.type == DNS_TYPE_CNAME && rr.class == DNS_CLASS_IN
+               && strcmp(rr.owner, chain[names - 1]) == 0
+               && dns_read_name(msg, len, rr.data, chain[names]) != 0) {
+                if(rr.ttl < ttl) {
+                    ttl = rr.ttl;
+                }
+                names++;
+                grew = true;
+            }
+        }
+    }
+
+    off = start;
+    for(unsigned i = 0; i < answers; i++) {
+        if((off = dns_read_rr(msg, len, off, &rr)) == 0) {
+            break;
+        }
+        if(rr.type != q->type || rr.class != DNS_CLASS_IN || rr.n != rdlen) {
+            continue;
+        }
+        for(unsigned j = 0; j < names; j++) {
+            if(strcmp(rr.owner, chain[j]) == 0) {
+                if(rr.ttl < ttl) {
+                    ttl = rr.ttl;
+                }
+                dns_question_add(q, msg + rr.data);
+                break;
+            }
+        }
+    }
+    if(ttl < q->query->ttl) {
+        q->query->ttl = ttl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSULTAS
+////////////////////////////////////////////////////////////////////////////////
+
+static void dns_tcp_cancel(struct dns_client *c, struct dns_question *q);
+static bool dns_tcp_start(struct dns_client *c, struct dns_question *q, unsigned server);
+static bool dns_udp_open(struct dns_client *c, struct dns_query *q, unsigned server);
+static void dns_udp_drop(struct dns_client *c, struct dns_query *q);
+static void dns_query_retry(struct dns_client *c, struct dns_query *q);
+
+/**
+ * avisa que el resultado está listo; si la cola de avisos del selector está
+ * llena lo deja para el timer
+ */
+static void
+dns_waiter_deliver(struct dns_client *c, struct dns_waiter *w) {
+    if(SELECTOR_SUCCESS == selector_notify_block(c->selector, w->fd)) {
+        free(w);
+        return;
+    }
+    w->next        = c->undelivered;
+    c->undelivered = w;
+    if(c->armed && c->undelivered->next == NULL) {
+        // estaba armado para un vencimiento: que despierte antes
+        c->armed = false;
+    }
+    dns_arm(c);
+}
+
+/**
+ * terminó la consulta: las direcciones IPv4 primero, y después las IPv6,
+ * quedan para el pedido (y en el caché, si se consultó) y se le avisa
+ */
+static void
+dns_query_finish(struct dns_client *c, struct dns_query *q) {
+    if(q->tries > 0) {
+        dns_list_remove(c, q);
+        struct dns_query **slot = dns_name_slot(c, q->name);
+        *slot = q->hnext;
+    }
+    dns_udp_drop(c, q);
+    for(unsigned i = 0; i < 2; i++) {
+        dns_tcp_cancel(c, &q->questions[i]);
+    }
+
+    struct addrinfo **tail = &q->questions[0].answers;
+    while(*tail != NULL) {
+        tail = &(*tail)->ai_next;
+    }
+    *tail = q->questions[1].answers;
+    struct addrinfo *answers = q->questions[0].answers;
+    c->inflight--;
+
+    if(q->tries > 0) {
+        const unsigned ttl = answers != NULL ? q->ttl
+                           : q->failed ? DNSCACHE_FAILURE_TTL : DNSCACHE_NEGATIVE_TTL;
+        dnscache_store(q->name, answers, ttl);
+    }
+
+    struct dns_waiter *w = q->waiters, *next;
+    if(w == NULL) {
+        // una renovación del caché que ningún pedido esperó
+        freeaddrinfo(answers);
+        free(q);
+        return;
+    }
+    // el primero se queda con las direcciones, los demás con una copia
+    for(w = w->next; w != NULL; w = next) {
+        next = w->next;
+        *w->result = addrinfo_copy(answers, w->port);
+        dns_waiter_deliver(c, w);
+    }
+    // si se sumó a una renovación, las direcciones no tienen su puerto
+    w = q->waiters;
+    addrinfo_set_port(answers, w->port);
+    *w->result = answers;
+    dns_waiter_deliver(c, w);
+    free(q);
+}
+
+/**
+ * envía las preguntas sin responder al siguiente servidor, desde un socket
+ * nuevo: lo que responda un intento anterior (un SERVFAIL atrasado, por
+ * ejemplo) ya no llega. false si era el primer intento y no se pudo abrir
+ * ningún socket: la consulta queda como estaba, para que la descarte quien
+ * la inició
+ */
+static bool
+dns_query_send(struct dns_client *c, struct dns_query *q) {
+    dns_udp_drop(c, q);
+    unsigned server = DNS_MAX_SERVERS;
+    for(unsigned i = 0; i < config.count; i++) {
+        const unsigned s = (q->tries + i) % config.count;
+        if(dns_udp_open(c, q, s)) {
+            server = s;
+            break;
+        }
+    }
+    if(server == DNS_MAX_SERVERS) {
+        if(q->tries == 0) {
+            return false;
+        }
+        q->failed = true;
+        dns_query_finish(c, q);
+        return true;
+    }
+
+    bool refused = false;
+    for(unsigned i = 0; i < 2; i++) {
+        struct dns_question *qn = &q->questions[i];
+        if(!qn->done && qn->tcp == NULL) {
+            // ids nuevos en cada intento, distintos entre sí
+            do {
+                qn->id = dns_rand(c);
+            } while(i == 1 && qn->id == q->questions[0].id);
+            uint8_t buf[DNS_UDP_MAX];
+            const size_t n = dns_build(buf, qn->id, q->name, qn->type);
+            // si no sale, se reintenta al vencer el plazo. El rechazo del
+            // primer mensaje puede aparecer acá en lugar de en recv()
+            if(send(q->fd, buf, n, MSG_NOSIGNAL) == -1 && errno == ECONNREFUSED) {
+                refused = true;
+            }
+        }
+    }
+
+    if(q->tries > 0) {
+        dns_list_remove(c, q);
+    } else {
+        struct dns_query **slot = dns_name_slot(c, q->name);
+        q->hnext = *slot;
+        *slot    = q;
+    }
+    q->tries++;
+    q->server   = server;
+    q->deadline = dns_now_ms() + config.timeout_ms;
+    dns_list_append(c, q);
+    dns_arm(c);
+    if(refused) {
+        dns_query_retry(c, q);
+    }
+    return true;
+}
+
+/** reintenta con el siguiente servidor, o termina si no quedan intentos */
+static void
+dns_query_retry(struct dns_client *c, struct dns_query *q) {
+    if(q->tries < config.attempts * config.count) {
+        dns_query_send(c, q);
+    } else {
+        q->failed = true;
+        dns_query_finish(c, q);
+    }
+}
+
+static void
+dns_question_done(struct dns_client *c, struct dns_question *qn) {
+    qn->done = true;
+    struct dns_query *q = qn->query;
+    if(q->questions[0].done && q->questions[1].done) {
+        dns_query_finish(c, q);
+    }
+}
+
+/**
+ * procesa una respuesta a `qn' que llegó del servidor `server', por el
+ * socket UDP de su consulta o por TCP
+ */
+static void
+dns_response(struct dns_client *c, struct dns_question *qn, const uint8_t *msg,
+             const size_t len, const bool tcp, const unsigned server) {
+    if(len < DNS_HEADER_LEN) {
+        return;
+    }
+    const uint16_t id      = (msg[0] << 8) | msg[1];
+    const uint16_t flags   = (msg[2] << 8) | msg[3];
+    const uint16_t qdcount = (msg[4] << 8) | msg[5];
+    const uint16_t ancount = (msg[6] << 8) | msg[7];
+
+    if(id != qn->id || qn->done || (qn->tcp != NULL && !tcp)
+       || !(flags & DNS_FLAG_QR) || qdcount != 1) {
+        return;
+    }
+
+    // la pregunta tiene que ser la nuestra
+    char name[DNS_NAME_MAX + 1];
+    size_t off = dns_read_name(msg, len, DNS_HEADER_LEN, name);
+    if(off == 0 || off + 4 > len || strcmp(name, qn->query->name) != 0
+       || ((msg[off] << 8) | msg[off + 1]) != qn->type
+       || ((msg[off + 2] << 8) | msg[off + 3]) != DNS_CLASS_IN) {
+        return;
+    }
+    off += 4;
+
+    if((flags & DNS_FLAG_TC) && !tcp) {
+        if(!dns_tcp_start(c, qn, server)) {
+            qn->query->failed = true;
+            dns_question_done(c, qn);
+        }
+        return;
+    }
+
+    switch(flags & DNS_RCODE_MASK) {
+        case 0:
+            dns_parse_answers(qn, msg, len, off, ancount);
+            break;
+        case DNS_RCODE_NXDOMAIN:
+            break;
+        default:
+            // SERVFAIL, REFUSED...: que pruebe otro servidor
+            dns_query_retry(c, qn->query);
+            return;
+    }
+    dns_question_done(c, qn);
+}
+
+/** libera el estado del worker cuando se cerró su último descriptor */
+static void
+dns_client_release(struct dns_client *c) {
+    if(--c->open > 0) {
+        return;
+    }
+    struct dns_waiter *w, *wnext;
+    struct dns_query  *q, *next;
+    for(q = c->head; q != NULL; q = next) {
+        next = q->next;
+        freeaddrinfo(q->questions[0].answers);
+        freeaddrinfo(q->questions[1].answers);
+        for(w = q->waiters; w != NULL; w = wnext) {
+            wnext = w->next;
+            free(w);
+        }
+        free(q);
+    }
+    // las direcciones de éstos ya son de su pedido
+    for(w = c->undelivered; w != NULL; w = wnext) {
+        wnext = w->next;
+        free(w);
+    }
+    if(worker_client == c) {
+        worker_client = NULL;
+    }
+    free(c);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SOCKETS UDP Y TIMER
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+dns_udp_read(struct selector_key *key) {
+    struct dns_query  *q = key->data;
+    struct dns_client *c = q->client;
+    uint8_t buf[DNS_UDP_MAX];
+
+    // un mensaje por vez: la respuesta puede terminar la consulta y cerrar
+    // el socket
+    const ssize_t n = recv(key->fd, buf, sizeof(buf), 0);
+    if(n >= DNS_HEADER_LEN) {
+        const uint16_t id = (buf[0] << 8) | buf[1];
+        for(unsigned i = 0; i < 2; i++) {
+            if(q->questions[i].id == id) {
+                dns_response(c, &q->questions[i], buf, n, false, q->server);
+                break;
+            }
+        }
+    } else if(n == -1 && errno == ECONNREFUSED) {
+        // el servidor rechazó el mensaje (ICMP port unreachable): se pasa al
+        // siguiente sin esperar el plazo
+        dns_query_retry(c, q);
+    }
+}
+
+static void
+dns_udp_close(struct selector_key *key) {
+    struct dns_query *q = key->data;
+    q->fd = -1;
+    close(key->fd);
+    dns_client_release(q->client);
+}
+
+static const struct fd_handler dns_udp_handler = {
+    .handle_read  = dns_udp_read,
+    .handle_close = dns_udp_close,
+};
+
+/**
+ * abre el socket de un intento de la consulta, conectado al servidor
+ * `server'. Al conectarlo el kernel le asigna un puerto de origen al azar
+ * (de ip_local_port_range).
+ */
+static bool
+dns_udp_open(struct dns_client *c, struct dns_query *q, const unsigned server) {
+    const struct sockaddr *addr = (const struct sockaddr *) &config.servers[server];
+    const int fd = socket(addr->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd == -1) {
+        return false;
+    }
+    if(connect(fd, addr, config.server_lens[server]) == -1
+       || SELECTOR_SUCCESS != selector_register(c->selector, fd, &dns_udp_handler, OP_READ, q)) {
+        close(fd);
+        return false;
+    }
+    q->fd = fd;
+    c->open++;
+    return true;
+}
+
+/** cierra el socket del último intento de la consulta, si tiene */
+static void
+dns_udp_drop(struct dns_client *c, struct dns_query *q) {
+    if(q->fd != -1) {
+        selector_unregister_fd(c->selector, q->fd);
+    }
+}
+
+/** venció el plazo de la primera consulta, o hay avisos sin entregar */
+static void
+dns_clock_timeout(struct selector_key *key) {
+    struct dns_client *c = key->data;
+    c->armed = false;
+
+    struct dns_waiter *pending = c->undelivered;
+    c->undelivered = NULL;
+    while(pending != NULL) {
+        struct dns_waiter *w = pending;
+        pending = w->next;
+        if(SELECTOR_SUCCESS == selector_notify_block(c->selector, w->fd)) {
+            free(w);
+        } else {
+            w->next        = c->undelivered;
+            c->undelivered = w;
+        }
+    }
+
+    const uint64_t now = dns_now_ms();
+    while(c->head != NULL && c->head->deadline <= now) {
+        // al reintentar pasa al final con un vencimiento posterior
+        dns_query_retry(c, c->head);
+    }
+    dns_arm(c);
+}
+
+static void
+dns_clock_close(struct selector_key *key) {
+    struct dns_client *c = key->data;
+    c->clock = -1;
+    close(key->fd);
+    dns_client_release(c);
+}
+
+static const struct fd_handler dns_clock_handler = {
+    .handle_timeout = dns_clock_timeout,
+    .handle_close   = dns_clock_close,
+};
+
+/** el estado del worker, creándolo la primera vez */
+static struct dns_client *
+dns_client_get(fd_selector s) {
+    if(worker_client != NULL) {
+        return worker_client;
+    }
+    if(config.count == 0) {
+        return NULL;
+    }
+    struct dns_client *c = calloc(1, sizeof(*c));
+    if(c == NULL) {
+        return NULL;
+    }
+    c->selector = s;
+    if(getrandom(&c->rng, sizeof(c->rng), GRND_NONBLOCK) != sizeof(c->rng)) {
+        c->rng = (uint32_t) dns_now_ms() ^ (uint32_t) getpid();
+    }
+    c->rng |= 1;
+
+    // el timer necesita un descriptor registrado; éste no tiene eventos
+    c->clock = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(c->clock == -1) {
+        free(c);
+        return NULL;
+    }
+    if(SELECTOR_SUCCESS != selector_register(s, c->clock, &dns_clock_handler, OP_NOOP, c)) {
+        close(c->clock);
+        free(c);
+        return NULL;
+    }
+    c->open = 1;
+    worker_client = c;
+    return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TCP (RESPUESTAS TRUNCADAS)
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+dns_tcp_fail(struct selector_key *key) {
+    struct dns_tcp *t = key->data;
+    struct dns_client   *c  = t->client;
+    struct dns_question *qn = t->question;
+
+    selector_unregister_fd(key->s, key->fd);
+    if(qn != NULL) {
+        qn->query->failed = true;
+        dns_question_done(c, qn);
+    }
+}
+
+static void
+dns_tcp_write(struct selector_key *key) {
+    struct dns_tcp *t = key->data;
+    const ssize_t n = send(key->fd, t->out + t->sent, t->out_len - t->sent, MSG_NOSIGNAL);
+    if(n == -1) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            dns_tcp_fail(key);
+        }
+        return;
+    }
+    t->sent += n;
+    if(t->sent == t->out_len) {
+        selector_set_interest_key(key, OP_READ);
+    }
+}
+
+static void
+dns_tcp_read(struct selector_key *key) {
+    struct dns_tcp *t = key->data;
+    ssize_t n;
+
+    if(t->got < 2) {
+        n = recv(key->fd, t->in_len_bytes + t->got, 2 - t->got, 0);
+        if(n > 0 && (t->got += n) == 2) {
+            t->in_len = (t->in_len_bytes[0] << 8) | t->in_len_bytes[1];
+            if(t->in_len < DNS_HEADER_LEN || (t->in = malloc(t->in_len)) == NULL) {
+                n = 0;
+            }
+        }
+    } else {
+        n = recv(key->fd, t->in + t->got - 2, t->in_len - (t->got - 2), 0);
+        if(n > 0) {
+            t->got += n;
+        }
+    }
+    if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if(n <= 0) {
+        dns_tcp_fail(key);
+        return;
+    }
+    if(t->got < 2 || t->got - 2 < t->in_len) {
+        return;
+    }
+
+    // la respuesta se procesa después de cerrar: puede terminar la consulta
+    struct dns_client   *c      = t->client;
+    struct dns_question *qn     = t->question;
+    const unsigned       server = t->server;
+    uint8_t             *msg    = t->in;
+    const size_t         len    = t->in_len;
+    t->in = NULL;
+    selector_unregister_fd(key->s, key->fd);
+    if(qn != NULL) {
+        dns_response(c, qn, msg, len, true, server);
+    }
+    free(msg);
+}
+
+static void
+dns_tcp_close(struct selector_key *key) {
+    struct dns_tcp *t = key->data;
+    if(t->question != NULL) {
+        t->question->tcp = NULL;
+    }
+    close(t->fd);
+    free(t->in);
+    struct dns_client *c = t->client;
+    free(t);
+    dns_client_release(c);
+}
+
+static const struct fd_handler dns_tcp_handler = {
+    .handle_read  = dns_tcp_read,
+    .handle_write = dns_tcp_write,
+    .handle_close = dns_tcp_close,
+};
+
+static bool
+dns_tcp_start(struct dns_client *c, struct dns_question *qn, const unsigned server) {
+    struct dns_tcp *t = calloc(1, sizeof(*t));
+    if(t == NULL) {
+        return false;
+    }
+    const struct sockaddr *addr = (const struct sockaddr *) &config.servers[server];
+    t->fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(t->fd == -1) {
+        goto fail;
+    }
+    if(connect(t->fd, addr, config.server_lens[server]) == -1 && errno != EINPROGRESS) {
+        goto fail;
+    }
+    const size_t n = dns_build(t->out + 2, qn->id, qn->query->name, qn->type);
+    t->out[0]   = n >> 8;
+    t->out[1]   = n & 0xff;
+    t->out_len  = n + 2;
+    t->client   = c;
+    t->question = qn;
+    t->server   = server;
+    if(SELECTOR_SUCCESS != selector_register(c->selector, t->fd, &dns_tcp_handler, OP_WRITE, t)) {
+        goto fail;
+    }
+    c->open++;
+    qn->tcp = t;
+    return true;
+
+fail:
+    if(t->fd != -1) {
+        close(t->fd);
+    }
+    free(t);
+    return false;
+}
+
+/** abandona la conexión TCP de la pregunta, si tiene */
+static void
+dns_tcp_cancel(struct dns_client *c, struct dns_question *qn) {
+    struct dns_tcp *t = qn->tcp;
+    if(t != NULL) {
+        t->question = NULL;
+        qn->tcp     = NULL;
+        selector_unregister_fd(c->selector, t->fd);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * copia `host' a `out' en minúsculas y sin punto final. false si es
+ * demasiado largo
+ */
+static bool
+dns_name_normalize(const char *host, char out[DNS_NAME_MAX + 1]) {
+    size_t n = strlen(host);
+    if(n > 0 && host[n - 1] == '.') {
+        n--;
+    }
+    if(n > DNS_NAME_MAX) {
+        return false;
+    }
+    for(size_t i = 0; i < n; i++) {
+        out[i] = tolower((unsigned char) host[i]);
+    }
+    out[n] = '\0';
+    return true;
+}
+
+/** etiquetas de 1 a 63 caracteres separadas por puntos */
+static bool
+dns_name_valid(const char *name) {
+    size_t label = 0;
+    for(const char *p = name; ; p++) {
+        if(*p == '.' || *p == '\0') {
+            if(label == 0 || label > 63) {
+                return false;
+            }
+            if(*p == '\0') {
+                return true;
+            }
+            label = 0;
+        } else {
+            label++;
+        }
+    }
+}
+
+/** direcciones literales y nombres de /etc/hosts. false si no es ninguno */
+static bool
+dns_local(struct dns_query *q) {
+    uint8_t addr[sizeof(struct in6_addr)];
+    if(inet_pton(AF_INET, q->name, addr) == 1) {
+        dns_question_add(&q->questions[0], addr);
+        return true;
+    }
+    if(inet_pton(AF_INET6, q->name, addr) == 1) {
+        dns_question_add(&q->questions[1], addr);
+        return true;
+    }
+
+    bool found = false;
+    for(const struct dns_host *h = config.hosts; h != NULL; h = h->next) {
+        if(strcmp(h->name, q->name) == 0) {
+            dns_question_add(&q->questions[h->family == AF_INET ? 0 : 1], &h->addr);
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * consulta `host' para el pedido `w', o se lo suma a la consulta en curso
+ * del nombre. Sin pedido es una renovación del caché. false si no se pudo.
+ */
+static bool
+dns_start(struct dns_client *c, const char *host, const in_port_t port,
+          struct dns_waiter *w) {
+    char name[DNS_NAME_MAX + 1];
+    const bool valid = dns_name_normalize(host, name);
+    if(valid) {
+        struct dns_query *pending = *dns_name_slot(c, name);
+        if(pending != NULL) {
+            // ya se está consultando: espera la misma respuesta
+            if(w == NULL) {
+                // nada que hacer
+            } else if(pending->waiters == NULL) {
+                pending->waiters = w;
+            } else {
+                w->next                = pending->waiters->next;
+                pending->waiters->next = w;
+            }
+            return true;
+        }
+    }
+
+    struct dns_query *q;
+    if(c->inflight >= DNS_MAX_INFLIGHT || (q = calloc(1, sizeof(*q))) == NULL) {
+        return false;
+    }
+    c->inflight++;
+    q->client  = c;
+    q->fd      = -1;
+    q->waiters = w;
+    q->port    = port;
+    q->ttl     = UINT32_MAX;
+    q->questions[0].type  = DNS_TYPE_A;
+    q->questions[1].type  = DNS_TYPE_AAAA;
+    q->questions[0].query = q->questions[1].query = q;
+
+    if(valid) {
+        strcpy(q->name, name);
+    }
+    if(!valid || dns_local(q) || !dns_name_valid(q->name)) {
+        // se responde sin consultar
+        dns_query_finish(c, q);
+        return true;
+    }
+
+    if(!dns_query_send(c, q)) {
+        c->inflight--;
+        free(q);
+        return false;
+    }
+    return true;
+}
+
+bool
+dns_submit(fd_selector s, const int fd, const char *host, const in_port_t port,
+           struct addrinfo **result) {
+    struct dns_client *c = dns_client_get(s);
+    if(c == NULL) {
+        return false;
+    }
+    struct dns_waiter *w = malloc(sizeof(*w));
+    if(w == NULL) {
+        return false;
+    }
+    w->next   = NULL;
+    w->fd     = fd;
+    w->port   = port;
+    w->result = result;
+
+    if(!dns_start(c, host, port, w)) {
+        free(w);
+        return false;
+    }
+    return true;
+}
+
+bool
+dns_prefetch(fd_selector s, const char *host) {
+    struct dns_client *c = dns_client_get(s);
+    return c != NULL && dns_start(c, host, 0, NULL);
+}
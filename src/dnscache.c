@@ -0,0 +1,395 @@
+/**
+ * dnscache.c - caché de resoluciones compartido por los workers
+ *
+ * Una tabla de hash de nombres (en minúsculas y sin punto final) más una
+ * lista por orden de uso para descartar el más viejo. Todo bajo un mutex:
+ * las secciones críticas son cortas y lo comparten los workers con los
+ * hilos de resolver.c.
+ *
+ * Cada entrada cuenta sus aciertos. Un acierto en la última parte del TTL
+ * de una entrada con suficientes aciertos la marca para renovar, y el que
+ * la guarda después la reemplaza con la entrada renovada; así el nombre no
+ * pasa por un fallo al vencer.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "dnscache.h"
+
+/** nombre más largo que se guarda, sin el punto final */
+#define DNSCACHE_NAME_MAX 255
+
+struct dnscache_entry {
+    /** siguiente en el bucket */
+    struct dnscache_entry *hnext;
+    /** vecinas en la lista por orden de uso (la primera es la más reciente) */
+    struct dnscache_entry *prev, *next;
+    uint32_t               hash;
+    /** vencimiento, en ms de CLOCK_MONOTONIC */
+    uint64_t               expires;
+    /** desde cuándo un acierto la renueva */
+    uint64_t               refresh;
+    /** aciertos desde que se guardó */
+    unsigned               uses;
+    /** se está renovando */
+    bool                   refreshing;
+    /**
+     * es una renovación que todavía no se usó después de `replaced', el
+     * vencimiento de la entrada que reemplazó
+     */
+    bool                   prefetched;
+    uint64_t               replaced;
+    bool                   negative;
+    unsigned               naddrs;
+    struct dnscache_addr   addrs[DNSCACHE_MAX_ADDRS];
+    char                   name[];
+};
+
+static struct {
+    pthread_mutex_t         lock;
+    struct dnscache_entry **buckets;
+    /** cantidad de buckets - 1 (potencia de 2) */
+    uint32_t                mask;
+    unsigned                capacity;
+    /** aciertos para renovar un nombre (0: no se renueva) */
+    unsigned                hot;
+    /** parte final del TTL en la que se renueva, en % */
+    unsigned                window;
+    struct dnscache_entry  *head, *tail;
+    struct dnscache_stats   stats;
+} cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t
+dnscache_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** copia `host' a `out' en minúsculas y sin punto final; retorna el largo */
+static size_t
+dnscache_key(const char *host, char out[DNSCACHE_NAME_MAX + 1], uint32_t *hash) {
+    size_t n = strnlen(host, DNSCACHE_NAME_MAX + 1);
+    if(n > 0 && host[n - 1] == '.') {
+        n--;
+    }
+    if(n > DNSCACHE_NAME_MAX) {
+        n = DNSCACHE_NAME_MAX;
+    }
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < n; i++) {
+        out[i] = tolower((unsigned char) host[i]);
+        h = (h ^ (uint8_t) out[i]) * 16777619u;
+    }
+    out[n] = '\0';
+    *hash = h;
+    return n;
+}
+
+static struct dnscache_entry **
+dnscache_slot(const char *name, const uint32_t hash) {
+    struct dnscache_entry **p = &cache.buckets[hash & cache.mask];
+    while(*p != NULL && ((*p)->hash != hash || strcmp((*p)->name, name) != 0)) {
+        p = &(*p)->hnext;
+    }
+    return p;
+}
+
+static void
+dnscache_lru_remove(struct dnscache_entry *e) {
+    if(e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        cache.head = e->next;
+    }
+    if(e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        cache.tail = e->prev;
+    }
+}
+
+static void
+dnscache_lru_push(struct dnscache_entry *e) {
+    e->prev = NULL;
+    e->next = cache.head;
+    if(cache.head != NULL) {
+        cache.head->prev = e;
+    } else {
+        cache.tail = e;
+    }
+    cache.head = e;
+}
+
+/** saca la entrada de `slot' y la libera */
+static void
+dnscache_remove(struct dnscache_entry **slot) {
+    struct dnscache_entry *e = *slot;
+    *slot = e->hnext;
+    dnscache_lru_remove(e);
+    cache.stats.entries--;
+    if(e->prefetched) {
+        cache.stats.prefetch_wasted++;
+    }
+    free(e);
+}
+
+bool
+dnscache_init(const unsigned capacity, const unsigned hot, const unsigned window) {
+    cache.capacity = capacity;
+    cache.hot      = hot;
+    cache.window   = window > 100 ? 100 : window;
+    cache.stats.capacity = capacity;
+    if(capacity == 0) {
+        return true;
+    }
+    uint32_t n = 1;
+    while(n < capacity) {
+        n <<= 1;
+    }
+    cache.buckets = calloc(n, sizeof(*cache.buckets));
+    cache.mask    = n - 1;
+    return cache.buckets != NULL;
+}
+
+/** arma una addrinfo por dirección, como las que deja getaddrinfo(3) */
+static struct addrinfo *
+dnscache_addrinfo(const struct dnscache_entry *e, const in_port_t port) {
+    struct addrinfo *head = NULL, **tail = &head;
+
+    for(unsigned i = 0; i < e->naddrs; i++) {
+        struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in6));
+        if(ai == NULL) {
+            break;
+        }
+        ai->ai_family   = e->addrs[i].family;
+        ai->ai_socktype = SOCK_STREAM;
+        ai->ai_protocol = IPPROTO_TCP;
+        ai->ai_addr     = (struct sockaddr *)(ai + 1);
+        if(e->addrs[i].family == AF_INET) {
+            struct sockaddr_in *in = (struct sockaddr_in *) ai->ai_addr;
+            in->sin_family = AF_INET;
+            in->sin_port   = port;
+            in->sin_addr   = e->addrs[i].ip.v4;
+            ai->ai_addrlen = sizeof(*in);
+        } else {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) ai->ai_addr;
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port   = port;
+            in6->sin6_addr   = e->addrs[i].ip.v6;
+            ai->ai_addrlen   = sizeof(*in6);
+        }
+        *tail = ai;
+        tail  = &ai->ai_next;
+    }
+    return head;
+}
+
+enum dnscache_result
+dnscache_lookup(const char *host, const in_port_t port, struct addrinfo **result) {
+    if(cache.capacity == 0) {
+        return DNSCACHE_MISS;
+    }
+    char     name[DNSCACHE_NAME_MAX + 1];
+    uint32_t hash;
+    dnscache_key(host, name, &hash);
+
+    enum dnscache_result ret = DNSCACHE_MISS;
+    pthread_mutex_lock(&cache.lock);
+    const uint64_t now = dnscache_now_ms();
+    struct dnscache_entry **slot = dnscache_slot(name, hash);
+    struct dnscache_entry  *e    = *slot;
+    if(e != NULL && e->expires <= now) {
+        dnscache_remove(slot);
+        e = NULL;
+    }
+    if(e == NULL) {
+        cache.stats.misses++;
+    } else if(e->negative) {
+        cache.stats.negative_hits++;
+        ret = DNSCACHE_NEGATIVE;
+    } else if((*result = dnscache_addrinfo(e, port)) != NULL) {
+        cache.stats.hits++;
+        ret = DNSCACHE_HIT;
+        if(e->prefetched && now >= e->replaced) {
+            // sin la renovación este pedido habría esperado una consulta
+            cache.stats.prefetch_hits++;
+            e->prefetched = false;
+        }
+        e->uses++;
+        if(cache.hot > 0 && e->uses >= cache.hot && now >= e->refresh && !e->refreshing) {
+            cache.stats.prefetches++;
+            e->refreshing = true;
+            ret = DNSCACHE_REFRESH;
+        }
+    } else {
+        cache.stats.misses++;
+    }
+    if(e != NULL) {
+        dnscache_lru_remove(e);
+        dnscache_lru_push(e);
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    return ret;
+}
+
+void
+dnscache_refresh_abort(const char *host) {
+    if(cache.capacity == 0) {
+        return;
+    }
+    char     name[DNSCACHE_NAME_MAX + 1];
+    uint32_t hash;
+    dnscache_key(host, name, &hash);
+
+    pthread_mutex_lock(&cache.lock);
+    struct dnscache_entry *e = *dnscache_slot(name, hash);
+    if(e != NULL && e->refreshing) {
+        e->refreshing = false;
+        cache.stats.prefetches--;
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void
+dnscache_store(const char *host, const struct addrinfo *addrs, unsigned ttl) {
+    if(cache.capacity == 0 || ttl == 0) {
+        return;
+    }
+    if(ttl > DNSCACHE_MAX_TTL) {
+        ttl = DNSCACHE_MAX_TTL;
+    }
+    char     name[DNSCACHE_NAME_MAX + 1];
+    uint32_t hash;
+    const size_t len = dnscache_key(host, name, &hash);
+
+    // se arma afuera del lock
+    struct dnscache_entry *e = malloc(sizeof(*e) + len + 1);
+    if(e == NULL) {
+        return;
+    }
+    memcpy(e->name, name, len + 1);
+    e->hash       = hash;
+    e->expires    = dnscache_now_ms() + (uint64_t) ttl * 1000;
+    e->refresh    = e->expires - (uint64_t) ttl * 10 * cache.window;
+    e->uses       = 0;
+    e->refreshing = false;
+    e->prefetched = false;
+    e->naddrs     = 0;
+    for(const struct addrinfo *ai = addrs; ai != NULL && e->naddrs < DNSCACHE_MAX_ADDRS;
+        ai = ai->ai_next) {
+        struct dnscache_addr *a = &e->addrs[e->naddrs];
+        if(ai->ai_family == AF_INET) {
+            a->ip.v4 = ((const struct sockaddr_in *) ai->ai_addr)->sin_addr;
+        } else if(ai->ai_family == AF_INET6) {
+            a->ip.v6 = ((const struct sockaddr_in6 *) ai->ai_addr)->sin6_addr;
+        } else {
+            continue;
+        }
+        a->family = ai->ai_family;
+        e->naddrs++;
+    }
+    e->negative = e->naddrs == 0;
+
+    pthread_mutex_lock(&cache.lock);
+    struct dnscache_entry **slot = dnscache_slot(name, hash);
+    if(*slot != NULL && (*slot)->refreshing && !(*slot)->negative && e->negative) {
+        // una renovación que falló no pisa las direcciones que siguen vigentes
+        pthread_mutex_unlock(&cache.lock);
+        free(e);
+        return;
+    }
+    if(*slot != NULL) {
+        // otra sesión lo resolvió antes, o es la renovación: queda la
+        // respuesta más nueva
+        if((*slot)->refreshing && !e->negative) {
+            e->prefetched = true;
+            e->replaced   = (*slot)->expires;
+        }
+        dnscache_remove(slot);
+    } else if(cache.stats.entries == cache.capacity) {
+        struct dnscache_entry *old = cache.tail;
+        dnscache_remove(dnscache_slot(old->name, old->hash));
+        cache.stats.evictions++;
+        slot = dnscache_slot(name, hash);
+    }
+    e->hnext = *slot;
+    *slot    = e;
+    dnscache_lru_push(e);
+    cache.stats.entries++;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+unsigned
+dnscache_flush(const char *host) {
+    unsigned n = 0;
+    if(cache.capacity == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    if(host != NULL) {
+        char     name[DNSCACHE_NAME_MAX + 1];
+        uint32_t hash;
+        dnscache_key(host, name, &hash);
+        struct dnscache_entry **slot = dnscache_slot(name, hash);
+        if(*slot != NULL) {
+            dnscache_remove(slot);
+            n++;
+        }
+    } else {
+        while(cache.head != NULL) {
+            dnscache_remove(dnscache_slot(cache.head->name, cache.head->hash));
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    return n;
+}
+
+void
+dnscache_stats(struct dnscache_stats *stats) {
+    pthread_mutex_lock(&cache.lock);
+    *stats = cache.stats;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void
+dnscache_foreach(bool (*visit)(const struct dnscache_info *info, void *data),
+                 void *data) {
+    pthread_mutex_lock(&cache.lock);
+    const uint64_t now = dnscache_now_ms();
+    for(const struct dnscache_entry *e = cache.head; e != NULL; e = e->next) {
+        if(e->expires <= now) {
+            continue;
+        }
+        const struct dnscache_info info = {
+            .name     = e->name,
+            .ttl      = (e->expires - now + 999) / 1000,
+            .negative = e->negative,
+            .naddrs   = e->naddrs,
+            .addrs    = e->addrs,
+        };
+        if(!visit(&info, data)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void
+dnscache_destroy(void) {
+    dnscache_flush(NULL);
+    free(cache.buckets);
+    cache.buckets  = NULL;
+    cache.capacity = 0;
+}
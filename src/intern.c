@@ -0,0 +1,132 @@
+/**
+ * intern.c - strings compartidos entre sesiones
+ *
+ * Tabla de hash por hilo con encadenamiento. Cada entrada lleva su string a
+ * continuación, así una referencia es directamente el `char *' y la entrada
+ * se recupera restando el offset.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+/** buckets iniciales de la tabla; se duplican cuando hay más entradas */
+#define INTERN_INITIAL_BUCKETS 64
+
+struct intern_table;
+
+struct intern_entry {
+    struct intern_entry       *next;
+    /** tabla (del hilo) que la creó */
+    const struct intern_table *owner;
+    uint32_t                   hash;
+    unsigned                   refs;
+    size_t                     len;
+    char                       str[];
+};
+
+static _Thread_local struct intern_table {
+    struct intern_entry **buckets;
+    size_t                size;
+    size_t                count;
+    /** el worker terminó: ya no se liberan entradas (ver intern_put) */
+    bool                  closed;
+} table;
+
+/** FNV-1a de 32 bits */
+static uint32_t
+intern_hash(const char *s, const size_t len) {
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        h ^= (uint8_t) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/** duplica los buckets. Sin memoria sigue con los actuales */
+static void
+intern_grow(void) {
+    const size_t size = table.size == 0 ? INTERN_INITIAL_BUCKETS : 2 * table.size;
+    struct intern_entry **buckets = calloc(size, sizeof(*buckets));
+    if(buckets == NULL) {
+        return;
+    }
+    for(size_t i = 0; i < table.size; i++) {
+        struct intern_entry *e, *next;
+        for(e = table.buckets[i]; e != NULL; e = next) {
+            next = e->next;
+            e->next = buckets[e->hash & (size - 1)];
+            buckets[e->hash & (size - 1)] = e;
+        }
+    }
+    free(table.buckets);
+    table.buckets = buckets;
+    table.size    = size;
+}
+
+const char *
+intern_get(const char *s, const size_t len) {
+    if(table.count >= table.size) {
+        intern_grow();
+        if(table.size == 0) {
+            return NULL;
+        }
+    }
+
+    const uint32_t hash = intern_hash(s, len);
+    struct intern_entry **bucket = &table.buckets[hash & (table.size - 1)];
+    for(struct intern_entry *e = *bucket; e != NULL; e = e->next) {
+        if(e->hash == hash && e->len == len && memcmp(e->str, s, len) == 0) {
+            e->refs++;
+            return e->str;
+        }
+    }
+
+    struct intern_entry *e = malloc(sizeof(*e) + len + 1);
+    if(e == NULL) {
+        return NULL;
+    }
+    e->owner = &table;
+    e->hash  = hash;
+    e->refs  = 1;
+    e->len   = len;
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+    e->next = *bucket;
+    *bucket = e;
+    table.count++;
+    return e->str;
+}
+
+void
+intern_put(const char *s) {
+    if(s == NULL) {
+        return;
+    }
+    struct intern_entry *e = (struct intern_entry *)
+        (s - offsetof(struct intern_entry, str));
+    if(e->owner != &table || table.closed || --e->refs > 0) {
+        return;
+    }
+
+    struct intern_entry **p = &table.buckets[e->hash & (table.size - 1)];
+    while(*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+    table.count--;
+    free(e);
+}
+
+void
+intern_destroy(void) {
+    free(table.buckets);
+    table.buckets = NULL;
+    table.size    = 0;
+    table.count   = 0;
+    table.closed  = true;
+}
@@ -161,6 +161,9 @@ log_auth(const char *username,
 
 void
 log_connection(const struct sockaddr *client_addr, int fd) {
+    if(LOG_LEVEL_DEBUG < min_level) {
+        return;
+    }
     char client_str[SOCKADDR_TO_HUMAN_MIN];
     sockaddr_to_human(client_str, sizeof(client_str), client_addr);
     
@@ -169,7 +172,7 @@ log_connection(const struct sockaddr *client_addr, int fd) {
              "New connection from %s (fd=%d)",
              client_str, fd);
     
-    write_log(LOG_LEVEL_INFO, message);
+    write_log(LOG_LEVEL_DEBUG, message);
 }
 
 void
@@ -4,11 +4,16 @@
  * Interpreta los argumentos de línea de comandos y monta los sockets pasivos
  * para el servidor SOCKS5 y el servidor de monitoreo.
  *
- * Todas las conexiones entrantes se manejan en un único hilo usando I/O
- * no bloqueante con un selector (multiplexación).
+ * Las conexiones entrantes se manejan con I/O no bloqueante sobre un selector
+ * (multiplexación). Con `-w N' se levantan N workers: cada uno es un hilo con
+ * su propio selector, su propio pool de sesiones y su propio socket pasivo
+ * SOCKS5 sobre el mismo puerto (SO_REUSEPORT), así el kernel reparte las
+ * conexiones entre ellos. El servidor de monitoreo corre en el worker 0.
  *
- * Las operaciones bloqueantes (resolución DNS) se descargan a hilos separados
- * que notifican al selector cuando terminan.
+ * Los nombres se resuelven sin bloquear al worker: por defecto con el cliente
+ * DNS de cada worker, que consulta por UDP (y TCP si la respuesta llega
+ * truncada) desde el mismo selector; con `-D', con getaddrinfo(3) en un pool
+ * fijo de hilos que avisa al selector del pedido cuando termina.
  */
 #include <stdio.h>
 #include <string.h>
@@ -16,9 +21,11 @@
 #include <limits.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -30,24 +37,59 @@
 #include "monitoring.h"
 #include "metrics.h"
 #include "logger.h"
+#include "resolver.h"
+#include "dns.h"
+#include "dnscache.h"
 
 /** Argumentos globales del servidor */
 struct socks5args socks5_args;
 
-/** Flag de terminación */
+/**
+ * Flag de terminación. La escriben el handler de señales y cualquier worker
+ * y la leen todos los workers: solo se accede con __atomic_*.
+ */
 static bool done = false;
 
+static void
+finish(void) {
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+}
+
+static bool
+finished(void) {
+    return __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+}
+
+/** Un reactor: hilo con su selector, su socket pasivo y su pool de sesiones */
+struct worker {
+    unsigned          id;
+    pthread_t         thread;
+    bool              running;
+    fd_selector       selector;
+    int               server_fd;
+
+    /** error que terminó el loop del worker, si lo hubo */
+    selector_status   ss;
+    const char       *err_msg;
+};
+
+static struct worker *workers = NULL;
+
+static void workers_wake(void);
+
 static void
 sigterm_handler(const int signal) {
     printf("\nSignal %d received, cleaning up and exiting...\n", signal);
-    done = true;
+    finish();
+    workers_wake();
 }
 
 /**
  * Crea un socket TCP pasivo (escucha) en la dirección y puerto especificados
  */
 static int
-create_passive_socket(const char *addr, unsigned short port, bool ipv6) {
+create_passive_socket(const char *addr, unsigned short port, bool ipv6,
+                      bool reuseport) {
     int fd = -1;
     int family = ipv6 ? AF_INET6 : AF_INET;
     
@@ -60,6 +102,14 @@ create_passive_socket(const char *addr, unsigned short port, bool ipv6) {
     // Permitir reusar la dirección
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
     
+    // Varios workers escuchan en el mismo puerto; el kernel balancea
+    if(reuseport &&
+       setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return -1;
+    }
+    
     if(ipv6) {
         struct sockaddr_in6 address;
         memset(&address, 0, sizeof(address));
@@ -113,6 +163,21 @@ create_passive_socket(const char *addr, unsigned short port, bool ipv6) {
     return fd;
 }
 
+/**
+ * Lleva el límite blando de descriptores abiertos al límite duro: con epoll
+ * el selector ya no está acotado por FD_SETSIZE y cada sesión usa dos fds.
+ */
+static void
+raise_nofile_limit(void) {
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            perror("setrlimit(RLIMIT_NOFILE)");
+        }
+    }
+}
+
 /**
  * Imprime banner de inicio
  */
@@ -127,6 +192,99 @@ print_banner(void) {
     printf("╚═══════════════════════════════════════════════════════════╝\n\n");
 }
 
+/**
+ * Prepara un worker: socket pasivo SOCKS5 propio y selector propio. El
+ * worker 0 además atiende el servidor de monitoreo.
+ */
+static const char *
+worker_init(struct worker *w, unsigned id, int monitor_fd) {
+    static const struct fd_handler socks5_passive_handler = {
+        .handle_read  = socksv5_passive_accept,
+        .handle_write = NULL,
+        .handle_close = NULL,
+    };
+    static const struct fd_handler monitoring_passive_handler = {
+        .handle_read  = monitoring_passive_accept,
+        .handle_write = NULL,
+        .handle_close = NULL,
+    };
+    
+    w->id        = id;
+    w->server_fd = create_passive_socket(socks5_args.socks_addr,
+                                         socks5_args.socks_port, false,
+                                         socks5_args.workers > 1);
+    if(w->server_fd < 0) {
+        return "unable to create SOCKS5 server socket";
+    }
+    if(selector_fd_set_nio(w->server_fd) == -1) {
+        return "setting server socket non-blocking";
+    }
+    
+    w->selector = selector_new(1024);
+    if(w->selector == NULL) {
+        return "unable to create selector";
+    }
+    
+    w->ss = selector_register(w->selector, w->server_fd,
+                              &socks5_passive_handler, OP_READ, NULL);
+    if(w->ss != SELECTOR_SUCCESS) {
+        return "registering SOCKS5 server fd";
+    }
+    
+    if(monitor_fd >= 0) {
+        w->ss = selector_register(w->selector, monitor_fd,
+                                  &monitoring_passive_handler, OP_READ, NULL);
+        if(w->ss != SELECTOR_SUCCESS) {
+            return "registering monitoring server fd";
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * Despierta a todos los workers para que noten `done'. Solo escribe en el
+ * eventfd de cada selector, así que es seguro llamarla desde sigterm_handler.
+ */
+static void
+workers_wake(void) {
+    if(workers == NULL) {
+        return;
+    }
+    for(unsigned i = 0; i < socks5_args.workers; i++) {
+        if(workers[i].selector != NULL) {
+            selector_wakeup(workers[i].selector);
+        }
+    }
+}
+
+/**
+ * Loop de un worker. Los selectors se destruyen en el hilo principal luego
+ * del join (otros hilos pueden estar despertándolos); acá solo se prepara y
+ * se libera el pool de sesiones del hilo.
+ */
+static void *
+worker_run(void *arg) {
+    struct worker *w = arg;
+    
+    if(!socksv5_pool_init()) {
+        fprintf(stderr, "Warning: could not preallocate sessions\n");
+    }
+    
+    while(!finished()) {
+        w->ss = selector_select(w->selector);
+        if(w->ss != SELECTOR_SUCCESS) {
+            w->err_msg = "serving";
+            finish();
+            workers_wake();
+        }
+    }
+    
+    socksv5_pool_destroy();
+    
+    return NULL;
+}
+
 int
 main(const int argc, char **argv) {
     // Parsear argumentos de línea de comandos
@@ -145,11 +303,11 @@ main(const int argc, char **argv) {
     // Cerrar stdin (no necesitamos entrada)
     close(STDIN_FILENO);
     
+    raise_nofile_limit();
+    
     const char       *err_msg = NULL;
     selector_status   ss      = SELECTOR_SUCCESS;
-    fd_selector       selector = NULL;
     
-    int server_fd = -1;
     int monitor_fd = -1;
     
     // Registrar manejadores de señales
@@ -157,34 +315,23 @@ main(const int argc, char **argv) {
     signal(SIGINT,  sigterm_handler);
     signal(SIGPIPE, SIG_IGN);  // Ignorar SIGPIPE
     
-    // Crear socket del servidor SOCKS5
-    server_fd = create_passive_socket(socks5_args.socks_addr, 
-                                       socks5_args.socks_port, false);
-    if(server_fd < 0) {
-        err_msg = "unable to create SOCKS5 server socket";
+    workers = calloc(socks5_args.workers, sizeof(*workers));
+    if(workers == NULL) {
+        err_msg = "allocating workers";
         goto finally;
     }
-    
-    printf("SOCKS5 server listening on %s:%d\n", 
-           socks5_args.socks_addr, socks5_args.socks_port);
+    for(unsigned i = 0; i < socks5_args.workers; i++) {
+        workers[i].server_fd = -1;
+    }
     
     // Crear socket del servidor de monitoreo
     monitor_fd = create_passive_socket(socks5_args.mng_addr,
-                                        socks5_args.mng_port, false);
+                                        socks5_args.mng_port, false, false);
     if(monitor_fd < 0) {
         err_msg = "unable to create monitoring server socket";
         goto finally;
     }
     
-    printf("Monitoring server listening on %s:%d\n",
-           socks5_args.mng_addr, socks5_args.mng_port);
-    
-    // Configurar sockets como no bloqueantes
-    if(selector_fd_set_nio(server_fd) == -1) {
-        err_msg = "setting server socket non-blocking";
-        goto finally;
-    }
-    
     if(selector_fd_set_nio(monitor_fd) == -1) {
         err_msg = "setting monitoring socket non-blocking";
         goto finally;
@@ -192,11 +339,11 @@ main(const int argc, char **argv) {
     
     // Inicializar el selector
     const struct selector_init conf = {
-        .signal = SIGALRM,
         .select_timeout = {
             .tv_sec  = 10,
             .tv_nsec = 0,
         },
+        .backend = socks5_args.io_backend,
     };
     
     if(0 != selector_init(&conf)) {
@@ -204,40 +351,38 @@ main(const int argc, char **argv) {
         goto finally;
     }
     
-    selector = selector_new(1024);
-    if(selector == NULL) {
-        err_msg = "unable to create selector";
+    if(!dnscache_init(socks5_args.dns_cache_entries, socks5_args.dns_prefetch_hot,
+                      socks5_args.dns_prefetch_window)) {
+        err_msg = "allocating DNS cache";
         goto finally;
     }
-    
-    // Registrar el servidor SOCKS5
-    const struct fd_handler socks5_passive_handler = {
-        .handle_read  = socksv5_passive_accept,
-        .handle_write = NULL,
-        .handle_close = NULL,
-    };
-    
-    ss = selector_register(selector, server_fd, &socks5_passive_handler,
-                           OP_READ, NULL);
-    if(ss != SELECTOR_SUCCESS) {
-        err_msg = "registering SOCKS5 server fd";
+    if(socks5_args.system_resolver) {
+        if(!resolver_init(socks5_args.resolver_threads, socks5_args.resolver_queue)) {
+            err_msg = "starting resolver threads";
+            goto finally;
+        }
+    } else if(!dns_init(socks5_args.nameservers, socks5_args.nameserver_count)) {
+        err_msg = "invalid name server address";
         goto finally;
     }
     
-    // Registrar el servidor de monitoreo
-    const struct fd_handler monitoring_passive_handler = {
-        .handle_read  = monitoring_passive_accept,
-        .handle_write = NULL,
-        .handle_close = NULL,
-    };
-    
-    ss = selector_register(selector, monitor_fd, &monitoring_passive_handler,
-                           OP_READ, NULL);
-    if(ss != SELECTOR_SUCCESS) {
-        err_msg = "registering monitoring server fd";
-        goto finally;
+    // Crear los workers (sockets pasivos SOCKS5 y selectors)
+    for(unsigned i = 0; i < socks5_args.workers; i++) {
+        err_msg = worker_init(&workers[i], i, i == 0 ? monitor_fd : -1);
+        if(err_msg != NULL) {
+            ss = workers[i].ss;
+            goto finally;
+        }
     }
     
+    printf("SOCKS5 server listening on %s:%d (%u worker%s)\n", 
+           socks5_args.socks_addr, socks5_args.socks_port,
+           socks5_args.workers, socks5_args.workers > 1 ? "s" : "");
+    printf("Monitoring server listening on %s:%d\n",
+           socks5_args.mng_addr, socks5_args.mng_port);
+    printf("I/O multiplexer: %s\n",
+           selector_backend_name(selector_get_backend(workers[0].selector)));
+    
     // Mostrar usuarios configurados
     printf("\nConfigured users:\n");
     int user_count = 0;
@@ -253,14 +398,43 @@ main(const int argc, char **argv) {
     
     printf("\nServer started. Press Ctrl+C to stop.\n");
     printf("═══════════════════════════════════════════════════════════════\n\n");
+    fflush(stdout);
+    
+    // Los workers 1..N-1 corren en hilos propios, con SIGINT/SIGTERM
+    // bloqueadas para que las reciba el hilo principal (worker 0)
+    workers[0].thread  = pthread_self();
+    workers[0].running = true;
+    
+    sigset_t term, old;
+    sigemptyset(&term);
+    sigaddset(&term, SIGINT);
+    sigaddset(&term, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &term, &old);
+    for(unsigned i = 1; i < socks5_args.workers; i++) {
+        if(pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+            err_msg = "creating worker thread";
+            finish();
+            break;
+        }
+        workers[i].running = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
     
     // Loop principal
-    while(!done) {
-        err_msg = NULL;
-        ss = selector_select(selector);
-        if(ss != SELECTOR_SUCCESS) {
-            err_msg = "serving";
-            goto finally;
+    worker_run(&workers[0]);
+    
+    finish();
+    workers_wake();
+    for(unsigned i = 1; i < socks5_args.workers; i++) {
+        if(workers[i].running) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+    
+    for(unsigned i = 0; i < socks5_args.workers && err_msg == NULL; i++) {
+        if(workers[i].err_msg != NULL) {
+            err_msg = workers[i].err_msg;
+            ss      = workers[i].ss;
         }
     }
     
@@ -282,28 +456,39 @@ finally:
     }
     
     // Imprimir métricas finales
-    struct socks5_metrics *m = metrics_get();
+    struct socks5_metrics m;
+    metrics_snapshot(&m);
     printf("\n═══════════════════════════════════════════════════════════════\n");
     printf("Final Statistics:\n");
-    printf("  Historical connections: %lu\n", m->historical_connections);
-    printf("  Successful connections: %lu\n", m->successful_connections);
-    printf("  Failed connections: %lu\n", m->failed_connections);
-    printf("  Total bytes transferred: %lu\n", m->bytes_transferred);
+    printf("  Historical connections: %lu\n", m.historical_connections);
+    printf("  Successful connections: %lu\n", m.successful_connections);
+    printf("  Failed connections: %lu\n", m.failed_connections);
+    printf("  Total bytes transferred: %lu\n", m.bytes_transferred);
     printf("═══════════════════════════════════════════════════════════════\n");
     
-    // Limpieza
-    if(selector != NULL) {
-        selector_destroy(selector);
+    // Limpieza. Los resolvers avisan a los selectors: terminan antes
+    resolver_destroy();
+    if(workers != NULL) {
+        for(unsigned i = 0; i < socks5_args.workers; i++) {
+            // se limpia el puntero antes de destruir: sigterm_handler
+            // corre en este mismo hilo y lo consulta en workers_wake()
+            fd_selector selector = workers[i].selector;
+            workers[i].selector = NULL;
+            selector_destroy(selector);
+            if(workers[i].server_fd >= 0) {
+                close(workers[i].server_fd);
+            }
+        }
+        free(workers);
     }
     selector_close();
+    dns_destroy();
+    dnscache_destroy();
     
     socksv5_pool_destroy();
     monitoring_destroy();
     logger_close();
     
-    if(server_fd >= 0) {
-        close(server_fd);
-    }
     if(monitor_fd >= 0) {
         close(monitor_fd);
     }
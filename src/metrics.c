@@ -1,72 +1,139 @@
 /**
  * metrics.c - Sistema de métricas del servidor SOCKSv5
  *
- * Implementación de singleton para métricas volátiles
+ * Métricas volátiles particionadas por hilo: cada worker incrementa su shard
+ * (un único escritor, sin operaciones atómicas con lock) y las lecturas
+ * agregan todos los shards.
  */
+#include <string.h>
+
 #include "metrics.h"
 
-/** Singleton de métricas (inicializado a cero) */
-static struct socks5_metrics metrics = {0};
+/** shard alineado a línea de caché para que los workers no compartan líneas */
+struct metrics_shard {
+    _Alignas(64) struct socks5_metrics m;
+};
+
+static struct metrics_shard shards[METRICS_MAX_SHARDS];
+
+/** cantidad de shards asignados */
+static unsigned shards_used = 0;
 
-struct socks5_metrics *
-metrics_get(void) {
-    return &metrics;
+/** shard del hilo actual */
+static _Thread_local struct socks5_metrics *local = NULL;
+
+static struct socks5_metrics *
+local_metrics(void) {
+    if(local == NULL) {
+        unsigned i = __atomic_fetch_add(&shards_used, 1, __ATOMIC_RELAXED);
+        if(i >= METRICS_MAX_SHARDS) {
+            i = METRICS_MAX_SHARDS - 1;
+        }
+        local = &shards[i].m;
+    }
+    return local;
+}
+
+/**
+ * Suma sobre un contador del shard propio. Hay un solo escritor por shard:
+ * alcanza con load/store relajados para que los lectores vean valores enteros.
+ */
+static inline void
+counter_add(uint64_t *counter, const uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+static inline uint64_t
+counter_get(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void
+metrics_snapshot(struct socks5_metrics *out) {
+    memset(out, 0, sizeof(*out));
+
+    unsigned n = __atomic_load_n(&shards_used, __ATOMIC_RELAXED);
+    if(n > METRICS_MAX_SHARDS) {
+        n = METRICS_MAX_SHARDS;
+    }
+    for(unsigned i = 0; i < n; i++) {
+        const struct socks5_metrics *m = &shards[i].m;
+        out->historical_connections += counter_get(&m->historical_connections);
+        out->current_connections    += counter_get(&m->current_connections);
+        out->bytes_transferred      += counter_get(&m->bytes_transferred);
+        out->bytes_from_clients     += counter_get(&m->bytes_from_clients);
+        out->bytes_to_clients       += counter_get(&m->bytes_to_clients);
+        out->bytes_from_origins     += counter_get(&m->bytes_from_origins);
+        out->bytes_to_origins       += counter_get(&m->bytes_to_origins);
+        out->successful_connections += counter_get(&m->successful_connections);
+        out->failed_connections     += counter_get(&m->failed_connections);
+        out->auth_successful        += counter_get(&m->auth_successful);
+        out->auth_failed            += counter_get(&m->auth_failed);
+    }
 }
 
 void 
 metrics_connection_opened(void) {
-    metrics.historical_connections++;
-    metrics.current_connections++;
+    struct socks5_metrics *m = local_metrics();
+    counter_add(&m->historical_connections, 1);
+    counter_add(&m->current_connections, 1);
 }
 
 void 
 metrics_connection_closed(void) {
-    if(metrics.current_connections > 0) {
-        metrics.current_connections--;
+    // las sesiones se abren y cierran en el mismo worker: el shard no
+    // queda negativo
+    struct socks5_metrics *m = local_metrics();
+    if(counter_get(&m->current_connections) > 0) {
+        counter_add(&m->current_connections, (uint64_t) -1);
     }
 }
 
 void 
 metrics_add_bytes_from_client(size_t bytes) {
-    metrics.bytes_from_clients += bytes;
-    metrics.bytes_transferred  += bytes;
+    struct socks5_metrics *m = local_metrics();
+    counter_add(&m->bytes_from_clients, bytes);
+    counter_add(&m->bytes_transferred,  bytes);
 }
 
 void 
 metrics_add_bytes_to_client(size_t bytes) {
-    metrics.bytes_to_clients  += bytes;
-    metrics.bytes_transferred += bytes;
+    struct socks5_metrics *m = local_metrics();
+    counter_add(&m->bytes_to_clients,  bytes);
+    counter_add(&m->bytes_transferred, bytes);
 }
 
 void 
 metrics_add_bytes_from_origin(size_t bytes) {
-    metrics.bytes_from_origins += bytes;
-    metrics.bytes_transferred  += bytes;
+    struct socks5_metrics *m = local_metrics();
+    counter_add(&m->bytes_from_origins, bytes);
+    counter_add(&m->bytes_transferred,  bytes);
 }
 
 void 
 metrics_add_bytes_to_origin(size_t bytes) {
-    metrics.bytes_to_origins  += bytes;
-    metrics.bytes_transferred += bytes;
+    struct socks5_metrics *m = local_metrics();
+    counter_add(&m->bytes_to_origins,  bytes);
+    counter_add(&m->bytes_transferred, bytes);
 }
 
 void 
 metrics_connection_success(void) {
-    metrics.successful_connections++;
+    counter_add(&local_metrics()->successful_connections, 1);
 }
 
 void 
 metrics_connection_failed(void) {
-    metrics.failed_connections++;
+    counter_add(&local_metrics()->failed_connections, 1);
 }
 
 void 
 metrics_auth_success(void) {
-    metrics.auth_successful++;
+    counter_add(&local_metrics()->auth_successful, 1);
 }
 
 void 
 metrics_auth_failed(void) {
-    metrics.auth_failed++;
+    counter_add(&local_metrics()->auth_failed, 1);
 }
-
@@ -21,6 +21,8 @@ enum {
     CMD_ADD_USER        = 0x02,
     CMD_REMOVE_USER     = 0x03,
     CMD_TOGGLE_DISECTOR = 0x04,
+    CMD_GET_DNS_CACHE   = 0x05,
+    CMD_FLUSH_DNS_CACHE = 0x06,
 };
 
 static void
@@ -39,13 +41,16 @@ usage(const char *progname) {
         "  adduser        Add user (requires -u user:pass)\n"
         "  deluser        Remove user (requires -u user)\n"
         "  toggle         Toggle disector\n"
+        "  dnscache       Show DNS cache statistics and entries\n"
+        "  dnsflush [name] Flush the DNS cache (or only one name)\n"
         "\n"
         "Examples:\n"
         "  %s metrics\n"
         "  %s -u admin:secret adduser\n"
         "  %s -u admin deluser\n"
+        "  %s dnsflush example.org\n"
         "\n",
-        progname, progname, progname, progname);
+        progname, progname, progname, progname, progname);
     exit(1);
 }
 
@@ -307,6 +312,104 @@ cmd_toggle(int fd) {
     }
 }
 
+static uint64_t
+get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for(int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void
+cmd_dnscache(int fd) {
+    if(send_command(fd, CMD_GET_DNS_CACHE, NULL, 0) != 0) {
+        return;
+    }
+
+    uint8_t status;
+    uint8_t data[65536];
+    uint16_t data_len;
+
+    if(receive_response(fd, &status, data, &data_len) != 0) {
+        return;
+    }
+
+    if(status != 0 || data_len < 74) {
+        fprintf(stderr, "Error: status = %d\n", status);
+        return;
+    }
+
+    const uint64_t hits = get_u64(data + 16), negative = get_u64(data + 24);
+    const uint64_t misses = get_u64(data + 32);
+    const uint64_t lookups = hits + negative + misses;
+    printf("DNS cache:\n");
+    printf("  Entries:                %lu / %lu\n", get_u64(data + 8), get_u64(data));
+    printf("  Hits:                   %lu\n", hits);
+    printf("  Negative hits:          %lu\n", negative);
+    printf("  Misses:                 %lu\n", misses);
+    printf("  Evictions:              %lu\n", get_u64(data + 40));
+    printf("  Hit ratio:              %.1f%%\n",
+           lookups == 0 ? 0.0 : 100.0 * (hits + negative) / lookups);
+    printf("  Prefetches:             %lu\n", get_u64(data + 48));
+    printf("  Prefetch hits:          %lu\n", get_u64(data + 56));
+    printf("  Wasted prefetches:      %lu\n", get_u64(data + 64));
+
+    const unsigned count = (data[72] << 8) | data[73];
+    size_t offset = 74;
+    for(unsigned i = 0; i < count && offset + 6 <= data_len; i++) {
+        const unsigned ttl = (data[offset] << 24) | (data[offset + 1] << 16)
+                           | (data[offset + 2] << 8) | data[offset + 3];
+        const int negative_entry = data[offset + 4];
+        const uint8_t nlen = data[offset + 5];
+        offset += 6;
+        if(offset + nlen + 1 > data_len) {
+            break;
+        }
+        printf("  %-40.*s %6us ", nlen, (const char *) data + offset, ttl);
+        offset += nlen;
+        const uint8_t naddrs = data[offset++];
+        if(negative_entry) {
+            printf(" (negative)");
+        }
+        for(unsigned j = 0; j < naddrs && offset < data_len; j++) {
+            const int family = data[offset++] == 4 ? AF_INET : AF_INET6;
+            const size_t alen = family == AF_INET ? 4 : 16;
+            char text[INET6_ADDRSTRLEN];
+            if(offset + alen > data_len) {
+                break;
+            }
+            inet_ntop(family, data + offset, text, sizeof(text));
+            printf(" %s", text);
+            offset += alen;
+        }
+        printf("\n");
+    }
+}
+
+static void
+cmd_dnsflush(int fd, const char *name) {
+    const size_t nlen = name == NULL ? 0 : strlen(name);
+    if(send_command(fd, CMD_FLUSH_DNS_CACHE, (const uint8_t *) name, nlen) != 0) {
+        return;
+    }
+
+    uint8_t status;
+    uint8_t data[1024];
+    uint16_t data_len;
+
+    if(receive_response(fd, &status, data, &data_len) != 0) {
+        return;
+    }
+
+    if(status == 0 && data_len >= 4) {
+        printf("Flushed %u DNS cache entries\n",
+               (unsigned) ((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]));
+    } else {
+        fprintf(stderr, "Error: status = %d\n", status);
+    }
+}
+
 int
 main(int argc, char **argv) {
     const char *addr = "127.0.0.1";
@@ -373,6 +476,10 @@ main(int argc, char **argv) {
         cmd_deluser(fd, user_pass);
     } else if(strcmp(cmd, "toggle") == 0) {
         cmd_toggle(fd);
+    } else if(strcmp(cmd, "dnscache") == 0) {
+        cmd_dnscache(fd);
+    } else if(strcmp(cmd, "dnsflush") == 0) {
+        cmd_dnsflush(fd, optind + 1 < argc ? argv[optind + 1] : NULL);
     } else {
         fprintf(stderr, "Unknown command: %s\n", cmd);
         close(fd);
@@ -15,6 +15,7 @@
 #include "metrics.h"
 #include "args.h"
 #include "netutils.h"
+#include "dnscache.h"
 
 #define BUFFER_SIZE 4096
 
@@ -130,7 +131,9 @@ static const struct fd_handler monitoring_handler = {
 /** Escribe métricas en el buffer de respuesta */
 static void
 write_metrics_response(struct monitoring_conn *c) {
-    struct socks5_metrics *m = metrics_get();
+    struct socks5_metrics snapshot;
+    struct socks5_metrics *m = &snapshot;
+    metrics_snapshot(m);
     
     // Formato de respuesta de métricas:
     // historical_connections (8 bytes)
@@ -356,7 +359,133 @@ handle_toggle_disector(struct monitoring_conn *c) {
             socks5_args.disectors_enabled ? "enabled" : "disabled");
 }
 
-/** Procesa el comando recibido */
+/** Escribe `v' en network byte order */
+static uint8_t *
+put_u64(uint8_t *p, const uint64_t v) {
+    for(int i = 7; i >= 0; i--) {
+        *p++ = (v >> (i * 8)) & 0xFF;
+    }
+    return p;
+}
+
+/** Entradas del caché que se van agregando a la respuesta */
+struct dns_cache_listing {
+    uint8_t  *p, *end;
+    uint16_t  count;
+};
+
+static bool
+write_dns_cache_entry(const struct dnscache_info *info, void *data) {
+    struct dns_cache_listing *l = data;
+    const size_t nlen = strlen(info->name);
+
+    size_t size = 4 + 1 + 1 + nlen + 1;
+    for(unsigned i = 0; i < info->naddrs; i++) {
+        size += 1 + (info->addrs[i].family == AF_INET ? 4 : 16);
+    }
+    if(nlen > 255 || (size_t)(l->end - l->p) < size) {
+        return false;
+    }
+
+    uint8_t *p = l->p;
+    *p++ = (info->ttl >> 24) & 0xFF;
+    *p++ = (info->ttl >> 16) & 0xFF;
+    *p++ = (info->ttl >> 8) & 0xFF;
+    *p++ = info->ttl & 0xFF;
+    *p++ = info->negative ? 1 : 0;
+    *p++ = nlen;
+    memcpy(p, info->name, nlen);
+    p += nlen;
+    *p++ = info->naddrs;
+    for(unsigned i = 0; i < info->naddrs; i++) {
+        if(info->addrs[i].family == AF_INET) {
+            *p++ = 4;
+            memcpy(p, &info->addrs[i].ip.v4, 4);
+            p += 4;
+        } else {
+            *p++ = 6;
+            memcpy(p, &info->addrs[i].ip.v6, 16);
+            p += 16;
+        }
+    }
+    l->p = p;
+    l->count++;
+    return true;
+}
+
+/** Estadísticas y entradas del caché DNS */
+static void
+write_dns_cache_response(struct monitoring_conn *c) {
+    size_t n;
+    uint8_t *buf = buffer_write_ptr(&c->write_buffer, &n);
+
+    struct dnscache_stats stats;
+    dnscache_stats(&stats);
+
+    buf[0] = MONITORING_VERSION;
+    buf[1] = MONITORING_STATUS_OK;
+
+    uint8_t *p = buf + 4;
+    p = put_u64(p, stats.capacity);
+    p = put_u64(p, stats.entries);
+    p = put_u64(p, stats.hits);
+    p = put_u64(p, stats.negative_hits);
+    p = put_u64(p, stats.misses);
+    p = put_u64(p, stats.evictions);
+    p = put_u64(p, stats.prefetches);
+    p = put_u64(p, stats.prefetch_hits);
+    p = put_u64(p, stats.prefetch_wasted);
+
+    // la cantidad se completa después de recorrer
+    struct dns_cache_listing listing = {
+        .p     = p + 2,
+        .end   = buf + n,
+        .count = 0,
+    };
+    dnscache_foreach(write_dns_cache_entry, &listing);
+    p[0] = (listing.count >> 8) & 0xFF;
+    p[1] = listing.count & 0xFF;
+
+    const uint16_t len = listing.p - (buf + 4);
+    buf[2] = (len >> 8) & 0xFF;
+    buf[3] = len & 0xFF;
+    buffer_write_adv(&c->write_buffer, 4 + len);
+}
+
+/** Vacía el caché DNS, o solo el nombre recibido */
+static void
+handle_flush_dns_cache(struct monitoring_conn *c) {
+    size_t n;
+    uint8_t *buf = buffer_write_ptr(&c->write_buffer, &n);
+
+    unsigned flushed;
+    if(c->data_len == 0) {
+        flushed = dnscache_flush(NULL);
+    } else {
+        char name[256];
+        const size_t nlen = c->data_len < sizeof(name) ? c->data_len : sizeof(name) - 1;
+        memcpy(name, c->data, nlen);
+        name[nlen] = '\0';
+        flushed = dnscache_flush(name);
+    }
+
+    buf[0] = MONITORING_VERSION;
+    buf[1] = MONITORING_STATUS_OK;
+    buf[2] = 0;
+    buf[3] = 4;
+    buf[4] = (flushed >> 24) & 0xFF;
+    buf[5] = (flushed >> 16) & 0xFF;
+    buf[6] = (flushed >> 8) & 0xFF;
+    buf[7] = flushed & 0xFF;
+    buffer_write_adv(&c->write_buffer, 8);
+
+    fprintf(stdout, "[MONITOR] DNS cache flushed: %u entries\n", flushed);
+}
+
+/**
+ * Procesa el comando recibido. Los comandos sobre usuarios toman
+ * `users_lock' porque los workers leen la tabla al autenticar.
+ */
 static void
 process_command(struct monitoring_conn *c) {
     switch(c->cmd) {
@@ -364,17 +493,29 @@ process_command(struct monitoring_conn *c) {
             write_metrics_response(c);
             break;
         case MONITORING_CMD_LIST_USERS:
+            pthread_rwlock_rdlock(&socks5_args.users_lock);
             write_users_response(c);
+            pthread_rwlock_unlock(&socks5_args.users_lock);
             break;
         case MONITORING_CMD_ADD_USER:
+            pthread_rwlock_wrlock(&socks5_args.users_lock);
             handle_add_user(c);
+            pthread_rwlock_unlock(&socks5_args.users_lock);
             break;
         case MONITORING_CMD_REMOVE_USER:
+            pthread_rwlock_wrlock(&socks5_args.users_lock);
             handle_remove_user(c);
+            pthread_rwlock_unlock(&socks5_args.users_lock);
             break;
         case MONITORING_CMD_TOGGLE_DISECTOR:
             handle_toggle_disector(c);
             break;
+        case MONITORING_CMD_GET_DNS_CACHE:
+            write_dns_cache_response(c);
+            break;
+        case MONITORING_CMD_FLUSH_DNS_CACHE:
+            handle_flush_dns_cache(c);
+            break;
         default: {
             size_t n;
             uint8_t *buf = buffer_write_ptr(&c->write_buffer, &n);
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
@@ -99,3 +100,43 @@ sock_blocking_copy(const int source, const int dest) {
     return ret;
 }
 
+struct addrinfo *
+addrinfo_copy(const struct addrinfo *list, const in_port_t port) {
+    struct addrinfo *head = NULL, **tail = &head;
+
+    for(const struct addrinfo *src = list; src != NULL; src = src->ai_next) {
+        if(src->ai_family != AF_INET && src->ai_family != AF_INET6) {
+            continue;
+        }
+        struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in6));
+        if(ai == NULL) {
+            freeaddrinfo(head);
+            return NULL;
+        }
+        ai->ai_family   = src->ai_family;
+        ai->ai_socktype = src->ai_socktype;
+        ai->ai_protocol = src->ai_protocol;
+        ai->ai_addrlen  = src->ai_addrlen;
+        ai->ai_addr     = (struct sockaddr *)(ai + 1);
+        memcpy(ai->ai_addr, src->ai_addr, src->ai_addrlen);
+        if(ai->ai_family == AF_INET) {
+            ((struct sockaddr_in *) ai->ai_addr)->sin_port = port;
+        } else {
+            ((struct sockaddr_in6 *) ai->ai_addr)->sin6_port = port;
+        }
+        *tail = ai;
+        tail  = &ai->ai_next;
+    }
+    return head;
+}
+
+void
+addrinfo_set_port(struct addrinfo *list, const in_port_t port) {
+    for(struct addrinfo *ai = list; ai != NULL; ai = ai->ai_next) {
+        if(ai->ai_family == AF_INET) {
+            ((struct sockaddr_in *) ai->ai_addr)->sin_port = port;
+        } else if(ai->ai_family == AF_INET6) {
+            ((struct sockaddr_in6 *) ai->ai_addr)->sin6_port = port;
+        }
+    }
+}
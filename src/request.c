@@ -17,7 +17,11 @@ request_parser_init(struct request_parser *p) {
     p->state     = request_version;
     p->remaining = 0;
     p->addr_idx  = 0;
-    memset(p->request, 0, sizeof(*(p->request)));
+    // el parser completa la dirección según su tipo; no hace falta limpiarla
+    p->request->cmd               = 0;
+    p->request->dest_addr_type    = 0;
+    p->request->dest_addr.fqdn[0] = '\0';
+    p->request->dest_port         = 0;
 }
 
 enum request_state 
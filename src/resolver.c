@@ -0,0 +1,343 @@
+/**
+ * resolver.c - resolución de nombres en un pool fijo de hilos
+ *
+ * Las consultas esperan en una cola circular de tamaño fijo protegida por un
+ * mutex; los hilos duermen en una variable de condición mientras está vacía.
+ * Una tabla de los nombres en espera o corriendo junta los pedidos de un
+ * mismo nombre en una sola consulta. Los avisos que no entran en la cola de
+ * notificaciones de su selector se guardan y se reintentan.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "resolver.h"
+#include "request.h"
+#include "dnscache.h"
+#include "netutils.h"
+
+/** cada cuánto se reintentan los avisos que no entraron en la cola */
+#define RESOLVER_RETRY_MS 10
+
+/** un pedido que espera el resultado de una consulta */
+struct resolver_waiter {
+    struct resolver_waiter *next;
+    fd_selector             selector;
+    int                     fd;
+    in_port_t               port;
+    struct addrinfo       **result;
+};
+
+/** la consulta de un nombre, en cola o corriendo */
+struct resolver_job {
+    /** siguiente en el bucket de su nombre */
+    struct resolver_job    *hnext;
+    struct resolver_waiter *waiters;
+    char                    host[SOCKS_MAX_FQDN_LEN + 1];
+};
+
+static struct {
+    pthread_mutex_t       lock;
+    pthread_cond_t        ready;
+
+    /** cola circular de consultas en espera */
+    struct resolver_job **jobs;
+    unsigned              depth, head, count;
+
+    /** consultas en espera o corriendo, por nombre */
+    struct resolver_job **pending;
+    /** cantidad de buckets - 1 (potencia de 2) */
+    uint32_t              mask;
+
+    /** pedidos ya resueltos cuyo aviso no entró en la cola del selector */
+    struct resolver_waiter *undelivered;
+
+    pthread_t            *threads;
+    unsigned              nthreads;
+    bool                  stop;
+} pool = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+};
+
+static struct resolver_job **
+pending_slot(const char *host) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(const char *p = host; *p != '\0'; p++) {
+        h = (h ^ (uint8_t) *p) * 16777619u;
+    }
+    struct resolver_job **slot = &pool.pending[h & pool.mask];
+    while(*slot != NULL && strcmp((*slot)->host, host) != 0) {
+        slot = &(*slot)->hnext;
+    }
+    return slot;
+}
+
+/** avisa al selector del pedido; si su cola está llena lo deja para después */
+static void
+deliver(struct resolver_waiter *w) {
+    if(SELECTOR_SUCCESS == selector_notify_block(w->selector, w->fd)) {
+        free(w);
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    w->next          = pool.undelivered;
+    pool.undelivered = w;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/** reintenta los avisos pendientes. Se llama con el lock tomado */
+static void
+redeliver(void) {
+    struct resolver_waiter *w = pool.undelivered, *next;
+    pool.undelivered = NULL;
+    for(; w != NULL; w = next) {
+        next = w->next;
+        if(SELECTOR_SUCCESS == selector_notify_block(w->selector, w->fd)) {
+            free(w);
+        } else {
+            w->next          = pool.undelivered;
+            pool.undelivered = w;
+        }
+    }
+}
+
+static void
+resolve(struct resolver_job *job) {
+    const struct addrinfo hints = {
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags    = AI_PASSIVE,
+        .ai_protocol = 0,
+    };
+
+    // sin servicio: cada pedido puede ir a un puerto distinto
+    struct addrinfo *result = NULL;
+    const int error = getaddrinfo(job->host, NULL, &hints, &result);
+    if(error != 0) {
+        result = NULL;
+    }
+    // getaddrinfo no informa el TTL
+    dnscache_store(job->host, result, error == 0 ? DNSCACHE_DEFAULT_TTL
+                 : error == EAI_NONAME || error == EAI_NODATA ? DNSCACHE_NEGATIVE_TTL
+                 : DNSCACHE_FAILURE_TTL);
+
+    // desde acá los pedidos nuevos del nombre arman otra consulta
+    pthread_mutex_lock(&pool.lock);
+    *pending_slot(job->host) = job->hnext;
+    pthread_mutex_unlock(&pool.lock);
+
+    struct resolver_waiter *w = job->waiters, *next;
+    if(w == NULL) {
+        // una renovación del caché que ningún pedido esperó
+        if(result != NULL) {
+            freeaddrinfo(result);
+        }
+        free(job);
+        return;
+    }
+    // el primero se queda con las direcciones, los demás con una copia
+    for(w = w->next; w != NULL; w = next) {
+        next = w->next;
+        *w->result = addrinfo_copy(result, w->port);
+        deliver(w);
+    }
+    w = job->waiters;
+    addrinfo_set_port(result, w->port);
+    *w->result = result;
+    deliver(w);
+    free(job);
+}
+
+static void *
+resolver_run(void *data) {
+    (void) data;
+
+    pthread_mutex_lock(&pool.lock);
+    for(;;) {
+        redeliver();
+        while(pool.count == 0 && !pool.stop) {
+            if(pool.undelivered == NULL) {
+                pthread_cond_wait(&pool.ready, &pool.lock);
+                continue;
+            }
+            // el selector vacía su cola sin avisarnos: se reintenta cada tanto
+            struct timespec t;
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_nsec += RESOLVER_RETRY_MS * 1000000L;
+            if(t.tv_nsec >= 1000000000L) {
+                t.tv_sec++;
+                t.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&pool.ready, &pool.lock, &t);
+            redeliver();
+        }
+        if(pool.stop) {
+            break;
+        }
+        struct resolver_job *job = pool.jobs[pool.head];
+        pool.head = (pool.head + 1) % pool.depth;
+        pool.count--;
+
+        pthread_mutex_unlock(&pool.lock);
+        resolve(job);
+        pthread_mutex_lock(&pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+bool
+resolver_init(const unsigned threads, const unsigned queue_depth) {
+    // a lo sumo `queue_depth' en espera más `threads' corriendo
+    uint32_t n = 1;
+    while(n < 2 * (queue_depth + threads)) {
+        n <<= 1;
+    }
+    pool.jobs    = calloc(queue_depth, sizeof(*pool.jobs));
+    pool.pending = calloc(n, sizeof(*pool.pending));
+    pool.threads = calloc(threads, sizeof(*pool.threads));
+    if(pool.jobs == NULL || pool.pending == NULL || pool.threads == NULL) {
+        goto fail;
+    }
+    pool.mask  = n - 1;
+    pool.depth = queue_depth;
+    pool.head  = pool.count = 0;
+    pool.stop  = false;
+    pool.undelivered = NULL;
+
+    // las señales las atiende el hilo principal
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for(pool.nthreads = 0; pool.nthreads < threads; pool.nthreads++) {
+        if(pthread_create(&pool.threads[pool.nthreads], NULL, resolver_run, NULL) != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(pool.nthreads == threads) {
+        return true;
+    }
+
+fail:
+    resolver_destroy();
+    return false;
+}
+
+/**
+ * encola `host' para el pedido `w' (o, sin pedido, como renovación del
+ * caché), o se lo suma a la consulta del nombre que ya está en la cola o
+ * corriendo, aun con la cola llena. Toma `w' si retorna true.
+ */
+static bool
+enqueue(const char *host, struct resolver_waiter *w) {
+    bool ret = false;
+
+    // se reserva afuera del lock; sobra si ya hay una consulta del nombre
+    struct resolver_job *job = malloc(sizeof(*job));
+    if(job == NULL) {
+        return false;
+    }
+    snprintf(job->host, sizeof(job->host), "%s", host);
+
+    pthread_mutex_lock(&pool.lock);
+    if(pool.stop || pool.jobs == NULL) {
+        // no está iniciado
+    } else {
+        struct resolver_job **slot    = pending_slot(job->host);
+        struct resolver_job  *pending = *slot;
+        if(pending != NULL) {
+            if(w == NULL) {
+                // nada que hacer
+            } else if(pending->waiters == NULL) {
+                pending->waiters = w;
+            } else {
+                w->next                = pending->waiters->next;
+                pending->waiters->next = w;
+            }
+            ret = true;
+        } else if(pool.count < pool.depth) {
+            job->hnext   = NULL;
+            job->waiters = w;
+            *slot        = job;
+            pool.jobs[(pool.head + pool.count) % pool.depth] = job;
+            pool.count++;
+            pthread_cond_signal(&pool.ready);
+            job = NULL;
+            ret = true;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    free(job);
+    return ret;
+}
+
+bool
+resolver_submit(fd_selector s, const int fd, const char *host,
+                const in_port_t port, struct addrinfo **result) {
+    struct resolver_waiter *w = malloc(sizeof(*w));
+    if(w == NULL) {
+        return false;
+    }
+    w->next     = NULL;
+    w->selector = s;
+    w->fd       = fd;
+    w->port     = port;
+    w->result   = result;
+
+    if(!enqueue(host, w)) {
+        free(w);
+        return false;
+    }
+    return true;
+}
+
+bool
+resolver_prefetch(const char *host) {
+    return enqueue(host, NULL);
+}
+
+void
+resolver_destroy(void) {
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    for(unsigned i = 0; i < pool.nthreads; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    // las que quedaron en la cola
+    for(unsigned i = 0; i < pool.count; i++) {
+        struct resolver_job    *job = pool.jobs[(pool.head + i) % pool.depth];
+        struct resolver_waiter *w, *next;
+        for(w = job->waiters; w != NULL; w = next) {
+            next = w->next;
+            free(w);
+        }
+        free(job);
+    }
+    // y los avisos que no llegaron a entregarse
+    struct resolver_waiter *w, *next;
+    for(w = pool.undelivered; w != NULL; w = next) {
+        next = w->next;
+        free(w);
+    }
+    pool.undelivered = NULL;
+    free(pool.threads);
+    free(pool.jobs);
+    free(pool.pending);
+    pool.threads  = NULL;
+    pool.jobs     = NULL;
+    pool.pending  = NULL;
+    pool.nthreads = 0;
+    pool.depth    = pool.count = 0;
+}
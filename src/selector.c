@@ -6,17 +6,35 @@
 #include <string.h> // memset
 #include <assert.h> // :)
 #include <errno.h>  // :)
-#include <pthread.h>
 
 #include <stdint.h> // SIZE_MAX
+#include <limits.h> // INT_MAX
+#include <time.h>   // clock_gettime
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
-#include <sys/signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
 #include "selector.h"
 
+/*
+ * io_uring se maneja con las syscalls directamente (sin liburing). Hace falta
+ * un kernel >= 5.11 (IORING_FEAT_EXT_ARG) y headers que lo describan.
+ */
+#if defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    if defined(IORING_ENTER_EXT_ARG) && defined(__NR_io_uring_setup)
+#      define SELECTOR_HAVE_URING 1
+#    endif
+#  endif
+#endif
+
 #define N(x) (sizeof(x)/sizeof((x)[0]))
 
 #define ERROR_DEFAULT_MSG "something failed"
@@ -48,40 +66,13 @@ selector_error(const selector_status status) {
 }
 
 
-static void
-wake_handler(const int signal) {
-    // nada que hacer. está solo para interrumpir el select
-    (void) signal;
-}
-
-// señal a usar para las notificaciones de resolución
+// opciones con las que se inicializó la librería
 struct selector_init conf;
-static sigset_t emptyset, blockset;
 
 selector_status
 selector_init(const struct selector_init  *c) {
     memcpy(&conf, c, sizeof(conf));
-
-    selector_status   ret = SELECTOR_SUCCESS;
-    struct sigaction act = {
-        .sa_handler = wake_handler,
-    };
-
-    sigemptyset(&blockset);
-    sigaddset  (&blockset, conf.signal);
-    if(-1 == sigprocmask(SIG_BLOCK, &blockset, NULL)) {
-        ret = SELECTOR_IO;
-        goto finally;
-    }
-
-    if (sigaction(conf.signal, &act, 0)) {
-        ret = SELECTOR_IO;
-        goto finally;
-    }
-    sigemptyset(&emptyset);
-
-finally:
-    return ret;
+    return SELECTOR_SUCCESS;
 }
 
 selector_status
@@ -89,28 +80,104 @@ selector_close(void) {
     return SELECTOR_SUCCESS;
 }
 
+const char *
+selector_backend_name(const selector_backend backend) {
+    const char *name;
+    switch(backend) {
+        case SELECTOR_BACKEND_SELECT:
+            name = "pselect";
+            break;
+        case SELECTOR_BACKEND_EPOLL:
+            name = "epoll";
+            break;
+        case SELECTOR_BACKEND_URING:
+            name = "io_uring";
+            break;
+        default:
+            name = "auto";
+    }
+    return name;
+}
+
 // estructuras internas
 struct item {
    int                 fd;
    fd_interest         interest;
    const fd_handler   *handler;
    void *              data;
-};
 
-/* tarea bloqueante */
-struct blocking_job {
-    /** selector dueño de la resolucion */
-    fd_selector  s;
-    /** file descriptor dueño de la resolucion */
-    int fd;
+   /**
+    * (epoll) generación de la registración. Viaja en cada evento para
+    * descartar los que quedaron pendientes de un fd que se cerró y se
+    * reutilizó durante la misma iteración.
+    */
+   uint32_t            gen;
+   /**
+    * (epoll) si el fd está dado de alta en el conjunto del kernel.
+    * (io_uring) si hay un poll pendiente para el fd.
+    */
+   bool                in_kernel;
+   /** (io_uring) intereses con los que se armó el poll pendiente */
+   fd_interest         polled;
+
+   /** si el timer del fd está armado */
+   bool                timer_armed;
+   /** slot de la rueda en el que está encolado (nivel * TIMER_SLOTS + slot) */
+   uint16_t            timer_slot;
+   /**
+    * vecinos en la lista del slot. Son fds y no punteros porque la tabla de
+    * items se realoca al crecer.
+    */
+   int                 timer_prev, timer_next;
+   /** vencimiento, en ms del reloj monotónico */
+   uint64_t            timer_expires;
+};
 
-    /** datos del trabajo provisto por el usuario */
-    void *data;
+/**
+ * rueda de timers jerárquica: TIMER_LEVELS niveles de TIMER_SLOTS slots. El
+ * nivel 0 tiene un slot por milisegundo; cada slot del nivel L abarca
+ * TIMER_SLOTS^L ms, y cuando el nivel inferior da la vuelta sus timers se
+ * redistribuyen (cascada) hacia abajo. Con 4 niveles de 64 slots se cubren
+ * ~4.6 horas; vencimientos más lejanos se estacionan en el último nivel y
+ * se recolocan al llegar su cascada.
+ */
+#define TIMER_LEVELS      4
+#define TIMER_SLOT_BITS   6
+#define TIMER_SLOTS       (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK   (TIMER_SLOTS - 1)
+#define TIMER_SPAN        (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+struct timer_wheel {
+    /** último milisegundo procesado */
+    uint64_t now;
+    /** primer fd de cada slot, -1 si está vacío */
+    int      slots[TIMER_LEVELS][TIMER_SLOTS];
+    /** slots no vacíos de cada nivel, para ubicar el próximo vencimiento */
+    uint64_t occupied[TIMER_LEVELS];
+    /** cantidad de timers armados */
+    size_t   armed;
+};
 
-    /** el siguiente en la lista */
-    struct blocking_job *next;
+/**
+ * tarea bloqueante finalizada, encolada por el hilo que la ejecutó.
+ *
+ * Cada slot de la cola lleva un número de secuencia que indica de quién es
+ * el turno: cuando vale `pos' el slot está libre para el productor que
+ * reservó la posición `pos'; cuando vale `pos + 1' tiene un trabajo listo
+ * para el consumidor (el hilo del selector).
+ */
+struct blocking_job {
+    size_t seq;
+    /** file descriptor dueño del trabajo */
+    int    fd;
 };
 
+/**
+ * cantidad de trabajos finalizados que pueden esperar a ser despachados.
+ * Potencia de 2.
+ */
+#define BLOCKING_QUEUE_SIZE 4096
+
 /** marca para usar en item->fd para saber que no está en uso */
 static const int FD_UNUSED = -1;
 
@@ -120,10 +187,23 @@ static const int FD_UNUSED = -1;
 struct fdselector {
     struct item    *fds;
     size_t          fd_size;  // cantidad de elementos posibles de fds
+    /** cantidad máxima de elementos que soporta el multiplexor */
+    size_t          fd_limit;
 
     /** fd maximo para usar en select() */
     int max_fd;  // max(.fds[].fd)
 
+    /** multiplexor en uso */
+    selector_backend backend;
+    /** (epoll) descriptor de la instancia de epoll */
+    int              epfd;
+    /** (epoll) eventos retornados por epoll_wait() */
+    struct epoll_event *events;
+    /** (epoll) última generación asignada a un item */
+    uint32_t            gen;
+    /** (io_uring) anillos compartidos con el kernel */
+    struct uring       *uring;
+
     /** descriptores prototipicos ser usados en select */
     fd_set master_r, master_w;
     /** para ser usado en el select() (recordar que select cambia el valor) */
@@ -134,26 +214,40 @@ struct fdselector {
     /** tambien select() puede cambiar el valor */
     struct timespec slave_t;
 
+    /** timers por fd */
+    struct timer_wheel timers;
+
     // notificaciónes entre blocking jobs y el selector
-    volatile pthread_t      selector_thread;
-    /** protege el acceso a resolutions jobs */
-    pthread_mutex_t         resolution_mutex;
+    /** eventfd registrado en el propio selector para despertarlo */
+    int                     wakeup_fd;
+    /**
+     * hay una escritura pendiente de consumir en wakeup_fd. Permite que
+     * varias notificaciones se colapsen en un solo despertar.
+     */
+    bool                    wakeup_pending;
     /**
-     * lista de trabajos blockeantes que finalizaron y que pueden ser
-     * notificados.
+     * cola (FIFO, sin locks, varios productores y un consumidor) de
+     * trabajos bloqueantes que finalizaron y que pueden ser notificados.
      */
-    struct blocking_job    *resolution_jobs;
+    struct blocking_job    *jobs;
+    /** próxima posición a reservar por un productor */
+    size_t                  jobs_tail;
+    /** próxima posición a despachar (solo la toca el hilo del selector) */
+    size_t                  jobs_head;
 };
 
-/** cantidad máxima de file descriptors que la plataforma puede manejar */
+/** cantidad máxima de file descriptors que select() puede manejar */
 #define ITEMS_MAX_SIZE      FD_SETSIZE
 
+/** cantidad máxima de eventos a retirar en cada epoll_wait() */
+#define EPOLL_MAX_EVENTS    1024
+
 /**
  * determina el tamaño a crecer, generando algo de slack para no tener
  * que realocar constantemente.
  */
 static
-size_t next_capacity(const size_t n) {
+size_t next_capacity(fd_selector s, const size_t n) {
     unsigned bits = 0;
     size_t tmp = n;
     while(tmp != 0) {
@@ -163,8 +257,8 @@ size_t next_capacity(const size_t n) {
     tmp = 1UL << bits;
 
     assert(tmp >= n);
-    if(tmp > ITEMS_MAX_SIZE) {
-        tmp = ITEMS_MAX_SIZE;
+    if(tmp > s->fd_limit) {
+        tmp = s->fd_limit;
     }
 
     return tmp + 1;
@@ -172,9 +266,339 @@ size_t next_capacity(const size_t n) {
 
 static inline void
 item_init(struct item *item) {
+    memset(item, 0x00, sizeof(*item));
     item->fd = FD_UNUSED;
 }
 
+/**
+ * traduce un interés a los eventos de epoll. OP_ERROR no tiene bit propio:
+ * epoll siempre reporta EPOLLERR/EPOLLHUP de los fds registrados.
+ */
+static uint32_t
+interest_to_epoll(const fd_interest interest) {
+    uint32_t ret = 0;
+    if(interest & OP_READ) {
+        ret |= EPOLLIN;
+    }
+    if(interest & OP_WRITE) {
+        ret |= EPOLLOUT;
+    }
+    return ret;
+}
+
+/**
+ * sincroniza el conjunto de interés del kernel con el item.
+ *
+ * Un fd sin intereses se da de baja: epoll reporta EPOLLHUP/EPOLLERR aunque no
+ * se pida ningún evento y eso haría girar en vacío al selector mientras, por
+ * ejemplo, una sesión espera una resolución DNS.
+ */
+static selector_status
+items_update_epoll_for_fd(fd_selector s, struct item *item) {
+    selector_status ret = SELECTOR_SUCCESS;
+    const bool want = ITEM_USED(item) && item->interest != OP_NOOP;
+    int op;
+
+    if(want) {
+        op = item->in_kernel ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    } else if(item->in_kernel) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        goto finally;
+    }
+
+    struct epoll_event ev = {
+        .events   = interest_to_epoll(item->interest),
+        .data.u64 = ((uint64_t)item->gen << 32) | (uint32_t)item->fd,
+    };
+    if(-1 == epoll_ctl(s->epfd, op, item->fd, &ev)) {
+        ret = SELECTOR_IO;
+    } else {
+        item->in_kernel = want;
+    }
+
+finally:
+    return ret;
+}
+
+#ifdef SELECTOR_HAVE_URING
+
+/** entradas del anillo de envío. El de completados es 4 veces más grande */
+#define URING_SQ_ENTRIES    1024
+#define URING_CQ_ENTRIES    (4 * URING_SQ_ENTRIES)
+
+/** user_data de los pedidos cuyo completado no interesa (cancelaciones) */
+#define URING_IGNORE        UINT64_MAX
+
+/**
+ * io_uring usado como multiplexor: cada fd con intereses tiene un
+ * IORING_OP_POLL_ADD pendiente. Los polls son de un solo disparo y se
+ * vuelven a armar luego de despachar el fd, lo que da la misma semántica
+ * "por nivel" que epoll y pselect (los handlers hacen una lectura por
+ * evento). Armar, cambiar y cancelar polls solo escribe en el anillo de
+ * envío; todo viaja al kernel con la espera de la siguiente iteración.
+ */
+struct uring {
+    int                  fd;
+
+    /** mapeo de los anillos (SQ y CQ comparten el mapeo) */
+    char                *ring;
+    size_t               ring_size;
+    struct io_uring_sqe *sqes;
+    size_t               sqes_size;
+
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /** copia de los completados de una iteración */
+    struct io_uring_cqe *ready;
+    unsigned             ready_size;
+
+    /** el kernel puede omitir el completado de las cancelaciones */
+    bool                 skip_success;
+};
+
+static int
+uring_enter(const int fd, const unsigned to_submit, const unsigned min_complete,
+            const unsigned flags, void *arg, const size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, arg, argsz);
+}
+
+/** entradas escritas en el anillo de envío que el kernel no consumió */
+static unsigned
+uring_sq_pending(const struct uring *u) {
+    return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void
+uring_destroy(struct uring *u) {
+    if(u != NULL) {
+        if(u->sqes != NULL && uring_sq_pending(u) > 0) {
+            // las cancelaciones encoladas al desregistrar liberan las
+            // referencias a los sockets; si quedan para el cierre asincrónico
+            // del anillo, un socket pasivo sigue ocupando su puerto un rato
+            uring_enter(u->fd, uring_sq_pending(u), 0, 0, NULL, 0);
+        }
+        if(u->sqes != NULL) {
+            munmap(u->sqes, u->sqes_size);
+        }
+        if(u->ring != NULL) {
+            munmap(u->ring, u->ring_size);
+        }
+        if(u->fd != -1) {
+            close(u->fd);
+        }
+        free(u->ready);
+        free(u);
+    }
+}
+
+/** crea la instancia y mapea los anillos. NULL si el kernel no lo soporta */
+static struct uring *
+uring_new(void) {
+    struct uring *u = calloc(1, sizeof(*u));
+    if(u == NULL) {
+        goto fail;
+    }
+    u->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0x00, sizeof(p));
+    p.flags      = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    u->fd = (int) syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p);
+    if(u->fd == -1) {
+        goto fail;
+    }
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+                            | IORING_FEAT_EXT_ARG;
+    if((p.features & required) != required) {
+        goto fail;
+    }
+#ifdef IORING_FEAT_CQE_SKIP
+    u->skip_success = (p.features & IORING_FEAT_CQE_SKIP) != 0;
+#endif
+
+    const size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    const size_t cq_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->ring == MAP_FAILED) {
+        u->ring = NULL;
+        goto fail;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto fail;
+    }
+
+    u->sq_head  = (unsigned *)(u->ring + p.sq_off.head);
+    u->sq_tail  = (unsigned *)(u->ring + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(u->ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(u->ring + p.sq_off.array);
+    u->cq_head  = (unsigned *)(u->ring + p.cq_off.head);
+    u->cq_tail  = (unsigned *)(u->ring + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)(u->ring + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)(u->ring + p.cq_off.cqes);
+    for(unsigned i = 0; i < p.sq_entries; i++) {
+        u->sq_array[i] = i;
+    }
+
+    u->ready_size = p.cq_entries;
+    u->ready      = malloc(u->ready_size * sizeof(*u->ready));
+    if(u->ready == NULL) {
+        goto fail;
+    }
+    return u;
+
+fail:
+    uring_destroy(u);
+    return NULL;
+}
+
+/**
+ * reserva una entrada en el anillo de envío. Si está lleno se envía lo
+ * acumulado sin esperar. NULL ante error.
+ */
+static struct io_uring_sqe *
+uring_get_sqe(struct uring *u) {
+    if(uring_sq_pending(u) > *u->sq_mask) {
+        int n;
+        do {
+            n = uring_enter(u->fd, uring_sq_pending(u), 0, 0, NULL, 0);
+        } while(n == -1 && errno == EINTR);
+        if(uring_sq_pending(u) > *u->sq_mask) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = u->sqes + (*u->sq_tail & *u->sq_mask);
+    memset(sqe, 0x00, sizeof(*sqe));
+    return sqe;
+}
+
+/** publica la entrada obtenida con uring_get_sqe() */
+static void
+uring_commit_sqe(struct uring *u) {
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t
+uring_user_data(const struct item *item) {
+    return ((uint64_t)item->gen << 32) | (uint32_t)item->fd;
+}
+
+/** cancela el poll pendiente del item, si lo hay */
+static selector_status
+uring_cancel(fd_selector s, struct item *item) {
+    if(!item->in_kernel) {
+        return SELECTOR_SUCCESS;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(s->uring);
+    if(sqe == NULL) {
+        return SELECTOR_IO;
+    }
+    sqe->opcode    = IORING_OP_POLL_REMOVE;
+    sqe->addr      = uring_user_data(item);
+    sqe->user_data = URING_IGNORE;
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+    if(s->uring->skip_success) {
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    }
+#endif
+    uring_commit_sqe(s->uring);
+    item->in_kernel = false;
+    return SELECTOR_SUCCESS;
+}
+
+/**
+ * sincroniza el poll pendiente del item con sus intereses. Un poll que
+ * cubre los intereses actuales se deja como está (handle_item filtra los
+ * eventos que sobran), incluso si el item pasó a OP_NOOP: al ser de un
+ * solo disparo no puede hacer girar al selector.
+ */
+static selector_status
+items_update_uring_for_fd(fd_selector s, struct item *item) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    if(item->in_kernel && (item->interest & ~item->polled) != 0) {
+        ret = uring_cancel(s, item);
+        if(SELECTOR_SUCCESS != ret) {
+            goto finally;
+        }
+    }
+    if(ITEM_USED(item) && item->interest != OP_NOOP && !item->in_kernel) {
+        struct io_uring_sqe *sqe = uring_get_sqe(s->uring);
+        if(sqe == NULL) {
+            ret = SELECTOR_IO;
+            goto finally;
+        }
+        item->gen = ++s->gen;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = item->fd;
+        sqe->poll32_events = ((item->interest & OP_READ)  ? POLLIN  : 0)
+                           | ((item->interest & OP_WRITE) ? POLLOUT : 0);
+        // POLLERR/POLLHUP llegan siempre: OP_ERROR no agrega bits
+        sqe->user_data     = uring_user_data(item);
+        uring_commit_sqe(s->uring);
+        item->in_kernel = true;
+        item->polled    = item->interest;
+    }
+finally:
+    return ret;
+}
+
+/**
+ * envía los pedidos acumulados y espera hasta `timeout' ms por al menos un
+ * completado. Retorna -1 solo ante errores.
+ */
+static int
+uring_wait(fd_selector s, const uint64_t timeout) {
+    struct uring *u = s->uring;
+    struct __kernel_timespec ts = {
+        .tv_sec  = timeout / 1000,
+        .tv_nsec = (timeout % 1000) * 1000000,
+    };
+    struct io_uring_getevents_arg arg = {
+        .ts = (uint64_t)(uintptr_t)&ts,
+    };
+    int n = uring_enter(u->fd, uring_sq_pending(u), 1,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg, sizeof(arg));
+    if(n == -1 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+        // venció el timeout, una señal, o completados desbordados que se
+        // recuperan en la próxima llamada
+        n = 0;
+    }
+    return n;
+}
+
+#endif
+
+/** sincroniza el multiplexor del kernel (epoll o io_uring) con el item */
+static selector_status
+items_update_kernel_for_fd(fd_selector s, struct item *item) {
+    selector_status ret = SELECTOR_SUCCESS;
+    switch(s->backend) {
+        case SELECTOR_BACKEND_EPOLL:
+            ret = items_update_epoll_for_fd(s, item);
+            break;
+#ifdef SELECTOR_HAVE_URING
+        case SELECTOR_BACKEND_URING:
+            ret = items_update_uring_for_fd(s, item);
+            break;
+#endif
+        default:
+            break;
+    }
+    return ret;
+}
+
 /**
  * inicializa los nuevos items. `last' es el indice anterior.
  */
@@ -187,29 +611,31 @@ items_init(fd_selector s, const size_t last) {
 }
 
 /**
- * calcula el fd maximo para ser utilizado en select()
+ * recalcula el fd maximo para ser utilizado en select() luego de liberar un
+ * item. Se busca hacia abajo desde el máximo anterior: si el liberado no era
+ * el máximo el costo es O(1), y un cierre masivo cuesta O(n) en total en
+ * lugar de O(n) por cada cierre.
  */
 static int
 items_max_fd(fd_selector s) {
-    int max = 0;
-    for(int i = 0; i <= s->max_fd; i++) {
-        struct item *item = s->fds + i;
-        if(ITEM_USED(item)) {
-            if(item->fd > max) {
-                max = item->fd;
-            }
-        }
+    int max = s->max_fd;
+    while(max > 0 && !ITEM_USED(s->fds + max)) {
+        max--;
     }
     return max;
 }
 
 static void
 items_update_fdset_for_fd(fd_selector s, const struct item * item) {
+    if(SELECTOR_BACKEND_SELECT != s->backend) {
+        return;
+    }
     FD_CLR(item->fd, &s->master_r);
     FD_CLR(item->fd, &s->master_w);
 
     if(ITEM_USED(item)) {
-        if(item->interest & OP_READ) {
+        // select() reporta los errores como listo para leer
+        if(item->interest & (OP_READ | OP_ERROR)) {
             FD_SET(item->fd, &(s->master_r));
         }
 
@@ -229,10 +655,10 @@ ensure_capacity(fd_selector s, const size_t n) {
     const size_t element_size = sizeof(*s->fds);
     if(n < s->fd_size) {
         ret = SELECTOR_SUCCESS;
-    } else if(n > ITEMS_MAX_SIZE) {
+    } else if(n > s->fd_limit) {
         ret = SELECTOR_MAXFD;
     } else if(NULL == s->fds) {
-        const size_t new_size = next_capacity(n);
+        const size_t new_size = next_capacity(s, n);
 
         s->fds = calloc(new_size, element_size);
         if(NULL == s->fds) {
@@ -242,7 +668,7 @@ ensure_capacity(fd_selector s, const size_t n) {
             items_init(s, 0);
         }
     } else {
-        const size_t new_size = next_capacity(n);
+        const size_t new_size = next_capacity(s, n);
         if (new_size > SIZE_MAX/element_size) {
             ret = SELECTOR_ENOMEM;
         } else {
@@ -262,6 +688,279 @@ ensure_capacity(fd_selector s, const size_t n) {
     return ret;
 }
 
+/**
+ * prepara el multiplexor pedido en la configuración. Si epoll no está
+ * disponible se degrada a pselect.
+ */
+static selector_status
+backend_init(fd_selector s) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    s->epfd     = -1;
+    s->backend  = SELECTOR_BACKEND_SELECT;
+    s->fd_limit = ITEMS_MAX_SIZE;
+
+#ifdef SELECTOR_HAVE_URING
+    if(SELECTOR_BACKEND_URING == conf.backend) {
+        s->uring = uring_new();
+        if(NULL != s->uring) {
+            s->backend  = SELECTOR_BACKEND_URING;
+            s->fd_limit = INT_MAX;
+            goto finally;
+        }
+    }
+#endif
+
+    if(SELECTOR_BACKEND_SELECT != conf.backend) {
+        s->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if(-1 == s->epfd) {
+            if(SELECTOR_BACKEND_EPOLL == conf.backend) {
+                ret = SELECTOR_IO;
+            }
+        } else {
+            s->events = calloc(EPOLL_MAX_EVENTS, sizeof(*s->events));
+            if(NULL == s->events) {
+                ret = SELECTOR_ENOMEM;
+            } else {
+                s->backend  = SELECTOR_BACKEND_EPOLL;
+                s->fd_limit = INT_MAX;
+            }
+        }
+    }
+
+#ifdef SELECTOR_HAVE_URING
+finally:
+#endif
+    return ret;
+}
+
+/** milisegundos del reloj monotónico */
+static uint64_t
+clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void
+timers_init(struct timer_wheel *w) {
+    for(unsigned l = 0; l < TIMER_LEVELS; l++) {
+        for(unsigned i = 0; i < TIMER_SLOTS; i++) {
+            w->slots[l][i] = FD_UNUSED;
+        }
+        w->occupied[l] = 0;
+    }
+    w->armed = 0;
+    w->now   = clock_ms();
+}
+
+/** encola el item en el slot que corresponde a su vencimiento */
+static void
+timer_link(fd_selector s, struct item *item) {
+    struct timer_wheel *w = &s->timers;
+
+    uint64_t expires = item->timer_expires;
+    if(expires < w->now) {
+        expires = w->now;
+    }
+    uint64_t delta = expires - w->now;
+    if(delta >= TIMER_SPAN) {
+        // demasiado lejos: se estaciona en el último nivel
+        delta   = TIMER_SPAN - 1;
+        expires = w->now + delta;
+    }
+    unsigned level = 0;
+    while(delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    const unsigned slot = (expires >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+
+    int *head = &w->slots[level][slot];
+    item->timer_slot = level * TIMER_SLOTS + slot;
+    item->timer_prev = FD_UNUSED;
+    item->timer_next = *head;
+    if(*head != FD_UNUSED) {
+        s->fds[*head].timer_prev = item->fd;
+    }
+    *head = item->fd;
+    w->occupied[level] |= 1ULL << slot;
+}
+
+/** saca al item de la lista de su slot */
+static void
+timer_unlink(fd_selector s, struct item *item) {
+    struct timer_wheel *w = &s->timers;
+    const unsigned level = item->timer_slot / TIMER_SLOTS;
+    const unsigned slot  = item->timer_slot % TIMER_SLOTS;
+
+    if(item->timer_prev != FD_UNUSED) {
+        s->fds[item->timer_prev].timer_next = item->timer_next;
+    } else {
+        w->slots[level][slot] = item->timer_next;
+        if(item->timer_next == FD_UNUSED) {
+            w->occupied[level] &= ~(1ULL << slot);
+        }
+    }
+    if(item->timer_next != FD_UNUSED) {
+        s->fds[item->timer_next].timer_prev = item->timer_prev;
+    }
+}
+
+static void
+timer_cancel(fd_selector s, struct item *item) {
+    if(item->timer_armed) {
+        timer_unlink(s, item);
+        item->timer_armed = false;
+        s->timers.armed--;
+    }
+}
+
+/** redistribuye los timers de un slot de nivel superior */
+static void
+timers_cascade(fd_selector s, const unsigned level, const unsigned slot) {
+    struct timer_wheel *w = &s->timers;
+    int fd = w->slots[level][slot];
+
+    w->slots[level][slot] = FD_UNUSED;
+    w->occupied[level]   &= ~(1ULL << slot);
+    while(fd != FD_UNUSED) {
+        struct item *item = s->fds + fd;
+        fd = item->timer_next;
+        timer_link(s, item);
+    }
+}
+
+/**
+ * distancia, entre 1 y TIMER_SLOTS, desde `pos' al siguiente slot ocupado.
+ * `occupied' no puede ser 0.
+ */
+static unsigned
+timers_next_slot(const uint64_t occupied, const unsigned pos) {
+    const unsigned shift = (pos + 1) & TIMER_SLOT_MASK;
+    const uint64_t r = shift == 0 ? occupied
+                     : (occupied >> shift) | (occupied << (TIMER_SLOTS - shift));
+    return __builtin_ctzll(r) + 1;
+}
+
+/**
+ * milisegundos hasta el próximo evento de la rueda: un vencimiento en el
+ * nivel 0 o una cascada de un nivel superior (que nunca ocurre después de
+ * los vencimientos que contiene). UINT64_MAX si no hay timers.
+ */
+static uint64_t
+timers_next_timeout(fd_selector s) {
+    const struct timer_wheel *w = &s->timers;
+    uint64_t ret = UINT64_MAX;
+
+    for(unsigned level = 0; w->armed > 0 && level < TIMER_LEVELS; level++) {
+        if(w->occupied[level] == 0) {
+            continue;
+        }
+        const unsigned bits = TIMER_SLOT_BITS * level;
+        const unsigned pos  = (w->now >> bits) & TIMER_SLOT_MASK;
+        const uint64_t k    = timers_next_slot(w->occupied[level], pos);
+        const uint64_t at   = ((w->now >> bits) + k) << bits;
+        if(at - w->now < ret) {
+            ret = at - w->now;
+        }
+    }
+    return ret;
+}
+
+/** despacha los timers vencidos hasta el instante actual */
+static void
+timers_run(fd_selector s) {
+    struct timer_wheel *w = &s->timers;
+    const uint64_t now = clock_ms();
+    struct selector_key key = {
+        .s = s,
+    };
+
+    while(w->now < now && w->armed > 0) {
+        // se saltean de una los milisegundos en los que no pasa nada
+        const uint64_t next = timers_next_timeout(s);
+        if(now - w->now < next) {
+            break;
+        }
+        w->now += next;
+
+        unsigned slot = w->now & TIMER_SLOT_MASK;
+        for(unsigned level = 1; slot == 0 && level < TIMER_LEVELS; level++) {
+            slot = (w->now >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK;
+            timers_cascade(s, level, slot);
+        }
+
+        // el handler puede re-armar o desregistrar fds: se saca de a uno
+        int *head = &w->slots[0][w->now & TIMER_SLOT_MASK];
+        while(*head != FD_UNUSED) {
+            struct item *item = s->fds + *head;
+            timer_cancel(s, item);
+            if(item->handler->handle_timeout != NULL) {
+                key.fd   = item->fd;
+                key.data = item->data;
+                item->handler->handle_timeout(&key);
+            }
+        }
+    }
+    w->now = now;
+}
+
+/** consume las notificaciones pendientes: una lectura por iteración */
+static void
+wakeup_read(struct selector_key *key) {
+    uint64_t n;
+    while(read(key->fd, &n, sizeof(n)) > 0) {
+        // eventfd acumula en un contador, una lectura alcanza
+    }
+    // las notificaciones encoladas antes de este punto se despachan en
+    // handle_block_notifications() al final de esta misma iteración.
+    __atomic_store_n(&key->s->wakeup_pending, false, __ATOMIC_RELEASE);
+}
+
+static void
+wakeup_close(struct selector_key *key) {
+    close(key->fd);
+    key->s->wakeup_fd = -1;
+}
+
+static const struct fd_handler wakeup_handler = {
+    .handle_read  = wakeup_read,
+    .handle_close = wakeup_close,
+};
+
+/** crea el eventfd de notificaciones y lo registra en el selector */
+static selector_status
+wakeup_init(fd_selector s) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(-1 == fd) {
+        ret = SELECTOR_IO;
+        goto finally;
+    }
+    ret = selector_register(s, fd, &wakeup_handler, OP_READ, NULL);
+    if(SELECTOR_SUCCESS != ret) {
+        close(fd);
+        goto finally;
+    }
+    s->wakeup_fd = fd;
+finally:
+    return ret;
+}
+
+/** preasigna la cola de trabajos bloqueantes */
+static selector_status
+jobs_init(fd_selector s) {
+    s->jobs = calloc(BLOCKING_QUEUE_SIZE, sizeof(*s->jobs));
+    if(NULL == s->jobs) {
+        return SELECTOR_ENOMEM;
+    }
+    for(size_t i = 0; i < BLOCKING_QUEUE_SIZE; i++) {
+        s->jobs[i].seq = i;
+    }
+    return SELECTOR_SUCCESS;
+}
+
 fd_selector
 selector_new(const size_t initial_elements) {
     size_t size = sizeof(struct fdselector);
@@ -271,9 +970,12 @@ selector_new(const size_t initial_elements) {
         ret->master_t.tv_sec  = conf.select_timeout.tv_sec;
         ret->master_t.tv_nsec = conf.select_timeout.tv_nsec;
         assert(ret->max_fd == 0);
-        ret->resolution_jobs  = 0;
-        pthread_mutex_init(&ret->resolution_mutex, 0);
-        if(0 != ensure_capacity(ret, initial_elements)) {
+        ret->wakeup_fd        = -1;
+        timers_init(&ret->timers);
+        if(SELECTOR_SUCCESS != jobs_init(ret)
+           || SELECTOR_SUCCESS != backend_init(ret)
+           || 0 != ensure_capacity(ret, initial_elements)
+           || SELECTOR_SUCCESS != wakeup_init(ret)) {
             selector_destroy(ret);
             ret = NULL;
         }
@@ -281,6 +983,11 @@ selector_new(const size_t initial_elements) {
     return ret;
 }
 
+selector_backend
+selector_get_backend(fd_selector s) {
+    return s->backend;
+}
+
 void
 selector_destroy(fd_selector s) {
     if(s != NULL) {
@@ -290,22 +997,23 @@ selector_destroy(fd_selector s) {
                     selector_unregister_fd(s, i);
                 }
             }
-            pthread_mutex_destroy(&s->resolution_mutex);
-            struct blocking_job* j = s->resolution_jobs;
-            while (j != NULL) {
-                struct blocking_job* aux = j;
-                j = j->next;
-                free(aux);
-            }
             free(s->fds);
             s->fds     = NULL;
             s->fd_size = 0;
         }
+        if(s->epfd != -1) {
+            close(s->epfd);
+        }
+#ifdef SELECTOR_HAVE_URING
+        uring_destroy(s->uring);
+#endif
+        free(s->events);
+        free(s->jobs);
         free(s);
     }
 }
 
-#define INVALID_FD(fd)  ((fd) < 0 || (fd) >= ITEMS_MAX_SIZE)
+#define INVALID_FD(s, fd)  ((fd) < 0 || (size_t)(fd) >= (s)->fd_limit)
 
 selector_status
 selector_register(fd_selector        s,
@@ -315,13 +1023,13 @@ selector_register(fd_selector        s,
                      void *data) {
     selector_status ret = SELECTOR_SUCCESS;
     // 0. validación de argumentos
-    if(s == NULL || INVALID_FD(fd) || handler == NULL) {
+    if(s == NULL || INVALID_FD(s, fd) || handler == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
     // 1. tenemos espacio?
     size_t ufd = (size_t)fd;
-    if(ufd > s->fd_size) {
+    if(ufd >= s->fd_size) {
         ret = ensure_capacity(s, ufd);
         if(SELECTOR_SUCCESS != ret) {
             goto finally;
@@ -338,6 +1046,13 @@ selector_register(fd_selector        s,
         item->handler  = handler;
         item->interest = interest;
         item->data     = data;
+        item->gen      = ++s->gen;
+
+        ret = items_update_kernel_for_fd(s, item);
+        if(SELECTOR_SUCCESS != ret) {
+            item_init(item);
+            goto finally;
+        }
 
         // actualizo colaterales
         if(fd > s->max_fd) {
@@ -355,7 +1070,7 @@ selector_unregister_fd(fd_selector       s,
                        const int         fd) {
     selector_status ret = SELECTOR_SUCCESS;
 
-    if(NULL == s || INVALID_FD(fd)) {
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -375,8 +1090,19 @@ selector_unregister_fd(fd_selector       s,
         item->handler->handle_close(&key);
     }
 
+    timer_cancel(s, item);
     item->interest = OP_NOOP;
     items_update_fdset_for_fd(s, item);
+    if(SELECTOR_BACKEND_EPOLL == s->backend) {
+        // el fd puede estar cerrado (y ya fuera del conjunto): no es un error
+        items_update_epoll_for_fd(s, item);
+    }
+#ifdef SELECTOR_HAVE_URING
+    if(SELECTOR_BACKEND_URING == s->backend) {
+        // el poll pendiente retiene el socket aunque el usuario lo cierre
+        uring_cancel(s, item);
+    }
+#endif
 
     memset(item, 0x00, sizeof(*item));
     item_init(item);
@@ -390,7 +1116,7 @@ selector_status
 selector_set_interest(fd_selector s, int fd, fd_interest i) {
     selector_status ret = SELECTOR_SUCCESS;
 
-    if(NULL == s || INVALID_FD(fd)) {
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -399,8 +1125,12 @@ selector_set_interest(fd_selector s, int fd, fd_interest i) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
+    if(item->interest == i) {
+        goto finally;
+    }
     item->interest = i;
     items_update_fdset_for_fd(s, item);
+    ret = items_update_kernel_for_fd(s, item);
 finally:
     return ret;
 }
@@ -409,7 +1139,7 @@ selector_status
 selector_set_interest_key(struct selector_key *key, fd_interest i) {
     selector_status ret;
 
-    if(NULL == key || NULL == key->s || INVALID_FD(key->fd)) {
+    if(NULL == key || NULL == key->s || INVALID_FD(key->s, key->fd)) {
         ret = SELECTOR_IARGS;
     } else {
         ret = selector_set_interest(key->s, key->fd, i);
@@ -418,106 +1148,348 @@ selector_set_interest_key(struct selector_key *key, fd_interest i) {
     return ret;
 }
 
+selector_status
+selector_set_timeout(fd_selector s, int fd, unsigned ms) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item *item = s->fds + fd;
+    if(!ITEM_USED(item)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    timer_cancel(s, item);
+    // la rueda puede estar atrasada respecto del reloj (se avanza al final
+    // de cada iteración), así que el vencimiento se calcula con el reloj.
+    // Como mínimo vence en el próximo milisegundo: el actual ya se procesó.
+    item->timer_expires = clock_ms() + (ms == 0 ? 1 : ms);
+    item->timer_armed   = true;
+    s->timers.armed++;
+    timer_link(s, item);
+finally:
+    return ret;
+}
+
+selector_status
+selector_set_timeout_key(struct selector_key *key, unsigned ms) {
+    selector_status ret;
+
+    if(NULL == key || NULL == key->s || INVALID_FD(key->s, key->fd)) {
+        ret = SELECTOR_IARGS;
+    } else {
+        ret = selector_set_timeout(key->s, key->fd, ms);
+    }
+
+    return ret;
+}
+
+selector_status
+selector_cancel_timeout(fd_selector s, int fd) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item *item = s->fds + fd;
+    if(!ITEM_USED(item)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    timer_cancel(s, item);
+finally:
+    return ret;
+}
+
+selector_status
+selector_cancel_timeout_key(struct selector_key *key) {
+    selector_status ret;
+
+    if(NULL == key || NULL == key->s || INVALID_FD(key->s, key->fd)) {
+        ret = SELECTOR_IARGS;
+    } else {
+        ret = selector_cancel_timeout(key->s, key->fd);
+    }
+
+    return ret;
+}
+
 /**
- * se encarga de manejar los resultados del select.
+ * despacha los eventos listos de un item: primero errores, luego lectura y
+ * por último escritura. Cada handler puede desregistrar el fd, por eso el
+ * interés se vuelve a consultar antes de despachar el siguiente.
  */
 static void
-handle_iteration(fd_selector s) {
-    int n = s->max_fd;
+handle_item(fd_selector s, struct item *item, const fd_interest ready) {
     struct selector_key key = {
-        .s = s,
+        .s    = s,
+        .fd   = item->fd,
+        .data = item->data,
     };
+    if(ready & OP_ERROR) {
+        if(OP_ERROR & item->interest) {
+            if(0 == item->handler->handle_error) {
+                assert(("OP_ERROR arrived but no handler. bug!" == 0));
+            } else {
+                item->handler->handle_error(&key);
+            }
+        }
+    }
+    if(ready & OP_READ) {
+        if(OP_READ & item->interest) {
+            if(0 == item->handler->handle_read) {
+                assert(("OP_READ arrived but no handler. bug!" == 0));
+            } else {
+                item->handler->handle_read(&key);
+            }
+        }
+    }
+    if(ready & OP_WRITE) {
+        if(OP_WRITE & item->interest) {
+            if(0 == item->handler->handle_write) {
+                assert(("OP_WRITE arrived but no handler. bug!" == 0));
+            } else {
+                item->handler->handle_write(&key);
+            }
+        }
+    }
+}
+
+/**
+ * se encarga de manejar los resultados del select. select() no dice qué
+ * descriptores están listos, así que hay que recorrerlos todos.
+ */
+static void
+handle_iteration(fd_selector s) {
+    int n = s->max_fd;
 
     for (int i = 0; i <= n; i++) {
         struct item *item = s->fds + i;
         if(ITEM_USED(item)) {
-            key.fd   = item->fd;
-            key.data = item->data;
+            fd_interest ready = OP_NOOP;
             if(FD_ISSET(item->fd, &s->slave_r)) {
-                if(OP_READ & item->interest) {
-                    if(0 == item->handler->handle_read) {
-                        assert(("OP_READ arrived but no handler. bug!" == 0));
-                    } else {
-                        item->handler->handle_read(&key);
-                    }
-                }
+                ready |= OP_READ | OP_ERROR;
             }
-            if(FD_ISSET(i, &s->slave_w)) {
-                if(OP_WRITE & item->interest) {
-                    if(0 == item->handler->handle_write) {
-                        assert(("OP_WRITE arrived but no handler. bug!" == 0));
-                    } else {
-                        item->handler->handle_write(&key);
-                    }
-                }
+            if(FD_ISSET(item->fd, &s->slave_w)) {
+                ready |= OP_WRITE;
+            }
+            handle_item(s, item, ready);
+        }
+    }
+}
+
+/**
+ * se encarga de manejar los resultados de epoll: solo se visitan los `n'
+ * descriptores listos. Como en select(), un error o un hangup se reportan
+ * como listo para leer y para escribir; así los handlers se enteran vía
+ * recv()/send().
+ */
+static void
+handle_iteration_epoll(fd_selector s, const int n) {
+    for(int i = 0; i < n; i++) {
+        const struct epoll_event *ev = s->events + i;
+        const int      fd  = (int)(uint32_t)ev->data.u64;
+        const uint32_t gen = (uint32_t)(ev->data.u64 >> 32);
+        if((size_t)fd >= s->fd_size) {
+            continue;
+        }
+        struct item *item = s->fds + fd;
+        if(!ITEM_USED(item) || item->gen != gen) {
+            continue;
+        }
+        fd_interest ready = OP_NOOP;
+        if(ev->events & (EPOLLERR | EPOLLHUP)) {
+            ready |= OP_ERROR;
+        }
+        if(ev->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            ready |= OP_READ;
+        }
+        if(ev->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            ready |= OP_WRITE;
+        }
+        handle_item(s, item, ready);
+    }
+}
+
+#ifdef SELECTOR_HAVE_URING
+/**
+ * se encarga de manejar los completados de io_uring. Se copian antes de
+ * despachar para liberar el anillo: los handlers pueden encolar (y si se
+ * llena, enviar) nuevos pedidos. Cada poll disparado se vuelve a armar con
+ * los intereses que tenga el item después del handler.
+ */
+static void
+handle_iteration_uring(fd_selector s) {
+    struct uring *u = s->uring;
+    unsigned head = *u->cq_head;
+    const unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+
+    for(; head != tail && n < u->ready_size; head++, n++) {
+        u->ready[n] = u->cqes[head & *u->cq_mask];
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    for(unsigned i = 0; i < n; i++) {
+        const struct io_uring_cqe *cqe = u->ready + i;
+        if(cqe->user_data == URING_IGNORE) {
+            continue;
+        }
+        const int      fd  = (int)(uint32_t)cqe->user_data;
+        const uint32_t gen = (uint32_t)(cqe->user_data >> 32);
+        if((size_t)fd >= s->fd_size) {
+            continue;
+        }
+        struct item *item = s->fds + fd;
+        if(!ITEM_USED(item) || !item->in_kernel || item->gen != gen) {
+            continue;  // poll cancelado o de una registración anterior
+        }
+        item->in_kernel = false;
+
+        fd_interest ready = OP_NOOP;
+        if(cqe->res < 0) {
+            // el poll falló: los handlers se enteran vía recv()/send()
+            ready = OP_READ | OP_WRITE | OP_ERROR;
+        } else {
+            if(cqe->res & (POLLERR | POLLHUP)) {
+                ready |= OP_ERROR;
+            }
+            if(cqe->res & (POLLIN | POLLERR | POLLHUP)) {
+                ready |= OP_READ;
             }
+            if(cqe->res & (POLLOUT | POLLERR | POLLHUP)) {
+                ready |= OP_WRITE;
+            }
+        }
+        handle_item(s, item, ready);
+
+        // los handlers pueden haber realocado la tabla
+        item = s->fds + fd;
+        if(ITEM_USED(item)) {
+            items_update_uring_for_fd(s, item);
         }
     }
 }
+#endif
 
+/**
+ * despacha los trabajos bloqueantes finalizados, en orden de llegada. Los
+ * handlers corren sin ningún lock tomado, así que los productores nunca
+ * esperan al selector.
+ */
 static void
 handle_block_notifications(fd_selector s) {
     struct selector_key key = {
         .s = s,
     };
-    pthread_mutex_lock(&s->resolution_mutex);
-    struct blocking_job* j = s->resolution_jobs;
-    while (j != NULL) {
-
-        struct item* item = s->fds + j->fd;
-        if (ITEM_USED(item)) {
-            key.fd = item->fd;
-            key.data = item->data;
-            item->handler->handle_block(&key);
+    // a lo sumo una vuelta de la cola, para no quedar atrapados si los
+    // productores encolan más rápido de lo que despachamos.
+    for(size_t n = 0; n < BLOCKING_QUEUE_SIZE; n++) {
+        struct blocking_job *j = s->jobs + (s->jobs_head & (BLOCKING_QUEUE_SIZE - 1));
+        if(__atomic_load_n(&j->seq, __ATOMIC_ACQUIRE) != s->jobs_head + 1) {
+            break;  // vacía, o el productor aún no terminó de escribir
+        }
+        const int fd = j->fd;
+        // liberamos el slot antes de ejecutar el handler
+        __atomic_store_n(&j->seq, s->jobs_head + BLOCKING_QUEUE_SIZE, __ATOMIC_RELEASE);
+        s->jobs_head++;
+
+        if(fd >= 0 && (size_t)fd < s->fd_size) {
+            struct item *item = s->fds + fd;
+            if(ITEM_USED(item) && item->handler->handle_block != NULL) {
+                key.fd   = item->fd;
+                key.data = item->data;
+                item->handler->handle_block(&key);
+            }
         }
-
-        struct blocking_job* aux = j;
-        j = j->next;
-        free(aux);
     }
-    s->resolution_jobs = 0;
-    pthread_mutex_unlock(&s->resolution_mutex);
 }
 
+/**
+ * reserva una posición en la cola. Retorna false si está llena.
+ * (cola acotada de Dmitry Vyukov, restringida a un consumidor)
+ */
+static bool
+jobs_push(fd_selector s, const int fd) {
+    size_t pos = __atomic_load_n(&s->jobs_tail, __ATOMIC_RELAXED);
+    for(;;) {
+        struct blocking_job *j = s->jobs + (pos & (BLOCKING_QUEUE_SIZE - 1));
+        const size_t seq = __atomic_load_n(&j->seq, __ATOMIC_ACQUIRE);
+        if(seq == pos) {
+            if(__atomic_compare_exchange_n(&s->jobs_tail, &pos, pos + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                j->fd = fd;
+                __atomic_store_n(&j->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            // otro productor ganó la posición; pos quedó actualizado
+        } else if(seq < pos) {
+            return false;  // el slot todavía no fue consumido: llena
+        } else {
+            pos = __atomic_load_n(&s->jobs_tail, __ATOMIC_RELAXED);
+        }
+    }
+}
 
 selector_status
 selector_notify_block(fd_selector  s,
                  const int    fd) {
-    selector_status ret = SELECTOR_SUCCESS;
+    // la cola solo se llena si el selector tiene BLOCKING_QUEUE_SIZE
+    // trabajos sin despachar. No se espera a que libere lugar: quien avisa
+    // puede ser el hilo del propio selector, o un hilo con más trabajo.
+    // Igual se lo despierta para que vacíe la cola.
+    const bool pushed = jobs_push(s, fd);
 
-    struct blocking_job *job = malloc(sizeof(*job));
-    if(job == NULL) {
-        ret = SELECTOR_ENOMEM;
-        goto finally;
-    }
-    job->s  = s;
-    job->fd = fd;
+    // notificamos al hilo del selector
+    selector_wakeup(s);
 
-    // encolamos en el selector los resultados
-    pthread_mutex_lock(&s->resolution_mutex);
-    job->next = s->resolution_jobs;
-    s->resolution_jobs = job;
-    pthread_mutex_unlock(&s->resolution_mutex);
-
-    // notificamos al hilo principal
-    pthread_kill(s->selector_thread, conf.signal);
+    return pushed ? SELECTOR_SUCCESS : SELECTOR_ENOMEM;
+}
 
-finally:
-    return ret;
+void
+selector_wakeup(fd_selector s) {
+    // solo el primero que encuentra el flag apagado escribe: el resto de
+    // las notificaciones viajan en el mismo despertar.
+    if(!__atomic_exchange_n(&s->wakeup_pending, true, __ATOMIC_ACQ_REL)) {
+        const uint64_t one = 1;
+        ssize_t n;
+        do {
+            n = write(s->wakeup_fd, &one, sizeof(one));
+        } while(n == -1 && errno == EINTR);
+    }
 }
 
 selector_status
 selector_select(fd_selector s) {
     selector_status ret = SELECTOR_SUCCESS;
 
-    memcpy(&s->slave_r, &s->master_r, sizeof(s->slave_r));
-    memcpy(&s->slave_w, &s->master_w, sizeof(s->slave_w));
-    memcpy(&s->slave_t, &s->master_t, sizeof(s->slave_t));
+    // el próximo timer puede acortar el tiempo de bloqueo
+    uint64_t timeout = s->master_t.tv_sec * 1000
+                     + (s->master_t.tv_nsec + 999999) / 1000000;
+    const uint64_t next = timers_next_timeout(s);
+    if(next < timeout) {
+        timeout = next;
+    }
 
-    s->selector_thread = pthread_self();
+    int fds;
+    if(SELECTOR_BACKEND_EPOLL == s->backend) {
+        fds = epoll_wait(s->epfd, s->events, EPOLL_MAX_EVENTS, (int)timeout);
+#ifdef SELECTOR_HAVE_URING
+    } else if(SELECTOR_BACKEND_URING == s->backend) {
+        fds = uring_wait(s, timeout);
+#endif
+    } else {
+        memcpy(&s->slave_r, &s->master_r, sizeof(s->slave_r));
+        memcpy(&s->slave_w, &s->master_w, sizeof(s->slave_w));
+        s->slave_t.tv_sec  = timeout / 1000;
+        s->slave_t.tv_nsec = (timeout % 1000) * 1000000;
 
-    int fds = pselect(s->max_fd + 1, &s->slave_r, &s->slave_w, 0, &s->slave_t,
-                      &emptyset);
+        fds = pselect(s->max_fd + 1, &s->slave_r, &s->slave_w, 0, &s->slave_t,
+                      NULL);
+    }
     if(-1 == fds) {
         switch(errno) {
             case EAGAIN:
@@ -539,11 +1511,18 @@ selector_select(fd_selector s) {
                 goto finally;
 
         }
+    } else if(SELECTOR_BACKEND_EPOLL == s->backend) {
+        handle_iteration_epoll(s, fds);
+#ifdef SELECTOR_HAVE_URING
+    } else if(SELECTOR_BACKEND_URING == s->backend) {
+        handle_iteration_uring(s);
+#endif
     } else {
         handle_iteration(s);
     }
     if(ret == SELECTOR_SUCCESS) {
         handle_block_notifications(s);
+        timers_run(s);
     }
 finally:
     return ret;
@@ -13,8 +13,13 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <netdb.h>
+#include <linux/errqueue.h>
 
 #include "hello.h"
 #include "auth.h"
@@ -26,11 +31,42 @@
 #include "args.h"
 #include "metrics.h"
 #include "logger.h"
+#include "intern.h"
+#include "resolver.h"
+#include "dns.h"
+#include "dnscache.h"
 
 #define N(x) (sizeof(x)/sizeof((x)[0]))
 
-/** Tamaño de los buffers de I/O */
-#define BUFFER_SIZE 4096
+/**
+ * Tamaño de los buffers de la sesión. Alcanzan para la negociación; en el
+ * túnel se reemplazan por otros más grandes si el tráfico los llena.
+ */
+#define BUFFER_SIZE 1024
+
+/**
+ * Clases de tamaño de los buffers del túnel: se pasa de BUFFER_SIZE a
+ * RELAY_BUFFER_MIN y luego se multiplica por RELAY_BUFFER_GROWTH cada vez
+ * que una lectura llena el buffer, hasta `-B'.
+ */
+#define RELAY_BUFFER_MIN    4096
+#define RELAY_BUFFER_GROWTH 4
+
+/**
+ * Presupuesto de cada notificación de lectura en COPY: se lee hasta vaciar
+ * el socket, pero no más de estas lecturas ni de estos bytes.
+ */
+#define COPY_READ_ITERATIONS 16
+#define COPY_READ_BUDGET     (256 * 1024)
+
+/** segundos sin tráfico tras los que un túnel devuelve los buffers que creció */
+#define RELAY_QUIET 2
+
+/**
+ * Conexiones aceptadas como máximo por cada notificación del socket pasivo,
+ * para que una avalancha de conexiones no posterge a las sesiones en curso.
+ */
+#define ACCEPT_BATCH 64
 
 /** Versión de SOCKS */
 #define SOCKS_VERSION 0x05
@@ -162,25 +198,81 @@ struct request_st {
     struct request_parser  parser;
     struct request         request;
     
-    /** resolución DNS */
-    struct addrinfo       *origin_resolution;
-    struct addrinfo       *current_origin;
-    
     /** estado de la conexión */
     enum socks_reply_status status;
 };
 
-/** Usado por REQUEST_CONNECTING */
+/** intentos de conexión al origen en curso a la vez, como máximo */
+#define CONNECT_ATTEMPTS_MAX     8
+/** espera antes de sumar el siguiente intento (Connection Attempt Delay) */
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
+/**
+ * Usado por REQUEST_CONNECTING: los intentos en carrera (Happy Eyeballs,
+ * RFC 8305). Las direcciones se prueban alternando familias, empezando por
+ * IPv6 como pide la sección 4, y dentro de cada familia en el orden del
+ * resolver; si un intento no conectó a los CONNECT_ATTEMPT_DELAY_MS (o apenas
+ * falla) se suma el siguiente, y el primero que conecta gana.
+ */
 struct connecting {
-    buffer   *wb;
-    int       fd;
-    enum socks_reply_status status;
+    /** próxima dirección de cada familia: [0] IPv6, [1] IPv4 */
+    struct addrinfo *next[2];
+    /** índice en `next' del próximo intento */
+    unsigned         turn;
+    /** intentos en curso, registrados en el selector */
+    int              fds[CONNECT_ATTEMPTS_MAX];
+    unsigned         count;
+    /** error del último intento que falló */
+    int              error;
+};
+
+/**
+ * Tubería que reemplaza a un buffer en el relay con splice(2): los bytes van
+ * del socket a la tubería y de ahí al otro socket sin pasar por el proceso.
+ */
+struct relay_pipe {
+    int    fds[2];
+    /** bytes dentro de la tubería, y su capacidad */
+    size_t len, size;
+    /**
+     * la tubería rechazó más datos antes de llegar a `size' (tiene una
+     * cantidad fija de páginas y los segmentos TCP pueden no llenarlas).
+     * Se vuelve a intentar cuando se vacía algo.
+     */
+    bool   full;
+};
+
+/** envíos con MSG_ZEROCOPY sin confirmar, como máximo, por dirección */
+#define ZEROCOPY_PENDING 16
+
+/**
+ * Envíos con MSG_ZEROCOPY desde un anillo. El kernel transmite desde la
+ * memoria del anillo hasta que avisa por la cola de errores del socket, así
+ * que esos bytes siguen ocupando el principio del anillo hasta el aviso.
+ */
+struct zerocopy {
+    /** bytes enviados y todavía fijados: los primeros `inflight' del anillo */
+    size_t   inflight;
+    /** cada envío sin confirmar, en orden: sus bytes y si ya llegó el aviso */
+    uint32_t sizes[ZEROCOPY_PENDING];
+    bool     done[ZEROCOPY_PENDING];
+    unsigned head, count;
+    /** número de envío que le asignó el kernel al de `head' */
+    uint32_t head_id;
+    /** el socket rechazó el envío (ENOBUFS): se espera algún aviso */
+    bool     blocked;
+    /** el kernel avisó que copió los datos igual: no vale la pena seguir */
+    bool     disabled;
 };
 
 /** Usado por COPY */
 struct copy {
     int       *fd;
-    buffer    *rb, *wb;
+    ring_buffer *rb, *wb;
+    /** con splice las tuberías hacen las veces de rb y wb; si no, NULL */
+    struct relay_pipe *rp, *wp;
+    /** envíos con MSG_ZEROCOPY desde wb (ver -Z); NULL si no se usan */
+    struct zerocopy *zc;
     fd_interest duplex;
     struct copy *other;
 };
@@ -189,52 +281,99 @@ struct copy {
 // ESTRUCTURA PRINCIPAL DE CONEXIÓN
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * Estado de la negociación. Solo hace falta hasta llegar a COPY: entonces
+ * vuelve al pool de bloques del worker y la sesión queda con lo que usa el
+ * túnel (ver handshake_release).
+ */
+struct handshake {
+    /** estados para el client_fd */
+    union {
+        struct hello_st      hello;
+        struct auth_st       auth;
+        struct request_st    request;
+    } client;
+
+    /** estado para el origin_fd */
+    struct connecting        conn;
+
+    /** buffers para I/O de la negociación, tomados del pool de buffers */
+    buffer  read_buffer, write_buffer;
+
+    /** dirección del origen: la que se conecta y luego la local, para la respuesta */
+    struct sockaddr_storage  origin_addr;
+    socklen_t                origin_addr_len;
+
+    /** siguiente en el pool */
+    struct handshake *next;
+};
+
+/** envíos con MSG_ZEROCOPY pendientes desde cada anillo de la sesión */
+struct zerocopy_pair {
+    struct zerocopy read, write;
+};
+
+/**
+ * Sesión: lo que vive mientras dure el túnel. Lo que solo usa la negociación
+ * está en `hs'.
+ */
 struct socks5 {
-    /** información del cliente */
-    struct sockaddr_storage  client_addr;
+    /** información del cliente (TCP sobre IPv4 o IPv6) */
+    union {
+        struct sockaddr_in   in;
+        struct sockaddr_in6  in6;
+    }                        client_addr;
     socklen_t                client_addr_len;
     int                      client_fd;
 
     /** información del servidor origen */
-    struct sockaddr_storage  origin_addr;
-    socklen_t                origin_addr_len;
     int                      origin_fd;
     struct addrinfo         *origin_resolution;
-    struct addrinfo         *origin_resolution_current;
 
     /** máquinas de estados */
     struct state_machine     stm;
 
-    /** estados para el client_fd */
-    union {
-        struct hello_st      hello;
-        struct auth_st       auth;
-        struct request_st    request;
-        struct copy          copy;
-    } client;
+    /** estado de la negociación; NULL desde COPY */
+    struct handshake        *hs;
 
-    /** estados para el origin_fd */
-    union {
-        struct connecting    conn;
-        struct copy          copy;
-    } orig;
+    /** estados de COPY para el client_fd y el origin_fd */
+    struct copy              client_copy, origin_copy;
 
-    /** buffers para I/O */
-    uint8_t raw_buff_a[BUFFER_SIZE], raw_buff_b[BUFFER_SIZE];
-    buffer  read_buffer, write_buffer;
+    /**
+     * buffers de COPY, como anillos: el espacio que libera un envío parcial
+     * se puede volver a llenar sin compactar. Sin datos en tránsito su
+     * memoria vuelve al pool (data == NULL).
+     */
+    ring_buffer read_ring, write_ring;
+
+    /** envíos con MSG_ZEROCOPY (solo si se usan, ver -Z) */
+    struct zerocopy_pair *zc;
+
+    /** tuberías del relay con splice (cliente->origen y origen->cliente) */
+    struct relay_pipe pipes[2];
+    bool              spliced;
+
+    /** el túnel ya volvió a los buffers chicos por inactividad (ver copy_timeout) */
+    bool quiet;
 
     /** contador de referencias */
     unsigned references;
 
-    /** siguiente en el pool */
+    /**
+     * hay un hilo resolviendo el nombre del origen. Mientras tanto el
+     * client_fd no se puede liberar: la notificación llega a ese fd.
+     */
+    bool resolving;
+
+    /** siguiente sesión libre de su slab */
     struct socks5 *next;
 
-    /** username autenticado (para logging) */
-    char username[257];
+    /** username autenticado (para logging), compartido (ver intern.h) */
+    const char *username;
     
-    /** Para logging de acceso */
+    /** Para logging de acceso. El destino también es compartido */
     time_t      connection_start;
-    char        dest_addr_str[256];
+    const char *dest;
     uint16_t    dest_port;
     uint8_t     last_status;
     uint64_t    bytes_to_origin;
@@ -245,47 +384,548 @@ struct socks5 {
 // POOL DE CONEXIONES
 ////////////////////////////////////////////////////////////////////////////////
 
-/** Pool máximo de conexiones reutilizables - aumentado para soportar 500+ conexiones */
-static const unsigned max_pool = 500;
-static unsigned pool_size = 0;
-static struct socks5 *pool = NULL;
+/**
+ * Las sesiones viven en slabs: bloques contiguos de SESSION_SLAB_BYTES (o de
+ * una hugepage con -H) alineados a su tamaño, así el slab de una sesión sale
+ * de su dirección. Cada worker tiene su propio arena de slabs: las sesiones
+ * nacen y mueren en el hilo de su selector.
+ */
+#define SESSION_SLAB_BYTES (64 * 1024)
+#define SESSION_HUGE_BYTES (2 * 1024 * 1024)
 
-/** Forward declaration de la tabla de estados (ERROR + 1 = 11 estados) */
-static const struct state_definition socks5_state_handlers[ERROR + 1];
+/**
+ * Marcas de agua del arena, en sesiones libres: la baja es SESSION_POOL_LOW
+ * (o -A si es mayor) y la alta, el doble. Un slab que queda vacío vuelve al
+ * sistema si las libres superan la marca alta y sin él no bajan de la baja.
+ */
+#define SESSION_POOL_LOW  256
+
+/** las sesiones de un slab arrancan alineadas a una línea de caché */
+#define SESSION_ALIGN  64
+#define SESSION_STRIDE ((sizeof(struct socks5) + SESSION_ALIGN - 1) & ~(size_t)(SESSION_ALIGN - 1))
+
+/** cabecera de un slab, al principio de su memoria */
+struct session_slab {
+    /** slabs del worker con sesiones disponibles; los vacíos al final */
+    struct session_slab *prev, *next;
+    /** sesiones liberadas del slab */
+    struct socks5 *free;
+    /**
+     * sesiones en uso, y cuántas se entregaron alguna vez: las siguientes
+     * nunca se tocaron y no ocupan memoria hasta que hagan falta
+     */
+    unsigned used, carved;
+    /** arena del worker dueño */
+    const struct session_arena *arena;
+};
+
+static _Thread_local struct session_arena {
+    struct session_slab *head, *tail;
+    /** sesiones libres entre todos los slabs (incluidas las sin tocar) */
+    unsigned free;
+    /**
+     * el worker terminó: las sesiones que se liberen después (al destruir
+     * el selector) no vuelven al arena
+     */
+    bool closed;
+} arena;
+
+static size_t
+session_slab_bytes(void) {
+    return socks5_args.session_hugepages ? SESSION_HUGE_BYTES : SESSION_SLAB_BYTES;
+}
+
+static unsigned
+session_slab_capacity(void) {
+    const size_t header = (sizeof(struct session_slab) + SESSION_ALIGN - 1)
+                        & ~(size_t)(SESSION_ALIGN - 1);
+    return (session_slab_bytes() - header) / SESSION_STRIDE;
+}
 
 static struct socks5 *
-socks5_new(int client_fd) {
+session_slab_at(struct session_slab *slab, const unsigned i) {
+    const size_t header = (sizeof(struct session_slab) + SESSION_ALIGN - 1)
+                        & ~(size_t)(SESSION_ALIGN - 1);
+    return (struct socks5 *)((uint8_t *)slab + header + i * SESSION_STRIDE);
+}
+
+static unsigned
+session_pool_low(void) {
+    return socks5_args.session_prealloc > SESSION_POOL_LOW
+         ? socks5_args.session_prealloc : SESSION_POOL_LOW;
+}
+
+static void
+session_slab_unlink(struct session_slab *slab) {
+    if(slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        arena.head = slab->next;
+    }
+    if(slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    } else {
+        arena.tail = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+}
+
+static void
+session_slab_push_head(struct session_slab *slab) {
+    slab->prev = NULL;
+    slab->next = arena.head;
+    if(arena.head != NULL) {
+        arena.head->prev = slab;
+    } else {
+        arena.tail = slab;
+    }
+    arena.head = slab;
+}
+
+static void
+session_slab_push_tail(struct session_slab *slab) {
+    slab->next = NULL;
+    slab->prev = arena.tail;
+    if(arena.tail != NULL) {
+        arena.tail->next = slab;
+    } else {
+        arena.head = slab;
+    }
+    arena.tail = slab;
+}
+
+/**
+ * reserva un slab alineado a su tamaño. Con -H lo intenta con hugepages
+ * reservadas (MAP_HUGETLB) y si no hay, con transparent hugepages. Con
+ * `touch' escribe cada página para que ya esté en memoria al usarla.
+ */
+static struct session_slab *
+session_slab_new(const bool touch) {
+    const size_t bytes = session_slab_bytes();
+    uint8_t *p = MAP_FAILED;
+
+    if(socks5_args.session_hugepages) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if(p == MAP_FAILED) {
+        // se pide el doble y se recorta lo que sobra para alinearlo
+        uint8_t *raw = mmap(NULL, 2 * bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(raw == MAP_FAILED) {
+            return NULL;
+        }
+        p = (uint8_t *)(((uintptr_t) raw + bytes - 1) & ~(uintptr_t)(bytes - 1));
+        if(p > raw) {
+            munmap(raw, p - raw);
+        }
+        if(p + bytes < raw + 2 * bytes) {
+            munmap(p + bytes, raw + 2 * bytes - (p + bytes));
+        }
+        if(socks5_args.session_hugepages) {
+            madvise(p, bytes, MADV_HUGEPAGE);
+        }
+    }
+    if(touch) {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        for(size_t off = 0; off < bytes; off += page) {
+            ((volatile uint8_t *) p)[off] = 0;
+        }
+    }
+
+    struct session_slab *slab = (struct session_slab *) p;
+    slab->free   = NULL;
+    slab->used   = 0;
+    slab->carved = 0;
+    slab->arena  = &arena;
+    session_slab_push_tail(slab);
+    arena.free  += session_slab_capacity();
+    return slab;
+}
+
+/** toma una sesión del arena: primero de los slabs con sesiones en uso */
+static struct socks5 *
+session_alloc(void) {
+    struct session_slab *slab = arena.head;
+    if(slab == NULL && (slab = session_slab_new(false)) == NULL) {
+        return NULL;
+    }
+
     struct socks5 *ret;
+    if(slab->free != NULL) {
+        ret        = slab->free;
+        slab->free = ret->next;
+    } else {
+        ret = session_slab_at(slab, slab->carved++);
+    }
+    slab->used++;
+    arena.free--;
+
+    if(slab->free == NULL && slab->carved == session_slab_capacity()) {
+        // lleno: sale de la lista hasta que se libere alguna sesión
+        session_slab_unlink(slab);
+    }
+    return ret;
+}
+
+/**
+ * devuelve la sesión a su slab. Un slab vacío pasa al final de la lista, o
+ * vuelve al sistema si sobran sesiones libres (ver SESSION_POOL_LOW).
+ */
+static void
+session_free(struct socks5 *s) {
+    struct session_slab *slab = (struct session_slab *)
+        ((uintptr_t) s & ~(uintptr_t)(session_slab_bytes() - 1));
+    const unsigned capacity = session_slab_capacity();
+
+    if(slab->arena != &arena || arena.closed) {
+        // al terminar, el selector de otro worker se destruye en el hilo
+        // principal: esa memoria se libera con el proceso
+        return;
+    }
+
+    const bool full = slab->free == NULL && slab->carved == capacity;
+    s->next    = slab->free;
+    slab->free = s;
+    slab->used--;
+    arena.free++;
 
-    if(pool == NULL) {
-        ret = malloc(sizeof(*ret));
+    if(full) {
+        session_slab_push_head(slab);
+    }
+    if(slab->used == 0) {
+        const unsigned low = session_pool_low();
+        if(arena.free > 2 * low && arena.free - capacity >= low) {
+            session_slab_unlink(slab);
+            arena.free -= capacity;
+            munmap(slab, session_slab_bytes());
+        } else if(slab != arena.tail) {
+            session_slab_unlink(slab);
+            session_slab_push_tail(slab);
+        }
+    }
+}
+
+bool
+socksv5_pool_init(void) {
+    while(arena.free < socks5_args.session_prealloc) {
+        if(session_slab_new(true) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Tuberías libres para el relay con splice. Crear una cuesta un pipe2 y un
+ * fcntl, así que se reutilizan las de las sesiones que terminaron vacías.
+ */
+#define PIPE_POOL_SIZE 64
+static _Thread_local struct relay_pipe pipe_pool[PIPE_POOL_SIZE];
+static _Thread_local unsigned pipe_pool_size = 0;
+
+static bool
+relay_pipe_get(struct relay_pipe *p) {
+    if(pipe_pool_size > 0) {
+        *p = pipe_pool[--pipe_pool_size];
+        return true;
+    }
+    if(pipe2(p->fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        return false;
+    }
+    const int size = fcntl(p->fds[0], F_GETPIPE_SZ);
+    if(size <= 0) {
+        close(p->fds[0]);
+        close(p->fds[1]);
+        return false;
+    }
+    p->size = size;
+    p->len  = 0;
+    p->full = false;
+    return true;
+}
+
+static void
+relay_pipe_put(struct relay_pipe *p) {
+    if(p->len == 0 && pipe_pool_size < PIPE_POOL_SIZE) {
+        pipe_pool[pipe_pool_size++] = *p;
+    } else {
+        close(p->fds[0]);
+        close(p->fds[1]);
+    }
+}
+
+/**
+ * Bytes reservados para buffers entre todas las sesiones de todos los
+ * workers, para respetar `-M'.
+ */
+static size_t relay_buffer_bytes = 0;
+
+/**
+ * Buffers libres de cada tamaño, compartidos por las sesiones del worker.
+ * Una sesión solo retiene buffers mientras tiene datos en tránsito: en COPY
+ * los que se vacían vuelven acá, así un túnel ocioso no ocupa memoria de I/O.
+ * Se guardan hasta CHUNK_POOL_BYTES por tamaño; el resto se libera.
+ */
+#define CHUNK_CLASSES    8
+#define CHUNK_POOL_BYTES (1024 * 1024)
+
+struct chunk {
+    struct chunk *next;
+};
+
+struct chunk_list {
+    size_t        size;
+    struct chunk *head;
+    size_t        bytes;
+};
+
+static _Thread_local struct chunk_list chunk_pool[CHUNK_CLASSES];
+
+/** la lista de los buffers de `size' bytes. NULL si no hay más clases */
+static struct chunk_list *
+chunk_list_for(const size_t size) {
+    for(unsigned i = 0; i < CHUNK_CLASSES; i++) {
+        if(chunk_pool[i].size == size || chunk_pool[i].size == 0) {
+            chunk_pool[i].size = size;
+            return chunk_pool + i;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * obtiene un buffer de `size' bytes. Los más grandes que BUFFER_SIZE solo
+ * se reservan si no superan el total permitido. NULL si no hay memoria.
+ */
+static uint8_t *
+chunk_get(const size_t size) {
+    struct chunk_list *l = chunk_list_for(size);
+    if(l != NULL && l->head != NULL) {
+        struct chunk *c = l->head;
+        l->head   = c->next;
+        l->bytes -= size;
+        return (uint8_t *) c;
+    }
+
+    const size_t total = __atomic_add_fetch(&relay_buffer_bytes, size,
+                                            __ATOMIC_RELAXED);
+    uint8_t *ret = NULL;
+    if(size <= BUFFER_SIZE || socks5_args.relay_buffer_total == 0
+       || total <= socks5_args.relay_buffer_total) {
+        ret = malloc(size);
+    }
+    if(ret == NULL) {
+        __atomic_sub_fetch(&relay_buffer_bytes, size, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+static void
+chunk_put(uint8_t *data, const size_t size) {
+    if(data == NULL) {
+        return;
+    }
+    struct chunk_list *l = chunk_list_for(size);
+    if(l != NULL && l->bytes + size <= CHUNK_POOL_BYTES) {
+        struct chunk *c = (struct chunk *) data;
+        c->next   = l->head;
+        l->head   = c;
+        l->bytes += size;
+    } else {
+        free(data);
+        __atomic_sub_fetch(&relay_buffer_bytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+chunk_pool_destroy(void) {
+    for(unsigned i = 0; i < CHUNK_CLASSES; i++) {
+        struct chunk_list *l = chunk_pool + i;
+        struct chunk *next;
+        for(struct chunk *c = l->head; c != NULL; c = next) {
+            next = c->next;
+            free(c);
+            __atomic_sub_fetch(&relay_buffer_bytes, l->size, __ATOMIC_RELAXED);
+        }
+        l->head  = NULL;
+        l->bytes = 0;
+    }
+}
+
+/**
+ * le da memoria al anillo si la había devuelto al pool. Si no hay de su
+ * tamaño se conforma con BUFFER_SIZE.
+ */
+static bool
+relay_ring_attach(ring_buffer *r) {
+    if(r->data == NULL) {
+        r->data = chunk_get(r->size);
+        if(r->data == NULL && r->size != BUFFER_SIZE) {
+            r->size = BUFFER_SIZE;
+            r->data = chunk_get(r->size);
+        }
+        r->read = 0;
+    }
+    return r->data != NULL;
+}
+
+/**
+ * devuelve al pool la memoria del anillo si está vacío. Conserva el tamaño,
+ * que es el que vuelve a pedir relay_ring_attach.
+ */
+static void
+relay_ring_detach(ring_buffer *r) {
+    if(r->data != NULL && r->len == 0) {
+        chunk_put(r->data, r->size);
+        r->data = NULL;
+    }
+}
+
+/**
+ * lleva el anillo a `size' bytes. Si no tiene memoria solo cambia el tamaño
+ * que pedirá al volver a tenerla. false si no hay memoria o se supera el
+ * total permitido.
+ */
+static bool
+relay_ring_resize(ring_buffer *r, const size_t size) {
+    if(r->data == NULL) {
+        r->size = size;
+        return true;
+    }
+    uint8_t *data = chunk_get(size);
+    if(data == NULL) {
+        return false;
+    }
+    uint8_t *const old      = r->data;
+    const size_t   old_size = r->size;
+    ring_move(r, data, size);
+    chunk_put(old, old_size);
+    return true;
+}
+
+/**
+ * devuelve al pool los buffers de la sesión. Un anillo con envíos de
+ * MSG_ZEROCOPY sin confirmar no se devuelve: el kernel puede seguir
+ * transmitiendo desde esa memoria después del close(2) y no queda socket por
+ * el que enterarse de cuándo termina. Se pierde (y sigue contando para -M),
+ * lo que solo pasa si la sesión se cierra con envíos sin confirmar.
+ */
+static void
+session_buffers_release(struct socks5 *s) {
+    if(s->zc == NULL || s->zc->read.count == 0) {
+        chunk_put(s->read_ring.data,  s->read_ring.size);
+    }
+    if(s->zc == NULL || s->zc->write.count == 0) {
+        chunk_put(s->write_ring.data, s->write_ring.size);
+    }
+    s->read_ring.data  = NULL;
+    s->write_ring.data = NULL;
+    free(s->zc);
+    s->zc = NULL;
+}
+
+/**
+ * Bloques de negociación libres, por worker. Solo los usan las sesiones que
+ * todavía no llegaron a COPY, así que alcanzan unos pocos aunque haya miles
+ * de túneles abiertos.
+ */
+#define HANDSHAKE_POOL_SIZE 256
+static _Thread_local struct handshake *handshake_pool = NULL;
+static _Thread_local unsigned handshake_pool_size = 0;
+
+/** un bloque de negociación con sus dos buffers. NULL si no hay memoria */
+static struct handshake *
+handshake_new(void) {
+    struct handshake *ret = handshake_pool;
+    if(ret != NULL) {
+        handshake_pool = ret->next;
+        handshake_pool_size--;
+    } else if((ret = malloc(sizeof(*ret))) == NULL) {
+        return NULL;
+    }
+    ret->origin_addr_len = 0;
+
+    uint8_t *a = chunk_get(BUFFER_SIZE);
+    uint8_t *b = chunk_get(BUFFER_SIZE);
+    buffer_init(&ret->read_buffer,  BUFFER_SIZE, a);
+    buffer_init(&ret->write_buffer, BUFFER_SIZE, b);
+    if(a == NULL || b == NULL) {
+        chunk_put(a, BUFFER_SIZE);
+        chunk_put(b, BUFFER_SIZE);
+        free(ret);
+        ret = NULL;
+    }
+    return ret;
+}
+
+/**
+ * devuelve el bloque de negociación de la sesión, con los buffers que le
+ * queden (en COPY ya pasaron a los anillos).
+ */
+static void
+handshake_release(struct socks5 *s) {
+    struct handshake *hs = s->hs;
+    if(hs == NULL) {
+        return;
+    }
+    s->hs = NULL;
+
+    chunk_put(hs->read_buffer.data,  BUFFER_SIZE);
+    chunk_put(hs->write_buffer.data, BUFFER_SIZE);
+    if(handshake_pool_size < HANDSHAKE_POOL_SIZE && !arena.closed) {
+        hs->next       = handshake_pool;
+        handshake_pool = hs;
+        handshake_pool_size++;
     } else {
-        ret       = pool;
-        pool      = pool->next;
-        ret->next = NULL;
-        pool_size--;
+        free(hs);
     }
+}
+
+/** Forward declaration de la tabla de estados (ERROR + 1 = 11 estados) */
+static const struct state_definition socks5_state_handlers[ERROR + 1];
+
+static struct socks5 *
+socks5_new(int client_fd) {
+    struct socks5 *ret = session_alloc();
 
     if(ret == NULL) {
         goto finally;
     }
 
-    memset(ret, 0x00, sizeof(*ret));
+    // Solo se inicializa la cabecera: el estado de cada etapa lo arma su
+    // on_arrival y los buffers salen del pool sin limpiar. Los anillos quedan
+    // vacíos al liberar la sesión (ver session_buffers_release) y la memoria
+    // nueva de un slab viene en cero.
+    assert(ret->read_ring.data == NULL && ret->write_ring.data == NULL);
+    assert(ret->zc == NULL);
+
+    ret->hs = handshake_new();
+    if(ret->hs == NULL) {
+        session_free(ret);
+        ret = NULL;
+        goto finally;
+    }
 
-    ret->client_fd = client_fd;
-    ret->origin_fd = -1;
+    ret->client_fd                 = client_fd;
+    ret->client_addr_len           = 0;
+    ret->origin_fd                 = -1;
+    ret->origin_resolution         = NULL;
+    ret->hs->conn.count            = 0;
+    ret->spliced                   = false;
+    ret->quiet                     = false;
+    ret->resolving                 = false;
+    ret->next                      = NULL;
+    ret->username                  = NULL;
 
     ret->stm.initial   = HELLO_READ;
     ret->stm.max_state = ERROR;
     ret->stm.states    = socks5_state_handlers;
     stm_init(&ret->stm);
 
-    buffer_init(&ret->read_buffer,  N(ret->raw_buff_a), ret->raw_buff_a);
-    buffer_init(&ret->write_buffer, N(ret->raw_buff_b), ret->raw_buff_b);
-
     ret->references = 1;
     ret->connection_start = time(NULL);
-    ret->dest_addr_str[0] = '\0';
+    ret->dest = NULL;
     ret->dest_port = 0;
     ret->last_status = 0xFF;
     ret->bytes_to_origin = 0;
@@ -295,41 +935,62 @@ finally:
     return ret;
 }
 
-static void
-socks5_destroy_(struct socks5* s) {
-    if(s->origin_resolution != NULL) {
-        freeaddrinfo(s->origin_resolution);
-        s->origin_resolution = NULL;
-    }
-    free(s);
-}
-
 static void
 socks5_destroy(struct socks5 *s) {
     if(s == NULL) {
         // nada para hacer
     } else if(s->references == 1) {
-        if(pool_size < max_pool) {
-            s->next = pool;
-            pool    = s;
-            pool_size++;
-        } else {
-            socks5_destroy_(s);
+        if(s->spliced) {
+            relay_pipe_put(&s->pipes[0]);
+            relay_pipe_put(&s->pipes[1]);
+            s->spliced = false;
+        }
+        handshake_release(s);
+        session_buffers_release(s);
+        if(s->origin_resolution != NULL) {
+            freeaddrinfo(s->origin_resolution);
+            s->origin_resolution = NULL;
         }
+        intern_put(s->username);
+        intern_put(s->dest);
+        session_free(s);
     } else {
         s->references -= 1;
     }
 }
 
+/**
+ * devuelve los slabs vacíos del worker. Los que tienen sesiones todavía
+ * registradas en el selector se liberan con el proceso.
+ */
 void
 socksv5_pool_destroy(void) {
-    struct socks5 *next, *s;
-    for(s = pool; s != NULL ; s = next) {
-        next = s->next;
-        free(s);
+    struct session_slab *next, *slab;
+    for(slab = arena.head; slab != NULL; slab = next) {
+        next = slab->next;
+        if(slab->used == 0) {
+            session_slab_unlink(slab);
+            munmap(slab, session_slab_bytes());
+        }
+    }
+    arena.free   = 0;
+    arena.closed = true;
+
+    while(handshake_pool != NULL) {
+        struct handshake *hs = handshake_pool;
+        handshake_pool = hs->next;
+        free(hs);
+    }
+    handshake_pool_size = 0;
+
+    chunk_pool_destroy();
+    intern_destroy();
+
+    while(pipe_pool_size > 0) {
+        struct relay_pipe *p = &pipe_pool[--pipe_pool_size];
+        close(p->fds[0]);
+        close(p->fds[1]);
     }
-    pool = NULL;
-    pool_size = 0;
 }
 
 /** obtiene el struct (socks5 *) desde la llave de selección */
@@ -342,16 +1003,40 @@ socksv5_pool_destroy(void) {
 static void socksv5_read   (struct selector_key *key);
 static void socksv5_write  (struct selector_key *key);
 static void socksv5_block  (struct selector_key *key);
+static void socksv5_timeout(struct selector_key *key);
+static void socksv5_error  (struct selector_key *key);
 static void socksv5_close  (struct selector_key *key);
 static void socksv5_done   (struct selector_key *key);
 
 static const struct fd_handler socks5_handler = {
-    .handle_read   = socksv5_read,
-    .handle_write  = socksv5_write,
-    .handle_close  = socksv5_close,
-    .handle_block  = socksv5_block,
+    .handle_read    = socksv5_read,
+    .handle_write   = socksv5_write,
+    .handle_close   = socksv5_close,
+    .handle_block   = socksv5_block,
+    .handle_timeout = socksv5_timeout,
+    .handle_error   = socksv5_error,
 };
 
+/**
+ * (re)arma el plazo de la sesión. Hay uno solo y vive en el timer del
+ * client_fd: negociación, conexión al origen o inactividad según el estado.
+ */
+static void
+session_deadline(fd_selector selector, struct socks5 *s, const unsigned seconds) {
+    if(seconds == 0) {
+        selector_cancel_timeout(selector, s->client_fd);
+    } else {
+        selector_set_timeout(selector, s->client_fd, seconds * 1000);
+    }
+}
+
+/** venció el plazo para negociar: se cierra la sesión */
+static unsigned
+handshake_timeout(struct selector_key *key) {
+    (void) key;
+    return ERROR;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // HELLO
 ////////////////////////////////////////////////////////////////////////////////
@@ -363,12 +1048,14 @@ on_hello_method(struct hello_parser *p, const uint8_t method) {
 
     // Verificar si se requiere autenticación
     bool auth_required = false;
+    pthread_rwlock_rdlock(&socks5_args.users_lock);
     for(int i = 0; i < MAX_USERS; i++) {
         if(socks5_args.users[i].name != NULL) {
             auth_required = true;
             break;
         }
     }
+    pthread_rwlock_unlock(&socks5_args.users_lock);
 
     if(auth_required) {
         // Si hay usuarios configurados, requerir USER/PASS
@@ -387,10 +1074,10 @@ on_hello_method(struct hello_parser *p, const uint8_t method) {
 static void
 hello_read_init(const unsigned state, struct selector_key *key) {
     (void) state;
-    struct hello_st *d = &ATTACHMENT(key)->client.hello;
+    struct hello_st *d = &ATTACHMENT(key)->hs->client.hello;
 
-    d->rb                              = &ATTACHMENT(key)->read_buffer;
-    d->wb                              = &ATTACHMENT(key)->write_buffer;
+    d->rb                              = &ATTACHMENT(key)->hs->read_buffer;
+    d->wb                              = &ATTACHMENT(key)->hs->write_buffer;
     d->method                          = SOCKS_HELLO_NO_ACCEPTABLE_METHODS;
     d->parser.data                     = &d->method;
     d->parser.on_authentication_method = on_hello_method;
@@ -400,7 +1087,7 @@ hello_read_init(const unsigned state, struct selector_key *key) {
 static void
 hello_read_close(const unsigned state, struct selector_key *key) {
     (void) state;
-    struct hello_st *d = &ATTACHMENT(key)->client.hello;
+    struct hello_st *d = &ATTACHMENT(key)->hs->client.hello;
     hello_parser_close(&d->parser);
 }
 
@@ -423,7 +1110,7 @@ hello_process(struct hello_st *d) {
 /** Lee bytes del mensaje hello */
 static unsigned
 hello_read(struct selector_key *key) {
-    struct hello_st *d = &ATTACHMENT(key)->client.hello;
+    struct hello_st *d = &ATTACHMENT(key)->hs->client.hello;
     unsigned  ret      = HELLO_READ;
     bool      error    = false;
     uint8_t  *ptr;
@@ -452,7 +1139,7 @@ hello_read(struct selector_key *key) {
 /** Escribe la respuesta del hello */
 static unsigned
 hello_write(struct selector_key *key) {
-    struct hello_st *d = &ATTACHMENT(key)->client.hello;
+    struct hello_st *d = &ATTACHMENT(key)->hs->client.hello;
     unsigned  ret      = HELLO_WRITE;
     uint8_t  *ptr;
     size_t    count;
@@ -486,32 +1173,35 @@ hello_write(struct selector_key *key) {
 static void
 auth_read_init(const unsigned state, struct selector_key *key) {
     (void) state;
-    struct auth_st *d = &ATTACHMENT(key)->client.auth;
+    struct auth_st *d = &ATTACHMENT(key)->hs->client.auth;
 
-    d->rb = &ATTACHMENT(key)->read_buffer;
-    d->wb = &ATTACHMENT(key)->write_buffer;
+    d->rb = &ATTACHMENT(key)->hs->read_buffer;
+    d->wb = &ATTACHMENT(key)->hs->write_buffer;
     auth_parser_init(&d->parser);
 }
 
 static void
 auth_read_close(const unsigned state, struct selector_key *key) {
     (void) state;
-    struct auth_st *d = &ATTACHMENT(key)->client.auth;
+    struct auth_st *d = &ATTACHMENT(key)->hs->client.auth;
     auth_parser_close(&d->parser);
 }
 
 /** Valida las credenciales contra los usuarios configurados */
 static bool
 validate_credentials(const char *username, const char *password) {
-    for(int i = 0; i < MAX_USERS; i++) {
+    bool ret = false;
+    pthread_rwlock_rdlock(&socks5_args.users_lock);
+    for(int i = 0; i < MAX_USERS && !ret; i++) {
         if(socks5_args.users[i].name != NULL) {
             if(strcmp(socks5_args.users[i].name, username) == 0 &&
                strcmp(socks5_args.users[i].pass, password) == 0) {
-                return true;
+                ret = true;
             }
         }
     }
-    return false;
+    pthread_rwlock_unlock(&socks5_args.users_lock);
+    return ret;
 }
 
 /** Procesa la autenticación */
@@ -525,7 +1215,8 @@ auth_process(struct auth_st *d, struct socks5 *s) {
     d->status = valid ? 0x00 : 0x01;
     
     if(valid) {
-        strncpy(s->username, (char *)d->parser.username, sizeof(s->username) - 1);
+        s->username = intern_get((const char *) d->parser.username,
+                                 d->parser.username_len);
         metrics_auth_success();
     } else {
         metrics_auth_failed();
@@ -541,7 +1232,7 @@ auth_process(struct auth_st *d, struct socks5 *s) {
 /** Lee credenciales de autenticación */
 static unsigned
 auth_read(struct selector_key *key) {
-    struct auth_st *d = &ATTACHMENT(key)->client.auth;
+    struct auth_st *d = &ATTACHMENT(key)->hs->client.auth;
     unsigned  ret     = AUTH_READ;
     bool      error   = false;
     uint8_t  *ptr;
@@ -570,7 +1261,7 @@ auth_read(struct selector_key *key) {
 /** Escribe respuesta de autenticación */
 static unsigned
 auth_write(struct selector_key *key) {
-    struct auth_st *d = &ATTACHMENT(key)->client.auth;
+    struct auth_st *d = &ATTACHMENT(key)->hs->client.auth;
     unsigned  ret     = AUTH_WRITE;
     uint8_t  *ptr;
     size_t    count;
@@ -604,10 +1295,10 @@ auth_write(struct selector_key *key) {
 static void
 request_read_init(const unsigned state, struct selector_key *key) {
     (void) state;
-    struct request_st *d = &ATTACHMENT(key)->client.request;
+    struct request_st *d = &ATTACHMENT(key)->hs->client.request;
 
-    d->rb = &ATTACHMENT(key)->read_buffer;
-    d->wb = &ATTACHMENT(key)->write_buffer;
+    d->rb = &ATTACHMENT(key)->hs->read_buffer;
+    d->wb = &ATTACHMENT(key)->hs->write_buffer;
     d->parser.request = &d->request;
     d->status = socks_status_general_SOCKS_server_failure;
     request_parser_init(&d->parser);
@@ -616,177 +1307,92 @@ request_read_init(const unsigned state, struct selector_key *key) {
 static void
 request_read_close(const unsigned state, struct selector_key *key) {
     (void) state;
-    struct request_st *d = &ATTACHMENT(key)->client.request;
+    struct request_st *d = &ATTACHMENT(key)->hs->client.request;
     request_parser_close(&d->parser);
 }
 
-/** Datos para resolución DNS asíncrona */
-struct dns_query {
-    int            client_fd;
-    fd_selector    selector;
-    char           host[SOCKS_MAX_FQDN_LEN + 1];
-    in_port_t      port;
-    struct socks5 *socks5;
-};
-
-/** Hilo de resolución DNS */
-static void *
-dns_resolve_thread(void *data) {
-    struct dns_query *q = (struct dns_query *)data;
-    
-    struct addrinfo hints = {
-        .ai_family   = AF_UNSPEC,
-        .ai_socktype = SOCK_STREAM,
-        .ai_flags    = AI_PASSIVE,
-        .ai_protocol = 0,
-    };
-    
-    char port_str[6];
-    snprintf(port_str, sizeof(port_str), "%d", ntohs(q->port));
-    
-    struct addrinfo *result = NULL;
-    int gai_error = getaddrinfo(q->host, port_str, &hints, &result);
-    
-    if(gai_error == 0) {
-        q->socks5->origin_resolution = result;
-        q->socks5->origin_resolution_current = result;
-    } else {
-        q->socks5->origin_resolution = NULL;
-    }
-    
-    // Notificar al selector
-    selector_notify_block(q->selector, q->client_fd);
-    
-    free(q);
-    return NULL;
-}
-
-/** Inicia resolución DNS asíncrona */
+/**
+ * Inicia la resolución DNS: en el cliente DNS del worker o, con -D, en el
+ * pool de resolvers. Si no se pudo encolar se le responde al cliente
+ * enseguida, sin esperar.
+ */
 static unsigned
 request_start_dns_resolution(struct selector_key *key) {
-    struct request_st *d = &ATTACHMENT(key)->client.request;
     struct socks5 *s = ATTACHMENT(key);
-    
-    struct dns_query *q = malloc(sizeof(*q));
-    if(q == NULL) {
-        return ERROR;
+    struct request_st *d = &s->hs->client.request;
+
+    const bool submitted = socks5_args.system_resolver
+        ? resolver_submit(key->s, s->client_fd, d->request.dest_addr.fqdn,
+                          d->request.dest_port, &s->origin_resolution)
+        : dns_submit(key->s, s->client_fd, d->request.dest_addr.fqdn,
+                     d->request.dest_port, &s->origin_resolution);
+    if(!submitted) {
+        d->status = socks_status_general_SOCKS_server_failure;
+        if(SELECTOR_SUCCESS != selector_set_interest_key(key, OP_WRITE)) {
+            return ERROR;
+        }
+        return REQUEST_WRITE;
     }
-    
-    q->client_fd = s->client_fd;
-    q->selector  = key->s;
-    q->port      = d->request.dest_port;
-    q->socks5    = s;
-    strncpy(q->host, d->request.dest_addr.fqdn, sizeof(q->host) - 1);
-    
     s->references++;
-    
-    pthread_t tid;
-    if(pthread_create(&tid, NULL, dns_resolve_thread, q) != 0) {
-        free(q);
-        s->references--;
-        return ERROR;
-    }
-    pthread_detach(tid);
-    
+    s->resolving = true;
+
     return REQUEST_RESOLVING;
 }
 
-/** Conecta al servidor origen */
+static unsigned
+connecting_start(fd_selector selector, struct socks5 *s);
+
+/** Conecta al servidor origen, con las direcciones de origin_resolution */
 static unsigned
 request_connect(struct selector_key *key) {
     struct socks5 *s = ATTACHMENT(key);
-    struct request_st *d = &s->client.request;
-    
-    struct addrinfo *addr = s->origin_resolution_current;
-    
-    while(addr != NULL) {
-        int fd = socket(addr->ai_family, SOCK_STREAM, 0);
-        if(fd == -1) {
-            addr = addr->ai_next;
-            continue;
-        }
-        
-        if(selector_fd_set_nio(fd) == -1) {
-            close(fd);
-            addr = addr->ai_next;
-            continue;
-        }
-        
-        int ret = connect(fd, addr->ai_addr, addr->ai_addrlen);
-        if(ret == -1) {
-            if(errno == EINPROGRESS) {
-                // conexión en progreso
-                s->origin_fd = fd;
-                s->origin_resolution_current = addr->ai_next;
-                
-                // Registrar el fd del origen en el selector
-                if(SELECTOR_SUCCESS != selector_register(key->s, fd, 
-                    &socks5_handler, OP_WRITE, s)) {
-                    close(fd);
-                    s->origin_fd = -1;
-                    addr = addr->ai_next;
-                    continue;
-                }
-                
-                s->references++;
-                
-                // Desactivar interés en el cliente mientras conectamos
-                selector_set_interest_key(key, OP_NOOP);
-                
-                return REQUEST_CONNECTING;
-            }
-            close(fd);
-            addr = addr->ai_next;
-            continue;
-        }
-        
-        // Conexión inmediata exitosa
-        s->origin_fd = fd;
-        memcpy(&s->origin_addr, addr->ai_addr, addr->ai_addrlen);
-        s->origin_addr_len = addr->ai_addrlen;
-        d->status = socks_status_succeeded;
-        
-        if(SELECTOR_SUCCESS != selector_register(key->s, fd,
-            &socks5_handler, OP_READ, s)) {
-            close(fd);
-            s->origin_fd = -1;
-            d->status = socks_status_general_SOCKS_server_failure;
-        } else {
-            s->references++;
+    struct connecting *d = &s->hs->conn;
+
+    // la primera dirección de cada familia
+    d->next[0] = d->next[1] = NULL;
+    for(struct addrinfo *ai = s->origin_resolution; ai != NULL; ai = ai->ai_next) {
+        const unsigned i = ai->ai_family == AF_INET6 ? 0 : 1;
+        if(d->next[i] == NULL) {
+            d->next[i] = ai;
         }
-        
-        return REQUEST_WRITE;
     }
-    
-    d->status = socks_status_host_unreachable;
-    return REQUEST_WRITE;
+    d->turn    = 0;
+    d->count   = 0;
+    d->error   = EHOSTUNREACH;
+
+    // Desactivar interés en el cliente mientras conectamos
+    selector_set_interest(key->s, s->client_fd, OP_NOOP);
+    return connecting_start(key->s, s);
 }
 
 /** Procesa el request del cliente */
 static unsigned
 request_process(struct selector_key *key) {
     struct socks5 *s = ATTACHMENT(key);
-    struct request_st *d = &s->client.request;
+    struct request_st *d = &s->hs->client.request;
+    
+    // Desde acá corre el plazo para resolver y conectar el origen
+    session_deadline(key->s, s, socks5_args.connect_timeout);
     
     // Guardar destino para logging
+    char dest[SOCKS_MAX_FQDN_LEN + 1];
     s->dest_port = ntohs(d->request.dest_port);
     switch(d->request.dest_addr_type) {
         case socks_req_addrtype_ipv4:
-            inet_ntop(AF_INET, &d->request.dest_addr.ipv4, 
-                      s->dest_addr_str, sizeof(s->dest_addr_str));
+            inet_ntop(AF_INET, &d->request.dest_addr.ipv4, dest, sizeof(dest));
             break;
         case socks_req_addrtype_ipv6:
-            inet_ntop(AF_INET6, &d->request.dest_addr.ipv6,
-                      s->dest_addr_str, sizeof(s->dest_addr_str));
+            inet_ntop(AF_INET6, &d->request.dest_addr.ipv6, dest, sizeof(dest));
             break;
         case socks_req_addrtype_domain:
-            strncpy(s->dest_addr_str, d->request.dest_addr.fqdn, 
-                    sizeof(s->dest_addr_str) - 1);
+            // snprintf termina el string y no rellena el resto con ceros
+            snprintf(dest, sizeof(dest), "%s", d->request.dest_addr.fqdn);
             break;
         default:
-            strncpy(s->dest_addr_str, "unknown", sizeof(s->dest_addr_str) - 1);
+            snprintf(dest, sizeof(dest), "unknown");
             break;
     }
+    s->dest = intern_get(dest, strlen(dest));
     
     // Verificar que sea CONNECT
     if(d->request.cmd != socks_req_cmd_connect) {
@@ -797,11 +1403,11 @@ request_process(struct selector_key *key) {
     // Preparar la resolución de direcciones
     switch(d->request.dest_addr_type) {
         case socks_req_addrtype_ipv4: {
-            struct sockaddr_in *addr = (struct sockaddr_in *)&s->origin_addr;
+            struct sockaddr_in *addr = (struct sockaddr_in *)&s->hs->origin_addr;
             addr->sin_family = AF_INET;
             addr->sin_port = d->request.dest_port;
             memcpy(&addr->sin_addr, &d->request.dest_addr.ipv4, 4);
-            s->origin_addr_len = sizeof(*addr);
+            s->hs->origin_addr_len = sizeof(*addr);
             
             // Crear addrinfo manual
             struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in));
@@ -816,16 +1422,15 @@ request_process(struct selector_key *key) {
             memcpy(ai->ai_addr, addr, sizeof(*addr));
             
             s->origin_resolution = ai;
-            s->origin_resolution_current = ai;
             return request_connect(key);
         }
         
         case socks_req_addrtype_ipv6: {
-            struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&s->origin_addr;
+            struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&s->hs->origin_addr;
             addr->sin6_family = AF_INET6;
             addr->sin6_port = d->request.dest_port;
             memcpy(&addr->sin6_addr, &d->request.dest_addr.ipv6, 16);
-            s->origin_addr_len = sizeof(*addr);
+            s->hs->origin_addr_len = sizeof(*addr);
             
             struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in6));
             if(ai == NULL) {
@@ -839,11 +1444,35 @@ request_process(struct selector_key *key) {
             memcpy(ai->ai_addr, addr, sizeof(*addr));
             
             s->origin_resolution = ai;
-            s->origin_resolution_current = ai;
             return request_connect(key);
         }
         
         case socks_req_addrtype_domain:
+            // Si está en el caché se conecta sin pasar por REQUEST_RESOLVING
+            switch(dnscache_lookup(d->request.dest_addr.fqdn, d->request.dest_port,
+                                   &s->origin_resolution)) {
+                case DNSCACHE_REFRESH:
+                    // Está por vencer y se pide seguido: se renueva en
+                    // segundo plano para que el próximo no espere. Si no
+                    // se pudo (cola llena, por ejemplo), que lo intente el
+                    // próximo acierto
+                    if(!(socks5_args.system_resolver
+                         ? resolver_prefetch(d->request.dest_addr.fqdn)
+                         : dns_prefetch(key->s, d->request.dest_addr.fqdn))) {
+                        dnscache_refresh_abort(d->request.dest_addr.fqdn);
+                    }
+                    // fall through
+                case DNSCACHE_HIT:
+                    return request_connect(key);
+                case DNSCACHE_NEGATIVE:
+                    d->status = socks_status_host_unreachable;
+                    if(SELECTOR_SUCCESS != selector_set_interest_key(key, OP_WRITE)) {
+                        return ERROR;
+                    }
+                    return REQUEST_WRITE;
+                case DNSCACHE_MISS:
+                    break;
+            }
             // Necesita resolución DNS asíncrona
             if(SELECTOR_SUCCESS != selector_set_interest_key(key, OP_NOOP)) {
                 return ERROR;
@@ -859,7 +1488,7 @@ request_process(struct selector_key *key) {
 /** Lee el request del cliente */
 static unsigned
 request_read(struct selector_key *key) {
-    struct request_st *d = &ATTACHMENT(key)->client.request;
+    struct request_st *d = &ATTACHMENT(key)->hs->client.request;
     unsigned  ret     = REQUEST_READ;
     bool      error   = false;
     uint8_t  *ptr;
@@ -895,193 +1524,589 @@ request_resolving_init(const unsigned state, struct selector_key *key) {
 static unsigned
 request_resolving_done(struct selector_key *key) {
     struct socks5 *s = ATTACHMENT(key);
-    struct request_st *d = &s->client.request;
+    struct request_st *d = &s->hs->client.request;
 
     if(s->references > 1) {
         s->references--;
     }
+    s->resolving = false;
 
     if(s->origin_resolution == NULL) {
         d->status = socks_status_host_unreachable;
         selector_set_interest_key(key, OP_WRITE);
         return REQUEST_WRITE;
     }
-    
-    s->origin_resolution_current = s->origin_resolution;
+
     return request_connect(key);
 }
 
+/**
+ * venció el plazo mientras se resolvía: se le responde al cliente sin
+ * esperar al resolver. La sesión recién termina cuando llega su
+ * notificación (ver request_write_block).
+ */
+static unsigned
+request_resolving_timeout(struct selector_key *key) {
+    struct request_st *d = &ATTACHMENT(key)->hs->client.request;
+
+    d->status = errno_to_socks(ETIMEDOUT);
+    if(SELECTOR_SUCCESS != selector_set_interest_key(key, OP_WRITE)) {
+        return ERROR;
+    }
+    return REQUEST_WRITE;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // REQUEST_CONNECTING
 ////////////////////////////////////////////////////////////////////////////////
 
+/** la próxima dirección a intentar, alternando familias. NULL si no quedan */
+static struct addrinfo *
+connecting_next(struct connecting *d) {
+    unsigned i = d->turn;
+    if(d->next[i] == NULL) {
+        i = 1 - i;
+    }
+    struct addrinfo *ai = d->next[i];
+    if(ai != NULL) {
+        struct addrinfo *n = ai->ai_next;
+        while(n != NULL && n->ai_family != ai->ai_family) {
+            n = n->ai_next;
+        }
+        d->next[i] = n;
+        d->turn    = 1 - i;
+    }
+    return ai;
+}
+
+/** abandona el intento de `fd'. Al desregistrarlo socksv5_close libera su referencia */
 static void
-connecting_init(const unsigned state, struct selector_key *key) {
-    (void) state;
-    struct connecting *d = &ATTACHMENT(key)->orig.conn;
-    d->fd = ATTACHMENT(key)->origin_fd;
-    d->status = socks_status_succeeded;
+connecting_drop(fd_selector selector, struct socks5 *s, const int fd) {
+    struct connecting *d = &s->hs->conn;
+    for(unsigned i = 0; i < d->count; i++) {
+        if(d->fds[i] == fd) {
+            d->fds[i] = d->fds[--d->count];
+            break;
+        }
+    }
+    selector_unregister_fd(selector, fd);
+    close(fd);
+}
+
+/** conectó el intento de `fd': los demás se abandonan */
+static unsigned
+connecting_won(fd_selector selector, struct socks5 *s, const int fd) {
+    struct connecting *d = &s->hs->conn;
+    while(d->count > 0) {
+        const int other = d->fds[--d->count];
+        if(other != fd) {
+            selector_unregister_fd(selector, other);
+            close(other);
+        }
+    }
+    s->origin_fd = fd;
+    selector_cancel_timeout(selector, fd);
+
+    s->hs->client.request.status = socks_status_succeeded;
+    metrics_connection_success();
+
+    // Obtener la dirección local para la respuesta
+    socklen_t addr_len = sizeof(s->hs->origin_addr);
+    getsockname(fd, (struct sockaddr *)&s->hs->origin_addr, &addr_len);
+    s->hs->origin_addr_len = addr_len;
+
+    selector_set_interest(selector, s->client_fd, OP_WRITE);
+    selector_set_interest(selector, fd, OP_NOOP);
+    return REQUEST_WRITE;
+}
+
+/**
+ * suma intentos hasta que uno quede en curso o conecte en el acto. Sin
+ * direcciones ni intentos en curso se le responde al cliente el último error.
+ */
+static unsigned
+connecting_start(fd_selector selector, struct socks5 *s) {
+    struct connecting *d = &s->hs->conn;
+    struct addrinfo *ai;
+
+    while(d->count < CONNECT_ATTEMPTS_MAX && (ai = connecting_next(d)) != NULL) {
+        const int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+        if(fd == -1) {
+            d->error = errno;
+            continue;
+        }
+        if(selector_fd_set_nio(fd) == -1) {
+            d->error = errno;
+            close(fd);
+            continue;
+        }
+        const bool connected = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+        if(!connected && errno != EINPROGRESS) {
+            d->error = errno;
+            close(fd);
+            continue;
+        }
+        if(SELECTOR_SUCCESS != selector_register(selector, fd, &socks5_handler,
+                                                 connected ? OP_NOOP : OP_WRITE, s)) {
+            d->error = ENOMEM;
+            close(fd);
+            continue;
+        }
+        s->references++;
+        d->fds[d->count++] = fd;
+        if(connected) {
+            return connecting_won(selector, s, fd);
+        }
+        // si no conecta a tiempo se suma el siguiente, sin abandonarlo
+        selector_set_timeout(selector, fd, CONNECT_ATTEMPT_DELAY_MS);
+        return REQUEST_CONNECTING;
+    }
+
+    if(d->count > 0) {
+        return REQUEST_CONNECTING;
+    }
+    s->hs->client.request.status = errno_to_socks(d->error);
+    if(SELECTOR_SUCCESS != selector_set_interest(selector, s->client_fd, OP_WRITE)) {
+        return ERROR;
+    }
+    return REQUEST_WRITE;
 }
 
-/** Verifica si la conexión se completó */
+/** Terminó (bien o mal) el intento de key->fd */
 static unsigned
 connecting_write(struct selector_key *key) {
     struct socks5 *s = ATTACHMENT(key);
-    struct request_st *d = &s->client.request;
-    
+
     int error = 0;
     socklen_t len = sizeof(error);
-    
-    // Verificar si connect() tuvo éxito
-    if(getsockopt(s->origin_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+    if(getsockopt(key->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
         error = errno;
     }
-    
-    if(error != 0) {
-        // Falló, intentar siguiente dirección
-        selector_unregister_fd(key->s, s->origin_fd);
-        close(s->origin_fd);
-        s->origin_fd = -1;
-        s->references--;
-        
-        if(s->origin_resolution_current != NULL) {
-            // Hay más direcciones para intentar
-            struct selector_key client_key = {
-                .s = key->s,
-                .fd = s->client_fd,
-                .data = s,
-            };
-            unsigned ret = request_connect(&client_key);
-            if(ret == REQUEST_CONNECTING) {
-                return REQUEST_CONNECTING;
-            }
-        }
-        
-        d->status = errno_to_socks(error);
-        selector_set_interest(key->s, s->client_fd, OP_WRITE);
-        return REQUEST_WRITE;
+    if(error == 0) {
+        return connecting_won(key->s, s, key->fd);
+    }
+
+    // Falló: el siguiente se suma sin esperar
+    s->hs->conn.error = error;
+    connecting_drop(key->s, s, key->fd);
+    return connecting_start(key->s, s);
+}
+
+/**
+ * venció un plazo. El de un intento (su fd) suma el siguiente; el de la
+ * conexión vive en el client_fd: se abandonan los intentos y se responde.
+ */
+static unsigned
+connecting_timeout(struct selector_key *key) {
+    struct socks5 *s = ATTACHMENT(key);
+    struct connecting *d = &s->hs->conn;
+
+    if(key->fd != s->client_fd) {
+        return connecting_start(key->s, s);
+    }
+    while(d->count > 0) {
+        connecting_drop(key->s, s, d->fds[d->count - 1]);
+    }
+    s->hs->client.request.status = errno_to_socks(ETIMEDOUT);
+    if(SELECTOR_SUCCESS != selector_set_interest_key(key, OP_WRITE)) {
+        return ERROR;
     }
+    return REQUEST_WRITE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// REQUEST_WRITE
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+request_write_init(const unsigned state, struct selector_key *key) {
+    (void) state;
+    struct socks5 *s = ATTACHMENT(key);
+    struct request_st *d = &s->hs->client.request;
     
-    // Conexión exitosa
-    d->status = socks_status_succeeded;
-    metrics_connection_success();
+    // Guardar status para logging
+    s->last_status = d->status;
     
-    // Obtener la dirección local para la respuesta
-    socklen_t addr_len = sizeof(s->origin_addr);
-    getsockname(s->origin_fd, (struct sockaddr *)&s->origin_addr, &addr_len);
-    s->origin_addr_len = addr_len;
+    // Armar respuesta
+    enum socks_addr_type atyp = socks_req_addrtype_ipv4;
+    union socks_addr addr;
+    in_port_t port = 0;
     
-    selector_set_interest(key->s, s->client_fd, OP_WRITE);
-    selector_set_interest(key->s, s->origin_fd, OP_NOOP);
+    memset(&addr, 0, sizeof(addr));
+    
+    if(d->status == socks_status_succeeded && s->origin_fd != -1) {
+        if(s->hs->origin_addr.ss_family == AF_INET) {
+            struct sockaddr_in *a = (struct sockaddr_in *)&s->hs->origin_addr;
+            atyp = socks_req_addrtype_ipv4;
+            memcpy(&addr.ipv4, &a->sin_addr, 4);
+            port = a->sin_port;
+        } else if(s->hs->origin_addr.ss_family == AF_INET6) {
+            struct sockaddr_in6 *a = (struct sockaddr_in6 *)&s->hs->origin_addr;
+            atyp = socks_req_addrtype_ipv6;
+            memcpy(&addr.ipv6, &a->sin6_addr, 16);
+            port = a->sin6_port;
+        }
+    }
     
+    request_marshall(d->wb, d->status, atyp, &addr, port);
+}
+
+/**
+ * el resolver todavía tiene el client_fd: no se puede cerrar hasta que
+ * llegue su aviso, así que la sesión queda sin intereses y sin nada por
+ * responder (ver request_write_block)
+ */
+static unsigned
+request_write_park(struct selector_key *key) {
+    selector_set_interest_key(key, OP_NOOP);
+    buffer_reset(ATTACHMENT(key)->hs->client.request.wb);
     return REQUEST_WRITE;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// REQUEST_WRITE
-////////////////////////////////////////////////////////////////////////////////
-
+static unsigned
+request_write(struct selector_key *key) {
+    struct socks5 *s = ATTACHMENT(key);
+    struct request_st *d = &s->hs->client.request;
+    unsigned  ret     = REQUEST_WRITE;
+    uint8_t  *ptr;
+    size_t    count;
+    ssize_t   n;
+
+    ptr = buffer_read_ptr(d->wb, &count);
+    n = send(key->fd, ptr, count, MSG_NOSIGNAL);
+    if(n == -1) {
+        ret = s->resolving ? request_write_park(key) : ERROR;
+    } else {
+        buffer_read_adv(d->wb, n);
+        if(!buffer_can_read(d->wb)) {
+            if(d->status == socks_status_succeeded) {
+                ret = COPY;
+                // Activar lectura en ambos extremos
+                selector_set_interest(key->s, s->client_fd, OP_READ);
+                if(s->origin_fd != -1) {
+                    selector_set_interest(key->s, s->origin_fd, OP_READ);
+                }
+            } else {
+                metrics_connection_failed();
+                ret = DONE;
+                if(s->resolving) {
+                    // respondimos por timeout: falta que vuelva el resolver
+                    ret = request_write_park(key);
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/** llegó la resolución que se dejó de esperar por timeout */
+static unsigned
+request_write_block(struct selector_key *key) {
+    struct socks5 *s = ATTACHMENT(key);
+    struct request_st *d = &s->hs->client.request;
+
+    if(s->references > 1) {
+        s->references--;
+    }
+    s->resolving = false;
+    if(s->origin_resolution != NULL) {
+        freeaddrinfo(s->origin_resolution);
+        s->origin_resolution = NULL;
+    }
+
+    // si la respuesta ya salió no queda nada por hacer
+    return buffer_can_read(d->wb) ? REQUEST_WRITE : DONE;
+}
+
+/** no se pudo entregar la respuesta a tiempo */
+static unsigned
+request_write_timeout(struct selector_key *key) {
+    struct socks5 *s = ATTACHMENT(key);
+
+    return s->resolving ? request_write_park(key) : ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// COPY
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * decide si el túnel usa splice. Hace falta que ningún disector necesite ver
+ * los datos y que no haya bytes esperando en los buffers de la negociación.
+ */
+static bool
+copy_splice_init(struct socks5 *s) {
+    if(!socks5_args.splice_relay || socks5_args.disectors_enabled
+       || buffer_can_read(&s->hs->read_buffer)
+       || buffer_can_read(&s->hs->write_buffer)) {
+        return false;
+    }
+    if(!relay_pipe_get(&s->pipes[0])) {
+        return false;
+    }
+    if(!relay_pipe_get(&s->pipes[1])) {
+        relay_pipe_put(&s->pipes[0]);
+        return false;
+    }
+    s->spliced = true;
+    return true;
+}
+
+/** algún anillo creció por encima de la memoria de la sesión */
+static bool
+copy_rings_grown(const struct socks5 *s) {
+    return s->read_ring.size != BUFFER_SIZE || s->write_ring.size != BUFFER_SIZE;
+}
+
+/**
+ * habilita MSG_ZEROCOPY en el socket de `d' si se pidió con -Z. Con splice
+ * no hace falta: los datos nunca pasan por el proceso.
+ */
+static void
+copy_zerocopy_init(struct copy *d, struct zerocopy *zc) {
+    const int one = 1;
+
+    d->zc = NULL;
+    if(zc != NULL && d->wp == NULL
+       && 0 == setsockopt(*d->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+        d->zc = zc;
+    }
+}
+
+/** hay envíos con MSG_ZEROCOPY fijando memoria del anillo de escritura */
+static bool
+copy_pinned(const struct copy *d) {
+    return d->zc != NULL && d->zc->count > 0;
+}
+
+/**
+ * decide si un envío de `unsent' bytes usa MSG_ZEROCOPY. Con envíos
+ * pendientes se sigue usando aunque sea chico: el anillo se libera en orden
+ * y unos bytes copiados detrás de otros fijados no se podrían liberar antes.
+ */
+static bool
+zerocopy_wanted(const struct zerocopy *zc, const size_t unsent) {
+    return zc != NULL
+        && (zc->count > 0
+            || (!zc->disabled && unsent >= socks5_args.zerocopy_threshold));
+}
+
+/** registra un envío de `n' bytes con MSG_ZEROCOPY */
+static void
+zerocopy_push(struct zerocopy *zc, const size_t n) {
+    const unsigned i = (zc->head + zc->count) % ZEROCOPY_PENDING;
+    zc->sizes[i] = n;
+    zc->done[i]  = false;
+    zc->count++;
+    zc->inflight += n;
+}
+
+/** el kernel liberó los envíos numerados de `lo' a `hi' inclusive */
 static void
-request_write_init(const unsigned state, struct selector_key *key) {
-    (void) state;
-    struct socks5 *s = ATTACHMENT(key);
-    struct request_st *d = &s->client.request;
-    
-    // Guardar status para logging
-    s->last_status = d->status;
-    
-    // Armar respuesta
-    enum socks_addr_type atyp = socks_req_addrtype_ipv4;
-    union socks_addr addr;
-    in_port_t port = 0;
-    
-    memset(&addr, 0, sizeof(addr));
-    
-    if(d->status == socks_status_succeeded && s->origin_fd != -1) {
-        if(s->origin_addr.ss_family == AF_INET) {
-            struct sockaddr_in *a = (struct sockaddr_in *)&s->origin_addr;
-            atyp = socks_req_addrtype_ipv4;
-            memcpy(&addr.ipv4, &a->sin_addr, 4);
-            port = a->sin_port;
-        } else if(s->origin_addr.ss_family == AF_INET6) {
-            struct sockaddr_in6 *a = (struct sockaddr_in6 *)&s->origin_addr;
-            atyp = socks_req_addrtype_ipv6;
-            memcpy(&addr.ipv6, &a->sin6_addr, 16);
-            port = a->sin6_port;
+zerocopy_complete(struct zerocopy *zc, const uint32_t lo, const uint32_t hi) {
+    for(unsigned i = 0; i < zc->count; i++) {
+        const uint32_t id = zc->head_id + i;
+        if(id - lo <= hi - lo) {
+            zc->done[(zc->head + i) % ZEROCOPY_PENDING] = true;
         }
     }
-    
-    request_marshall(d->wb, d->status, atyp, &addr, port);
 }
 
-static unsigned
-request_write(struct selector_key *key) {
-    struct socks5 *s = ATTACHMENT(key);
-    struct request_st *d = &s->client.request;
-    unsigned  ret     = REQUEST_WRITE;
-    uint8_t  *ptr;
-    size_t    count;
-    ssize_t   n;
-
-    ptr = buffer_read_ptr(d->wb, &count);
-    n = send(key->fd, ptr, count, MSG_NOSIGNAL);
-    if(n == -1) {
-        ret = ERROR;
-    } else {
-        buffer_read_adv(d->wb, n);
-        if(!buffer_can_read(d->wb)) {
-            if(d->status == socks_status_succeeded) {
-                ret = COPY;
-                // Activar lectura en ambos extremos
-                selector_set_interest(key->s, s->client_fd, OP_READ);
-                if(s->origin_fd != -1) {
-                    selector_set_interest(key->s, s->origin_fd, OP_READ);
-                }
-            } else {
-                metrics_connection_failed();
-                ret = DONE;
+/**
+ * procesa los avisos de la cola de errores de `fd' y consume del anillo los
+ * envíos que el kernel ya liberó, en orden. Retorna true si liberó alguno.
+ */
+static bool
+zerocopy_reap(struct zerocopy *zc, ring_buffer *r, const int fd) {
+    bool ret = false;
+
+    // se vacía la cola entera: con avisos sin leer epoll sigue reportando
+    // EPOLLERR y el selector giraría en vacío
+    for(;;) {
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err)
+                                   + sizeof(struct sockaddr_in6))];
+        struct msghdr msg = {
+            .msg_control    = control,
+            .msg_controllen = sizeof(control),
+        };
+        if(-1 == recvmsg(fd, &msg, MSG_ERRQUEUE)) {
+            // EAGAIN: no hay más avisos
+            break;
+        }
+        for(struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+            cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR)
+              || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const struct sock_extended_err *ee = (void *) CMSG_DATA(cm);
+            if(ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
             }
+            zerocopy_complete(zc, ee->ee_info, ee->ee_data);
+            if(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc->disabled = true;
+            }
+        }
+        while(zc->count > 0 && zc->done[zc->head]) {
+            ring_read_adv(r, zc->sizes[zc->head]);
+            zc->inflight -= zc->sizes[zc->head];
+            zc->head = (zc->head + 1) % ZEROCOPY_PENDING;
+            zc->head_id++;
+            zc->count--;
+            zc->blocked = false;
+            ret = true;
         }
     }
-
+    if(ret) {
+        relay_ring_detach(r);
+    }
     return ret;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// COPY
-////////////////////////////////////////////////////////////////////////////////
+/** una lectura llenó el anillo: pasa a la siguiente clase de tamaño */
+static void
+copy_ring_grow(ring_buffer *r) {
+    const size_t max = socks5_args.relay_buffer_max;
+    if(r->size >= max) {
+        return;
+    }
+    size_t size = r->size < RELAY_BUFFER_MIN ? RELAY_BUFFER_MIN
+                                             : r->size * RELAY_BUFFER_GROWTH;
+    if(size > max) {
+        size = max;
+    }
+    // sin memoria se sigue con el tamaño actual
+    relay_ring_resize(r, size);
+}
+
+/**
+ * rearma el plazo de inactividad del túnel. Si algún anillo creció vence
+ * antes, a los RELAY_QUIET segundos, para devolver esa memoria.
+ */
+static void
+copy_deadline(fd_selector selector, struct socks5 *s) {
+    unsigned seconds = socks5_args.idle_timeout;
+    if(copy_rings_grown(s) && (seconds == 0 || seconds > RELAY_QUIET)) {
+        seconds = RELAY_QUIET;
+    }
+    s->quiet = false;
+    session_deadline(selector, s, seconds);
+}
 
 static void
 copy_init(const unsigned state, struct selector_key *key) {
     (void) state;
     struct socks5 *s = ATTACHMENT(key);
     
-    struct copy *c_client = &s->client.copy;
-    struct copy *c_origin = &s->orig.copy;
+    struct copy *c_client = &s->client_copy;
+    struct copy *c_origin = &s->origin_copy;
     
+    // los buffers de la negociación pasan a los anillos, que los devuelven
+    // al pool mientras no tengan datos en tránsito
+    ring_adopt(&s->read_ring,  &s->hs->read_buffer);
+    ring_adopt(&s->write_ring, &s->hs->write_buffer);
+    buffer_init(&s->hs->read_buffer,  0, NULL);
+    buffer_init(&s->hs->write_buffer, 0, NULL);
+    relay_ring_detach(&s->read_ring);
+    relay_ring_detach(&s->write_ring);
+
     c_client->fd     = &s->client_fd;
-    c_client->rb     = &s->read_buffer;
-    c_client->wb     = &s->write_buffer;
+    c_client->rb     = &s->read_ring;
+    c_client->wb     = &s->write_ring;
     c_client->duplex = OP_READ | OP_WRITE;
     c_client->other  = c_origin;
     
     c_origin->fd     = &s->origin_fd;
-    c_origin->rb     = &s->write_buffer;
-    c_origin->wb     = &s->read_buffer;
+    c_origin->rb     = &s->write_ring;
+    c_origin->wb     = &s->read_ring;
     c_origin->duplex = OP_READ | OP_WRITE;
     c_origin->other  = c_client;
+
+    if(copy_splice_init(s)) {
+        c_client->rp = &s->pipes[0];
+        c_client->wp = &s->pipes[1];
+        c_origin->rp = &s->pipes[1];
+        c_origin->wp = &s->pipes[0];
+    } else {
+        c_client->rp = c_client->wp = NULL;
+        c_origin->rp = c_origin->wp = NULL;
+    }
+
+    // el estado de MSG_ZEROCOPY solo existe si se usa
+    if(socks5_args.zerocopy_threshold > 0 && !s->spliced) {
+        s->zc = calloc(1, sizeof(*s->zc));
+    }
+    copy_zerocopy_init(c_client, s->zc == NULL ? NULL : &s->zc->write);
+    copy_zerocopy_init(c_origin, s->zc == NULL ? NULL : &s->zc->read);
+    if(c_client->zc == NULL && c_origin->zc == NULL) {
+        free(s->zc);
+        s->zc = NULL;
+    }
+
+    // la negociación terminó: la sesión se queda solo con lo del túnel
+    handshake_release(s);
+    if(s->origin_resolution != NULL) {
+        freeaddrinfo(s->origin_resolution);
+        s->origin_resolution = NULL;
+    }
+
+    copy_deadline(key->s, s);
+}
+
+/** hay lugar para leer del fd */
+static bool
+copy_can_fill(const struct copy *d) {
+    return d->rp != NULL ? d->rp->len < d->rp->size && !d->rp->full
+                         : ring_can_write(d->rb);
+}
+
+/** hay bytes esperando para ser escritos en el fd, y se pueden enviar */
+static bool
+copy_can_drain(const struct copy *d) {
+    if(d->wp != NULL) {
+        return d->wp->len > 0;
+    }
+    if(d->zc == NULL) {
+        return ring_can_read(d->wb);
+    }
+    return d->wb->len > d->zc->inflight
+        && !d->zc->blocked && d->zc->count < ZEROCOPY_PENDING;
+}
+
+/**
+ * quedan bytes hacia el fd: por enviar o, con MSG_ZEROCOPY, enviados pero
+ * sin confirmar. Hasta que no quede nada no se envía el FIN: el kernel
+ * reporta un hangup del socket y el selector no podría esperar los avisos.
+ */
+static bool
+copy_pending(const struct copy *d) {
+    return d->wp != NULL ? d->wp->len > 0 : ring_can_read(d->wb);
+}
+
+/** el otro extremo ya cerró y se vació lo que había mandado: enviar el FIN */
+static void
+copy_shutdown_drained(struct copy *d) {
+    if((d->duplex & OP_WRITE) && !copy_pending(d) && !(d->other->duplex & OP_READ)) {
+        shutdown(*d->fd, SHUT_WR);
+        d->duplex = INTEREST_OFF(d->duplex, OP_WRITE);
+    }
 }
 
 static fd_interest
 copy_compute_interests(fd_selector s, struct copy *d) {
     fd_interest ret = OP_NOOP;
     
-    if((d->duplex & OP_READ) && buffer_can_write(d->rb)) {
+    if((d->duplex & OP_READ) && copy_can_fill(d)) {
         ret |= OP_READ;
     }
-    if((d->duplex & OP_WRITE) && buffer_can_read(d->wb)) {
+    if((d->duplex & OP_WRITE) && copy_can_drain(d)) {
         ret |= OP_WRITE;
     }
+    if(copy_pinned(d)) {
+        ret |= OP_ERROR;
+    }
     
     if(SELECTOR_SUCCESS != selector_set_interest(s, *d->fd, ret)) {
         abort();
@@ -1096,12 +2121,133 @@ copy_ptr(struct selector_key *key) {
     struct socks5 *s = ATTACHMENT(key);
     
     if(key->fd == s->client_fd) {
-        return &s->client.copy;
+        return &s->client_copy;
+    } else {
+        return &s->origin_copy;
+    }
+}
+
+/** lee del fd hacia el buffer (o la tubería) de lectura. Como recv(2) */
+static ssize_t
+copy_recv(struct copy *d, const int fd) {
+    ssize_t n;
+    if(d->rp != NULL) {
+        n = splice(fd, NULL, d->rp->fds[1], NULL, d->rp->size - d->rp->len,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0) {
+            d->rp->len += n;
+        } else if(n == -1 && errno == EAGAIN && d->rp->len > 0) {
+            // o no hay datos, o no entran: en ambos casos se espera a que
+            // el otro extremo consuma lo que hay en la tubería
+            d->rp->full = true;
+        }
+    } else if(!relay_ring_attach(d->rb)) {
+        errno = ENOMEM;
+        n     = -1;
+    } else {
+        struct iovec iov[2];
+        n = readv(fd, iov, ring_write_iov(d->rb, iov));
+        if(n > 0) {
+            ring_write_adv(d->rb, n);
+        } else {
+            relay_ring_detach(d->rb);
+        }
+    }
+    return n;
+}
+
+/** escribe en el fd desde el buffer (o la tubería) de escritura. Como send(2) */
+static ssize_t
+copy_send(struct copy *d, const int fd) {
+    ssize_t n;
+    if(d->wp != NULL) {
+        n = splice(d->wp->fds[0], NULL, fd, NULL, d->wp->len,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0) {
+            d->wp->len -= n;
+            d->wp->full = false;
+        }
+    } else {
+        // sendmsg(2) es el writev(2) de los sockets que acepta MSG_NOSIGNAL.
+        // Los bytes enviados con MSG_ZEROCOPY quedan en el anillo hasta el aviso
+        const size_t  skip = d->zc != NULL ? d->zc->inflight : 0;
+        struct iovec  iov[2];
+        struct msghdr msg = {
+            .msg_iov    = iov,
+            .msg_iovlen = ring_peek_iov(d->wb, skip, iov),
+        };
+        if(zerocopy_wanted(d->zc, d->wb->len - skip)) {
+            if(d->zc->blocked || d->zc->count == ZEROCOPY_PENDING) {
+                // no hay lugar para registrar otro envío: se espera un aviso
+                errno = EAGAIN;
+                return -1;
+            }
+            n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+            if(n > 0) {
+                zerocopy_push(d->zc, n);
+                return n;
+            } else if(n == -1 && errno == ENOBUFS && d->zc->count > 0) {
+                // sin memoria para fijar más páginas: se espera un aviso
+                d->zc->blocked = true;
+                errno = EAGAIN;
+                return n;
+            } else if(!(n == -1 && errno == ENOBUFS)) {
+                return n;
+            }
+            // sin nada pendiente se puede enviar copiando
+        }
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(n > 0) {
+            ring_read_adv(d->wb, n);
+            relay_ring_detach(d->wb);
+        }
+    }
+    return n;
+}
+
+/**
+ * envía por el fd de `d' lo que tiene pendiente y actualiza el estado de las
+ * dos direcciones. Retorna lo mismo que copy_send().
+ */
+static ssize_t
+copy_flush(struct socks5 *s, struct copy *d) {
+    const ssize_t n = copy_send(d, *d->fd);
+    
+    if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        // el socket está lleno: queda esperando OP_WRITE
+    } else if(n == -1) {
+        shutdown(*d->fd, SHUT_WR);
+        d->duplex = INTEREST_OFF(d->duplex, OP_WRITE);
+        if(d->other->fd != NULL && *d->other->fd != -1) {
+            shutdown(*d->other->fd, SHUT_RD);
+            d->other->duplex = INTEREST_OFF(d->other->duplex, OP_READ);
+        }
     } else {
-        return &s->orig.copy;
+        // Métricas
+        if(*d->fd == s->client_fd) {
+            metrics_add_bytes_to_client(n);
+        } else {
+            metrics_add_bytes_to_origin(n);
+            s->bytes_to_origin += n;  // Para logging
+        }
+        
+        copy_shutdown_drained(d);
     }
+    return n;
 }
 
+/** cuántos bytes puede leer copy_recv() en el próximo llamado */
+static size_t
+copy_room(const struct copy *d) {
+    return d->rp != NULL ? d->rp->size - d->rp->len : d->rb->size - d->rb->len;
+}
+
+/**
+ * Lee y reenvía mientras el socket tenga datos y haya lugar, en lugar de
+ * hacer una sola lectura por notificación: una sesión con mucho para leer
+ * no paga una vuelta del selector por cada buffer. El presupuesto por
+ * notificación acota cuánto puede acaparar un solo túnel al resto.
+ */
 static unsigned
 copy_read(struct selector_key *key) {
     struct copy *d = copy_ptr(key);
@@ -1110,28 +2256,60 @@ copy_read(struct selector_key *key) {
         return ERROR;
     }
     
-    size_t   count;
-    uint8_t *ptr = buffer_write_ptr(d->rb, &count);
-    ssize_t  n   = recv(key->fd, ptr, count, 0);
+    struct socks5 *s = ATTACHMENT(key);
+    size_t total = 0;
     
-    if(n <= 0) {
-        // EOF o error: cerrar esta dirección
-        shutdown(*d->fd, SHUT_RD);
-        d->duplex = INTEREST_OFF(d->duplex, OP_READ);
-        if(d->other->fd != NULL && *d->other->fd != -1) {
-            shutdown(*d->other->fd, SHUT_WR);
-            d->other->duplex = INTEREST_OFF(d->other->duplex, OP_WRITE);
+    for(unsigned i = 0; i < COPY_READ_ITERATIONS && total < COPY_READ_BUDGET; i++) {
+        const size_t  room = copy_room(d);
+        const ssize_t n    = copy_recv(d, key->fd);
+        
+        if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // no hay (más) datos: se vuelve a intentar en la próxima
+            break;
+        } else if(n <= 0) {
+            // EOF o error: cerrar esta dirección. Si quedan bytes pendientes
+            // hacia el otro extremo, el SHUT_WR lo hace copy_write al vaciarlos.
+            shutdown(*d->fd, SHUT_RD);
+            d->duplex = INTEREST_OFF(d->duplex, OP_READ);
+            if(d->other->fd != NULL && *d->other->fd != -1
+               && !copy_pending(d->other)) {
+                shutdown(*d->other->fd, SHUT_WR);
+                d->other->duplex = INTEREST_OFF(d->other->duplex, OP_WRITE);
+            }
+            break;
+        }
+        
+        total += n;
+        // rb es el wb del otro extremo: si tiene bytes fijados no se mueve
+        if(d->rp == NULL && !ring_can_write(d->rb) && !copy_pinned(d->other)) {
+            copy_ring_grow(d->rb);
+        }
+        
+        // Cut-through: el otro extremo casi siempre acepta los datos ya, y
+        // enviarlos ahora ahorra una vuelta del selector y los cambios de
+        // interés. Solo si no puede con todo queda esperando OP_WRITE (o,
+        // con MSG_ZEROCOPY, los avisos que liberen lugar).
+        if((d->other->duplex & OP_WRITE) && *d->other->fd != -1
+           && copy_can_drain(d->other)) {
+            copy_flush(s, d->other);
         }
-    } else {
-        buffer_write_adv(d->rb, n);
+        
+        // una lectura corta vació el socket; sin lugar hay que esperar al
+        // otro extremo
+        if((size_t) n < room || !copy_can_fill(d) || !(d->duplex & OP_READ)) {
+            break;
+        }
+    }
+    
+    if(total > 0) {
+        copy_deadline(key->s, s);
         
         // Métricas
-        struct socks5 *s = ATTACHMENT(key);
         if(key->fd == s->client_fd) {
-            metrics_add_bytes_from_client(n);
+            metrics_add_bytes_from_client(total);
         } else {
-            metrics_add_bytes_from_origin(n);
-            s->bytes_from_origin += n;  // Para logging
+            metrics_add_bytes_from_origin(total);
+            s->bytes_from_origin += total;  // Para logging
         }
     }
     
@@ -1153,28 +2331,9 @@ copy_write(struct selector_key *key) {
         return ERROR;
     }
     
-    size_t   count;
-    uint8_t *ptr = buffer_read_ptr(d->wb, &count);
-    ssize_t  n   = send(key->fd, ptr, count, MSG_NOSIGNAL);
-    
-    if(n == -1) {
-        shutdown(*d->fd, SHUT_WR);
-        d->duplex = INTEREST_OFF(d->duplex, OP_WRITE);
-        if(d->other->fd != NULL && *d->other->fd != -1) {
-            shutdown(*d->other->fd, SHUT_RD);
-            d->other->duplex = INTEREST_OFF(d->other->duplex, OP_READ);
-        }
-    } else {
-        buffer_read_adv(d->wb, n);
-        
-        // Métricas
-        struct socks5 *s = ATTACHMENT(key);
-        if(key->fd == s->client_fd) {
-            metrics_add_bytes_to_client(n);
-        } else {
-            metrics_add_bytes_to_origin(n);
-            s->bytes_to_origin += n;  // Para logging
-        }
+    struct socks5 *s = ATTACHMENT(key);
+    if(copy_flush(s, d) > 0) {
+        copy_deadline(key->s, s);
     }
     
     copy_compute_interests(key->s, d);
@@ -1187,6 +2346,76 @@ copy_write(struct selector_key *key) {
     return COPY;
 }
 
+/**
+ * el túnel estuvo inactivo. Si todavía tiene buffers grandes (ver
+ * copy_deadline) los devuelve y espera el resto del plazo; si no, el plazo
+ * de inactividad venció y se cierra.
+ */
+static unsigned
+copy_timeout(struct selector_key *key) {
+    struct socks5 *s = ATTACHMENT(key);
+    const unsigned idle = socks5_args.idle_timeout;
+
+    if(!s->quiet && copy_rings_grown(s) && (idle == 0 || idle > RELAY_QUIET)) {
+        ring_buffer *const rings[] = { &s->read_ring, &s->write_ring };
+        const struct zerocopy *const pins[] = {
+            s->zc == NULL ? NULL : &s->zc->read,
+            s->zc == NULL ? NULL : &s->zc->write,
+        };
+        for(unsigned i = 0; i < N(rings); i++) {
+            if(rings[i]->size != BUFFER_SIZE && rings[i]->len <= BUFFER_SIZE
+               && (pins[i] == NULL || pins[i]->count == 0)) {
+                relay_ring_resize(rings[i], BUFFER_SIZE);
+            }
+        }
+        s->quiet = true;
+        session_deadline(key->s, s, idle == 0 ? 0 : idle - RELAY_QUIET);
+        return COPY;
+    }
+    return DONE;
+}
+
+/** llegaron avisos de MSG_ZEROCOPY a la cola de errores del socket */
+static unsigned
+copy_error(struct selector_key *key) {
+    struct copy *d = copy_ptr(key);
+
+    if(d == NULL || *d->fd == -1) {
+        return ERROR;
+    }
+
+    if(d->zc != NULL && zerocopy_reap(d->zc, d->wb, key->fd)) {
+        copy_shutdown_drained(d);
+    }
+
+    copy_compute_interests(key->s, d);
+    copy_compute_interests(key->s, d->other);
+
+    if(d->duplex == OP_NOOP && d->other->duplex == OP_NOOP) {
+        return DONE;
+    }
+
+    return COPY;
+}
+
+/**
+ * procesa los avisos de MSG_ZEROCOPY que ya llegaron antes de cerrar los
+ * sockets: si el envío falló (RST, por ejemplo) el kernel ya liberó todo y
+ * los anillos pueden volver al pool.
+ */
+static void
+copy_zerocopy_close(struct socks5 *s) {
+    if(s->zc == NULL) {
+        return;
+    }
+    if(s->zc->write.count > 0 && s->client_fd != -1) {
+        zerocopy_reap(&s->zc->write, &s->write_ring, s->client_fd);
+    }
+    if(s->zc->read.count > 0 && s->origin_fd != -1) {
+        zerocopy_reap(&s->zc->read, &s->read_ring, s->origin_fd);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // TABLA DE ESTADOS
 ////////////////////////////////////////////////////////////////////////////////
@@ -1197,47 +2426,57 @@ static const struct state_definition socks5_state_handlers[ERROR + 1] = {
         .on_arrival     = hello_read_init,
         .on_departure   = hello_read_close,
         .on_read_ready  = hello_read,
+        .on_timeout     = handshake_timeout,
     },
     {
         .state          = HELLO_WRITE,
         .on_write_ready = hello_write,
+        .on_timeout     = handshake_timeout,
     },
     {
         .state          = AUTH_READ,
         .on_arrival     = auth_read_init,
         .on_departure   = auth_read_close,
         .on_read_ready  = auth_read,
+        .on_timeout     = handshake_timeout,
     },
     {
         .state          = AUTH_WRITE,
         .on_write_ready = auth_write,
+        .on_timeout     = handshake_timeout,
     },
     {
         .state          = REQUEST_READ,
         .on_arrival     = request_read_init,
         .on_departure   = request_read_close,
         .on_read_ready  = request_read,
+        .on_timeout     = handshake_timeout,
     },
     {
         .state          = REQUEST_RESOLVING,
         .on_arrival     = request_resolving_init,
         .on_block_ready = request_resolving_done,
+        .on_timeout     = request_resolving_timeout,
     },
     {
         .state          = REQUEST_CONNECTING,
-        .on_arrival     = connecting_init,
         .on_write_ready = connecting_write,
+        .on_timeout     = connecting_timeout,
     },
     {
         .state          = REQUEST_WRITE,
         .on_arrival     = request_write_init,
         .on_write_ready = request_write,
+        .on_block_ready = request_write_block,
+        .on_timeout     = request_write_timeout,
     },
     {
         .state          = COPY,
         .on_arrival     = copy_init,
         .on_read_ready  = copy_read,
         .on_write_ready = copy_write,
+        .on_timeout     = copy_timeout,
+        .on_error_ready = copy_error,
     },
     {
         .state          = DONE,
@@ -1251,24 +2490,30 @@ static const struct state_definition socks5_state_handlers[ERROR + 1] = {
 // HANDLERS TOP-LEVEL
 ////////////////////////////////////////////////////////////////////////////////
 
-void
-socksv5_passive_accept(struct selector_key *key) {
+/**
+ * acepta una conexión del socket pasivo y le arma su sesión. Retorna false
+ * cuando no conviene seguir aceptando (backlog vacío o error).
+ */
+static bool
+passive_accept_one(struct selector_key *key) {
     struct sockaddr_storage       client_addr;
     socklen_t                     client_addr_len = sizeof(client_addr);
     struct socks5                *state           = NULL;
 
-    const int client = accept(key->fd, (struct sockaddr*) &client_addr,
-                                                          &client_addr_len);
+    const int client = accept4(key->fd, (struct sockaddr*) &client_addr,
+                               &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if(client == -1) {
-        goto fail;
-    }
-    if(selector_fd_set_nio(client) == -1) {
-        goto fail;
+        // el cliente abandonó antes de ser aceptado: puede haber más atrás
+        return errno == ECONNABORTED || errno == EINTR;
     }
     state = socks5_new(client);
     if(state == NULL) {
         goto fail;
     }
+    // los sockets pasivos son IPv4 o IPv6: la dirección entra en la sesión
+    if(client_addr_len > sizeof(state->client_addr)) {
+        client_addr_len = sizeof(state->client_addr);
+    }
     memcpy(&state->client_addr, &client_addr, client_addr_len);
     state->client_addr_len = client_addr_len;
 
@@ -1278,19 +2523,24 @@ socksv5_passive_accept(struct selector_key *key) {
     }
     
     metrics_connection_opened();
+    session_deadline(key->s, state, socks5_args.handshake_timeout);
+    log_connection((struct sockaddr *)&client_addr, client);
     
-    // Log de nueva conexión
-    char buff[SOCKADDR_TO_HUMAN_MIN];
-    fprintf(stdout, "Connection from %s\n", 
-            sockaddr_to_human(buff, sizeof(buff), (struct sockaddr *)&client_addr));
-    
-    return;
+    return true;
     
 fail:
-    if(client != -1) {
-        close(client);
-    }
+    close(client);
     socks5_destroy(state);
+    return false;
+}
+
+void
+socksv5_passive_accept(struct selector_key *key) {
+    // el selector es level-triggered: lo que quede en el backlog vuelve a
+    // notificarse en la próxima vuelta, después de atender al resto
+    for(unsigned i = 0; i < ACCEPT_BATCH && passive_accept_one(key); i++) {
+        // nada
+    }
 }
 
 static void
@@ -1323,6 +2573,26 @@ socksv5_block(struct selector_key *key) {
     }
 }
 
+static void
+socksv5_timeout(struct selector_key *key) {
+    struct state_machine *stm = &ATTACHMENT(key)->stm;
+    const enum socks_v5state st = stm_handler_timeout(stm, key);
+
+    if(ERROR == st || DONE == st) {
+        socksv5_done(key);
+    }
+}
+
+static void
+socksv5_error(struct selector_key *key) {
+    struct state_machine *stm = &ATTACHMENT(key)->stm;
+    const enum socks_v5state st = stm_handler_error(stm, key);
+
+    if(ERROR == st || DONE == st) {
+        socksv5_done(key);
+    }
+}
+
 static void
 socksv5_close(struct selector_key *key) {
     socks5_destroy(ATTACHMENT(key));
@@ -1333,11 +2603,11 @@ socksv5_done(struct selector_key *key) {
     struct socks5 *s = ATTACHMENT(key);
     
     // Registrar acceso antes de cerrar
-    if(s->dest_addr_str[0] != '\0') {
+    if(s->dest != NULL) {
         log_access(
-            s->username[0] ? s->username : NULL,
+            s->username,
             (struct sockaddr *)&s->client_addr,
-            s->dest_addr_str,
+            s->dest,
             s->dest_port,
             s->last_status,
             s->bytes_to_origin,
@@ -1345,6 +2615,14 @@ socksv5_done(struct selector_key *key) {
         );
     }
     
+    copy_zerocopy_close(s);
+
+    // intentos de conexión que seguían en carrera; cada uno tiene su
+    // referencia, así que la sesión sigue viva
+    while(s->hs != NULL && s->hs->conn.count > 0) {
+        connecting_drop(key->s, s, s->hs->conn.fds[s->hs->conn.count - 1]);
+    }
+
     const int fds[] = {
         s->client_fd,
         s->origin_fd,
@@ -1364,5 +2642,7 @@ socksv5_done(struct selector_key *key) {
 
 unsigned
 socksv5_get_connection_count(void) {
-    return metrics_get()->current_connections;
+    struct socks5_metrics m;
+    metrics_snapshot(&m);
+    return m.current_connections;
 }
@@ -0,0 +1,1258 @@
+#!/bin/bash
+#
+# test_bench.sh - Benchmarks de rendimiento del servidor SOCKSv5
+# ITBA - Protocolos de Comunicación 2025/2
+#
+# Uso: ./test_bench.sh [benchmark]...
+#
+#   idle       Costo de CPU por ida y vuelta de una sesión activa en función
+#              de la cantidad de sesiones ociosas (costo por despertar del
+#              selector).
+#   teardown   Costo de cerrar de golpe muchas sesiones (cliente que se cae
+#              con todas sus conexiones abiertas).
+#   echo       Latencia y CPU del servidor por ida y vuelta de pedido/respuesta
+#              por una sesión, para cada tamaño de ECHO_SIZES.
+#   memory     Memoria residente del servidor con muchas sesiones ociosas en
+#              COPY que ya intercambiaron algunos bytes.
+#   accept     Conexiones por segundo que el servidor acepta y atiende
+#              (hasta el HELLO) ante una avalancha de conexiones, y CPU del
+#              servidor por conexión.
+#   hello      CPU del servidor por conexión desde el accept hasta responder
+#              el HELLO, la mejor y la mediana de HELLO_RUNS avalanchas de
+#              HELLO_CONNECTIONS conexiones, para cada binario de
+#              HELLO_BINARIES (para comparar contra otra versión).
+#   churn      Tasa y CPU de la primera avalancha de conexiones tras
+#              iniciar, y memoria con CHURN_SESSIONS sesiones y tras
+#              liberarlas, en CHURN_ROUNDS rondas, para cada modo de
+#              CHURN_MODES (lazy: sin reservar; prealloc: -A; hugepages:
+#              -A -H).
+#   footprint  Memoria residente por sesión con FOOTPRINT_SESSIONS sesiones
+#              detenidas en la negociación (tras el HELLO) y en COPY, para
+#              cada binario de FOOTPRINT_BINARIES (para comparar contra otra
+#              versión).
+#   resolve    Latencia (mediana, p99 y máxima) desde el pedido CONNECT a un
+#              nombre hasta la respuesta, para avalanchas de RESOLVE_BURSTS
+#              pedidos simultáneos, con los rechazados y el pico de hilos
+#              del servidor, para cada binario de RESOLVE_BINARIES.
+#   dns        Lo mismo que resolve pero con un nombre distinto por pedido,
+#              contra un servidor de nombres de prueba que responde a los
+#              DNS_DELAY_MS ms, para cada modo de DNS_MODES (loop: el
+#              cliente DNS de cada worker, con -n; pool: getaddrinfo en
+#              hilos, con -D). El modo pool consulta a /etc/resolv.conf: el
+#              servidor de prueba escucha en DNS_STUB_PORT (por defecto 53,
+#              requiere root) y resolv.conf debe apuntar a 127.0.0.1.
+#   dnscache   Latencia de DNSCACHE_REQUESTS pedidos simultáneos repartidos
+#              entre DNSCACHE_NAMES nombres, contra el mismo servidor de
+#              nombres con demora de dns: la primera avalancha (caché frío)
+#              y una segunda (caché caliente), con el caché (on) y sin él
+#              (off: -C 0), para cada modo de DNSCACHE_MODES.
+#   fanout     Latencia de FANOUT_CONNECTIONS pedidos simultáneos al mismo
+#              nombre (uno nuevo en cada avalancha, sin caché) y cuántas
+#              preguntas recibió el servidor de nombres de dns, para cada
+#              modo de DNS_MODES y cada binario de FANOUT_BINARIES.
+#   prefetch   Latencia de PREFETCH_RATE pedidos por segundo, uno tras otro,
+#              repartidos entre PREFETCH_NAMES nombres con TTL de
+#              PREFETCH_TTL s durante PREFETCH_SECONDS s, contra el servidor
+#              de nombres de dns, sin renovar los nombres antes de que venzan
+#              (off: -F 0) y renovándolos (on: -F PREFETCH_HOT -W
+#              PREFETCH_WINDOW), con las preguntas al servidor de nombres y
+#              las renovaciones usadas y desperdiciadas.
+#   eyeballs   Latencia de EYEBALLS_CONNECTIONS pedidos simultáneos a nombres
+#              con dirección IPv4 e IPv6, contra el servidor de nombres de
+#              dns, cuando el puerto EYEBALLS_PORT no responde en ::1 (la
+#              cola del listen llena descarta los SYN) y tiene eco en
+#              127.0.0.1, para cada binario de EYEBALLS_BINARIES.
+#   relay      CPU del servidor por GB retransmitido y throughput, con cada
+#              multiplexor de RELAY_BACKENDS y cada modo de RELAY_MODES
+#              (buffers: recv/send; splice: -S -N; zerocopy: -Z con
+#              ZEROCOPY_KB). En loopback el kernel copia igual los envíos
+#              con MSG_ZEROCOPY y el modo zerocopy mide lo que cuesta
+#              intentarlo; la ganancia solo aparece hacia una interfaz real.
+#
+# Sin argumentos se ejecutan todos. El costo de CPU se mide sobre el proceso
+# socks5d (utime + stime de /proc/<pid>/stat), así la carga que generan los
+# clientes de prueba no contamina el resultado.
+#
+
+# Colores para output
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+BLUE='\033[0;34m'
+YELLOW='\033[1;33m'
+NC='\033[0m'
+
+# Configuración
+PROXY_PORT="${PROXY_PORT:-1080}"
+MONITOR_PORT="${MONITOR_PORT:-8080}"
+TEST_USER="bench"
+TEST_PASS="bench123"
+ECHO_PORT="9997"
+DISCARD_PORT="9996"
+RESULTS_FILE="bench_results.txt"
+LOG_FILE="bench_server.log"
+BENCH_DIR="$(mktemp -d /tmp/socks5_bench.XXXXXX)"
+HELPER="$BENCH_DIR/helper.py"
+
+# Parámetros de cada benchmark (se pueden pisar desde el entorno)
+IDLE_LEVELS="${IDLE_LEVELS:-0 1000 4000 8000}"
+IDLE_ROUNDTRIPS="${IDLE_ROUNDTRIPS:-20000}"
+# 20000 sesiones = 40000 fds en el servidor: ajustar a `ulimit -Hn'
+TEARDOWN_SESSIONS="${TEARDOWN_SESSIONS:-20000}"
+ECHO_SIZES="${ECHO_SIZES:-64 1024 16384}"
+ECHO_ROUNDTRIPS="${ECHO_ROUNDTRIPS:-20000}"
+# 50000 sesiones = 100000 fds en el servidor: ajustar a `ulimit -Hn'
+MEMORY_SESSIONS="${MEMORY_SESSIONS:-50000}"
+ACCEPT_CONNECTIONS="${ACCEPT_CONNECTIONS:-20000}"
+ACCEPT_BURSTS="${ACCEPT_BURSTS:-64 1024}"
+HELLO_CONNECTIONS="${HELLO_CONNECTIONS:-20000}"
+HELLO_RUNS="${HELLO_RUNS:-5}"
+HELLO_BINARIES="${HELLO_BINARIES:-./bin/socks5d}"
+CHURN_SESSIONS="${CHURN_SESSIONS:-5000}"
+CHURN_ROUNDS="${CHURN_ROUNDS:-3}"
+CHURN_MODES="${CHURN_MODES:-lazy prealloc hugepages}"
+FOOTPRINT_SESSIONS="${FOOTPRINT_SESSIONS:-8000}"
+FOOTPRINT_BINARIES="${FOOTPRINT_BINARIES:-./bin/socks5d}"
+RESOLVE_BURSTS="${RESOLVE_BURSTS:-200 2000}"
+RESOLVE_HOST="${RESOLVE_HOST:-localhost}"
+RESOLVE_BINARIES="${RESOLVE_BINARIES:-./bin/socks5d}"
+DNS_BURSTS="${DNS_BURSTS:-200 2000}"
+DNS_DELAY_MS="${DNS_DELAY_MS:-20}"
+DNS_MODES="${DNS_MODES:-loop pool}"
+DNS_STUB_PORT="${DNS_STUB_PORT:-53}"
+DNSCACHE_REQUESTS="${DNSCACHE_REQUESTS:-2000}"
+DNSCACHE_NAMES="${DNSCACHE_NAMES:-100}"
+DNSCACHE_MODES="${DNSCACHE_MODES:-off on}"
+FANOUT_CONNECTIONS="${FANOUT_CONNECTIONS:-50 500}"
+FANOUT_BINARIES="${FANOUT_BINARIES:-./bin/socks5d}"
+PREFETCH_NAMES="${PREFETCH_NAMES:-20}"
+PREFETCH_TTL="${PREFETCH_TTL:-2}"
+PREFETCH_RATE="${PREFETCH_RATE:-200}"
+PREFETCH_SECONDS="${PREFETCH_SECONDS:-10}"
+PREFETCH_HOT="${PREFETCH_HOT:-3}"
+PREFETCH_WINDOW="${PREFETCH_WINDOW:-10}"
+EYEBALLS_CONNECTIONS="${EYEBALLS_CONNECTIONS:-20}"
+EYEBALLS_PORT="${EYEBALLS_PORT:-9995}"
+EYEBALLS_BINARIES="${EYEBALLS_BINARIES:-./bin/socks5d}"
+RELAY_MB="${RELAY_MB:-1024}"
+RELAY_STREAMS="${RELAY_STREAMS:-1 16}"
+RELAY_BACKENDS="${RELAY_BACKENDS:-epoll io_uring}"
+RELAY_MODES="${RELAY_MODES:-buffers splice zerocopy}"
+ZEROCOPY_KB="${ZEROCOPY_KB:-16}"
+
+SERVER_BIN="./bin/socks5d"
+SERVER_PID=""
+ECHO_PID=""
+DISCARD_PID=""
+CLK_TCK=$(getconf CLK_TCK)
+
+print_header() {
+    echo -e "\n${BLUE}═══════════════════════════════════════════════════════════════${NC}"
+    echo -e "${BLUE}  $1${NC}"
+    echo -e "${BLUE}═══════════════════════════════════════════════════════════════${NC}\n"
+}
+
+print_result() {
+    if [ "$2" == "OK" ]; then
+        echo -e "  ${GREEN}✓${NC} $1"
+    elif [ "$2" == "WARN" ]; then
+        echo -e "  ${YELLOW}⚠${NC} $1"
+    else
+        echo -e "  ${RED}✗${NC} $1"
+    fi
+}
+
+cleanup() {
+    echo -e "\n${YELLOW}Limpiando...${NC}"
+    [ -n "$SERVER_PID" ] && kill $SERVER_PID 2>/dev/null
+    [ -n "$ECHO_PID" ] && kill $ECHO_PID 2>/dev/null
+    [ -n "$DISCARD_PID" ] && kill $DISCARD_PID 2>/dev/null
+    jobs -p | xargs -r kill 2>/dev/null
+    rm -rf "$BENCH_DIR"
+}
+
+trap cleanup EXIT
+
+# Cliente/servidor de prueba. Python permite sostener miles de sesiones
+# desde un solo proceso, cosa que curl/nc no pueden.
+write_helper() {
+    cat > "$HELPER" << 'EOF'
+import os, selectors, socket, struct, sys, time
+
+def listener(port, addr='127.0.0.1', backlog=4096):
+    l = socket.socket(socket.AF_INET6 if ':' in addr else socket.AF_INET)
+    l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if ':' in addr:
+        l.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_V6ONLY, 1)
+    l.bind((addr, port))
+    l.listen(backlog)
+    l.setblocking(False)
+    return l
+
+def echo_server(port, echo=True, addr='127.0.0.1'):
+    """servidor de eco (o de descarte) no bloqueante que sostiene miles de
+    conexiones"""
+    sel = selectors.DefaultSelector()
+    l = listener(port, addr)
+    sel.register(l, selectors.EVENT_READ)
+    while True:
+        for k, _ in sel.select():
+            if k.fileobj is l:
+                try:
+                    c, _ = l.accept()
+                except OSError:
+                    continue
+                c.setblocking(False)
+                sel.register(c, selectors.EVENT_READ)
+            else:
+                try:
+                    d = k.fileobj.recv(65536)
+                except OSError:
+                    d = b''
+                if d:
+                    try:
+                        if echo:
+                            k.fileobj.sendall(d)
+                    except OSError:
+                        pass
+                else:
+                    sel.unregister(k.fileobj)
+                    k.fileobj.close()
+
+def socks_connect(proxy, user, pwd, port):
+    """abre una sesión SOCKS5 autenticada hasta llegar a COPY"""
+    s = socket.create_connection(('127.0.0.1', proxy))
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    s.sendall(b'\x05\x01\x02')
+    if s.recv(2) != b'\x05\x02':
+        raise RuntimeError('hello')
+    u, p = user.encode(), pwd.encode()
+    s.sendall(bytes([1, len(u)]) + u + bytes([len(p)]) + p)
+    if s.recv(2) != b'\x01\x00':
+        raise RuntimeError('auth')
+    s.sendall(b'\x05\x01\x00\x01' + socket.inet_aton('127.0.0.1')
+              + struct.pack('>H', port))
+    r = s.recv(10)
+    if len(r) < 2 or r[1] != 0:
+        raise RuntimeError('request')
+    return s
+
+def hold(proxy, user, pwd, port, n, ping=0):
+    """abre n sesiones ociosas y las mantiene hasta recibir una señal. Con
+    ping > 0 cada una hace antes una ida y vuelta de ping bytes"""
+    socks = [socks_connect(proxy, user, pwd, port) for _ in range(n)]
+    for s in socks if ping > 0 else []:
+        s.sendall(b'x' * ping)
+        got = 0
+        while got < ping:
+            got += len(s.recv(ping - got))
+    print('ready %d' % len(socks), flush=True)
+    while True:
+        time.sleep(3600)
+
+def park(proxy, n):
+    """abre n conexiones que se quedan en la negociación justo después del
+    HELLO, hasta recibir una señal"""
+    socks = []
+    for _ in range(n):
+        s = socket.create_connection(('127.0.0.1', proxy))
+        s.sendall(b'\x05\x01\x02')
+        socks.append(s)
+    for s in socks:
+        if s.recv(2) != b'\x05\x02':
+            raise RuntimeError('hello')
+    print('ready %d' % len(socks), flush=True)
+    while True:
+        time.sleep(3600)
+
+def resolve_burst(proxy, user, pwd, port, n, host, pid, names=0):
+    """negocia n sesiones, manda a la vez n CONNECT a `host' (con %d, un
+    nombre distinto por sesión, o uno de `names' si no es 0) y mide cuánto
+    tarda cada respuesta. Imprime mediana, p99 y máxima (ms), los pedidos
+    rechazados y el pico de hilos del proceso `pid'"""
+    import threading
+    socks = []
+    u, p = user.encode(), pwd.encode()
+    for _ in range(n):
+        s = socket.create_connection(('127.0.0.1', proxy))
+        s.sendall(b'\x05\x01\x02')
+        if s.recv(2) != b'\x05\x02':
+            raise RuntimeError('hello')
+        s.sendall(bytes([1, len(u)]) + u + bytes([len(p)]) + p)
+        if s.recv(2) != b'\x01\x00':
+            raise RuntimeError('auth')
+        socks.append(s)
+
+    peak, sampling = [0], [True]
+    def sample():
+        while sampling[0]:
+            with open('/proc/%d/status' % pid) as f:
+                for line in f:
+                    if line.startswith('Threads:'):
+                        peak[0] = max(peak[0], int(line.split()[1]))
+            time.sleep(0.002)
+    sampler = threading.Thread(target=sample)
+    sampler.start()
+
+    sel = selectors.DefaultSelector()
+    start = {}
+    for i, s in enumerate(socks):
+        h = (host % (i % names if names else i) if '%d' in host else host).encode()
+        req = b'\x05\x01\x00\x03' + bytes([len(h)]) + h + struct.pack('>H', port)
+        start[s] = time.perf_counter()
+        s.sendall(req)
+        sel.register(s, selectors.EVENT_READ)
+    lat, rejected = [], 0
+    while len(lat) + rejected < n:
+        events = sel.select(30)
+        if not events:
+            rejected += n - len(lat) - rejected
+            break
+        for k, _ in events:
+            s = k.fileobj
+            r = s.recv(2)
+            sel.unregister(s)
+            if len(r) == 2 and r[1] == 0:
+                lat.append(time.perf_counter() - start[s])
+            else:
+                rejected += 1
+    sampling[0] = False
+    sampler.join()
+    for s in socks:
+        s.close()
+    lat.sort()
+    pct = lambda q: lat[min(len(lat) - 1, int(q * len(lat)))] * 1e3 if lat else 0
+    print('%.2f %.2f %.2f %d %d' % (pct(0.5), pct(0.99), pct(1), rejected, peak[0]))
+
+def blackhole(port, addr='127.0.0.1'):
+    """puerto de `addr' que no contesta: con la cola del listen llena el
+    kernel descarta los SYN y el connect(2) queda esperando"""
+    l = listener(port, addr, backlog=0)
+    fillers = []
+    for _ in range(8):
+        c = socket.socket(l.family)
+        c.setblocking(False)
+        c.connect_ex((addr, port))
+        fillers.append(c)
+    while True:
+        time.sleep(3600)
+
+def dns_stub(port, delay_ms, count_file=None, ttl=60, v6=False):
+    """servidor de nombres que responde cualquier A con 127.0.0.1 y TTL
+    `ttl' (y AAAA sin direcciones, o con ::1 si `v6') a los `delay_ms' ms,
+    sin bloquearse mientras espera. Si se indica, lleva en `count_file'
+    cuántas preguntas recibió"""
+    import collections
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    for opt in (33, socket.SO_RCVBUF):   # SO_RCVBUFFORCE, si se puede
+        try:
+            udp.setsockopt(socket.SOL_SOCKET, opt, 8 << 20)
+            break
+        except OSError:
+            pass
+    udp.bind(('127.0.0.1', port))
+    udp.setblocking(False)
+    a = socket.inet_aton('127.0.0.1')
+    a6 = socket.inet_pton(socket.AF_INET6, '::1')
+    pending = collections.deque()
+    count = 0
+    sel = selectors.DefaultSelector()
+    sel.register(udp, selectors.EVENT_READ)
+    while True:
+        wait = None
+        if pending:
+            wait = max(0, pending[0][0] - time.monotonic())
+        if sel.select(wait):
+            while True:
+                try:
+                    q, addr = udp.recvfrom(512)
+                except BlockingIOError:
+                    break
+                off = 12
+                while off < len(q) and q[off]:
+                    off += 1 + q[off]
+                qtype = struct.unpack('>H', q[off + 1:off + 3])[0]
+                an = b''
+                if qtype == 1:
+                    an = b'\xc0\x0c' + struct.pack('>HHIH', 1, 1, int(ttl), 4) + a
+                elif qtype == 28 and v6:
+                    an = b'\xc0\x0c' + struct.pack('>HHIH', 28, 1, int(ttl), 16) + a6
+                r = q[:2] + struct.pack('>HHHHH', 0x8180, 1, 1 if an else 0, 0, 0) \
+                    + q[12:off + 5] + an
+                pending.append((time.monotonic() + delay_ms / 1e3, r, addr))
+                count += 1
+            if count_file:
+                with open(count_file + '.tmp', 'w') as f:
+                    f.write('%d\n' % count)
+                os.replace(count_file + '.tmp', count_file)
+        now = time.monotonic()
+        while pending and pending[0][0] <= now:
+            _, r, addr = pending.popleft()
+            udp.sendto(r, addr)
+
+def steady(proxy, user, pwd, port, host, names, rate, seconds):
+    """durante `seconds' s, `rate' pedidos CONNECT por segundo, uno tras
+    otro, a uno de los `names' nombres de `host' (con %d) por vez. Imprime
+    pedidos, mediana, p99 y máxima (ms) desde el CONNECT hasta la respuesta
+    y los rechazados"""
+    u, p = user.encode(), pwd.encode()
+    lat, rejected, i = [], 0, 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        next_at = start + i / rate
+        now = time.perf_counter()
+        if next_at > now:
+            time.sleep(next_at - now)
+        s = socket.create_connection(('127.0.0.1', proxy))
+        s.sendall(b'\x05\x01\x02')
+        if s.recv(2) != b'\x05\x02':
+            raise RuntimeError('hello')
+        s.sendall(bytes([1, len(u)]) + u + bytes([len(p)]) + p)
+        if s.recv(2) != b'\x01\x00':
+            raise RuntimeError('auth')
+        h = (host % (i % names)).encode()
+        t = time.perf_counter()
+        s.sendall(b'\x05\x01\x00\x03' + bytes([len(h)]) + h + struct.pack('>H', port))
+        r = s.recv(2)
+        if len(r) == 2 and r[1] == 0:
+            lat.append(time.perf_counter() - t)
+        else:
+            rejected += 1
+        s.close()
+        i += 1
+    lat.sort()
+    pct = lambda q: lat[min(len(lat) - 1, int(q * len(lat)))] * 1e3 if lat else 0
+    print('%d %.2f %.2f %.2f %d' % (i, pct(0.5), pct(0.99), pct(1), rejected))
+
+def pingpong(proxy, user, pwd, port, count, size=64):
+    """count idas y vueltas de `size' bytes por una sola sesión"""
+    s = socks_connect(proxy, user, pwd, port)
+    msg = b'x' * size
+    t = time.perf_counter()
+    for _ in range(count):
+        s.sendall(msg)
+        got = 0
+        while got < size:
+            got += len(s.recv(size - got))
+    dt = time.perf_counter() - t
+    s.close()
+    print('%.1f' % (dt / count * 1e6))
+
+def storm(proxy, n, burst):
+    """abre n conexiones, con hasta `burst' en vuelo a la vez, y espera la
+    respuesta al HELLO de cada una"""
+    sel = selectors.DefaultSelector()
+    opened = ok = failed = 0
+    t = time.perf_counter()
+    while ok + failed < n:
+        while opened < n and opened - ok - failed < burst:
+            s = socket.socket()
+            s.setblocking(False)
+            s.connect_ex(('127.0.0.1', proxy))
+            sel.register(s, selectors.EVENT_WRITE)
+            opened += 1
+        events = sel.select(5)
+        if not events:
+            failed += opened - ok - failed
+            break
+        for k, ev in events:
+            s = k.fileobj
+            try:
+                if ev & selectors.EVENT_WRITE:
+                    s.send(b'\x05\x01\x02')
+                    sel.modify(s, selectors.EVENT_READ)
+                    continue
+                done = s.recv(2)[:1] == b'\x05'
+            except OSError:
+                done = False
+            sel.unregister(s)
+            s.close()
+            if done:
+                ok += 1
+            else:
+                failed += 1
+    dt = time.perf_counter() - t
+    print('%.0f %d' % (ok / dt, failed))
+
+def blast(proxy, user, pwd, port, mb, streams):
+    """envía mb MB por cada una de `streams' sesiones en paralelo"""
+    socks = [socks_connect(proxy, user, pwd, port) for _ in range(streams)]
+    chunk = memoryview(b'x' * 65536)
+    left = {}
+    sel = selectors.DefaultSelector()
+    for s in socks:
+        s.setblocking(False)
+        left[s] = mb * 1024 * 1024
+        sel.register(s, selectors.EVENT_WRITE)
+    while left:
+        for k, _ in sel.select():
+            s = k.fileobj
+            try:
+                n = s.send(chunk[:min(len(chunk), left[s])])
+            except BlockingIOError:
+                continue
+            left[s] -= n
+            if left[s] == 0:
+                sel.unregister(s)
+                s.close()
+                del left[s]
+
+if __name__ == '__main__':
+    cmd, args = sys.argv[1], sys.argv[2:]
+    if cmd == 'echo':
+        echo_server(int(args[0]), True, *args[1:])
+    elif cmd == 'blackhole':
+        blackhole(int(args[0]), *args[1:])
+    elif cmd == 'discard':
+        echo_server(int(args[0]), echo=False)
+    elif cmd == 'storm':
+        storm(int(args[0]), int(args[1]), int(args[2]))
+    elif cmd == 'blast':
+        blast(int(args[0]), args[1], args[2], int(args[3]), int(args[4]),
+              int(args[5]))
+    elif cmd == 'hold':
+        hold(int(args[0]), args[1], args[2], int(args[3]), int(args[4]),
+             *map(int, args[5:]))
+    elif cmd == 'park':
+        park(int(args[0]), int(args[1]))
+    elif cmd == 'resolve':
+        resolve_burst(int(args[0]), args[1], args[2], int(args[3]),
+                      int(args[4]), args[5], int(args[6]), *map(int, args[7:]))
+    elif cmd == 'dnsstub':
+        dns_stub(int(args[0]), int(args[1]), *args[2:])
+    elif cmd == 'steady':
+        steady(int(args[0]), args[1], args[2], int(args[3]), args[4],
+               int(args[5]), int(args[6]), int(args[7]))
+    elif cmd == 'pingpong':
+        pingpong(int(args[0]), args[1], args[2], int(args[3]), int(args[4]),
+                 *map(int, args[5:]))
+EOF
+}
+
+# Memoria residente del servidor, en KB
+server_rss_kb() {
+    awk '/^VmRSS/ { print $2 }' /proc/$SERVER_PID/status
+}
+
+# Ticks de CPU consumidos por el servidor hasta el momento
+server_cpu_ticks() {
+    awk '{ print $14 + $15 }' /proc/$SERVER_PID/stat
+}
+
+# Conexiones concurrentes según el servidor de monitoreo
+server_current_connections() {
+    ./bin/socks5_client -P $MONITOR_PORT metrics 2>/dev/null \
+        | awk -F: '/Current connections/ { gsub(/ /, "", $2); print $2 }'
+}
+
+start_echo_server() {
+    python3 "$HELPER" echo $ECHO_PORT > /dev/null 2>&1 &
+    ECHO_PID=$!
+    sleep 1
+    if kill -0 $ECHO_PID 2>/dev/null; then
+        print_result "Servidor de eco en puerto $ECHO_PORT" "OK"
+        return 0
+    fi
+    print_result "Error al iniciar servidor de eco" "FAIL"
+    return 1
+}
+
+start_discard_server() {
+    python3 "$HELPER" discard $DISCARD_PORT > /dev/null 2>&1 &
+    DISCARD_PID=$!
+    sleep 1
+    if kill -0 $DISCARD_PID 2>/dev/null; then
+        print_result "Servidor de descarte en puerto $DISCARD_PORT" "OK"
+        return 0
+    fi
+    print_result "Error al iniciar servidor de descarte" "FAIL"
+    return 1
+}
+
+start_server() {
+    cd "$(dirname "$0")"
+
+    if [ ! -f "$SERVER_BIN" ]; then
+        echo "Compilando..."
+        make all > /dev/null 2>&1
+    fi
+
+    "$SERVER_BIN" -p $PROXY_PORT -P $MONITOR_PORT -u $TEST_USER:$TEST_PASS \
+        "$@" > "$LOG_FILE" 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+
+    if kill -0 $SERVER_PID 2>/dev/null; then
+        print_result "Servidor iniciado (PID: $SERVER_PID) $*" "OK"
+        return 0
+    fi
+    print_result "Error al iniciar servidor" "FAIL"
+    return 1
+}
+
+stop_server() {
+    kill $SERVER_PID 2>/dev/null
+    wait $SERVER_PID 2>/dev/null
+    SERVER_PID=""
+}
+
+# Sostiene $1 sesiones ociosas en segundo plano (cada una hace antes una ida
+# y vuelta de $2 bytes, si se indica); deja el PID en HOLD_PID
+start_idle_sessions() {
+    local n=$1
+    local ping=${2:-0}
+    HOLD_PID=""
+    [ "$n" -eq 0 ] && return 0
+
+    python3 "$HELPER" hold $PROXY_PORT $TEST_USER $TEST_PASS $ECHO_PORT $n $ping \
+        > "$BENCH_DIR/hold.out" 2>&1 &
+    HOLD_PID=$!
+    for _ in $(seq 1 120); do
+        grep -q ready "$BENCH_DIR/hold.out" && return 0
+        kill -0 $HOLD_PID 2>/dev/null || break
+        sleep 0.5
+    done
+    HOLD_PID=""
+    return 1
+}
+
+stop_idle_sessions() {
+    [ -n "$HOLD_PID" ] && kill $HOLD_PID 2>/dev/null && wait $HOLD_PID 2>/dev/null
+    # esperar a que el servidor libere las sesiones
+    for _ in $(seq 1 60); do
+        [ "$(server_current_connections)" == "0" ] && break
+        sleep 0.5
+    done
+}
+
+# Benchmark: costo por despertar vs. sesiones ociosas
+bench_idle() {
+    print_header "Benchmark: costo por despertar vs. sesiones ociosas"
+
+    start_server || return 1
+
+    printf "  %-16s %-22s %-20s\n" "Ociosas" "CPU servidor (µs/rt)" "Latencia (µs/rt)"
+    echo "  ──────────────────────────────────────────────────────────"
+    echo "idle: ociosas cpu_us_por_rt latencia_us_por_rt" >> "$RESULTS_FILE"
+
+    for n in $IDLE_LEVELS; do
+        if ! start_idle_sessions $n; then
+            print_result "No se pudieron abrir $n sesiones ociosas" "FAIL"
+            break
+        fi
+
+        local before=$(server_cpu_ticks)
+        local lat=$(python3 "$HELPER" pingpong $PROXY_PORT $TEST_USER $TEST_PASS \
+                    $ECHO_PORT $IDLE_ROUNDTRIPS)
+        local after=$(server_cpu_ticks)
+        local cpu=$(awk -v t=$((after - before)) -v hz=$CLK_TCK -v n=$IDLE_ROUNDTRIPS \
+                    'BEGIN { printf "%.1f", t / hz / n * 1e6 }')
+
+        printf "  %-16s %-22s %-20s\n" "$n" "$cpu" "$lat"
+        echo "idle: $n $cpu $lat" >> "$RESULTS_FILE"
+
+        stop_idle_sessions
+    done
+
+    stop_server
+}
+
+# Benchmark: cierre masivo de sesiones
+bench_teardown() {
+    print_header "Benchmark: cierre masivo de sesiones"
+
+    start_server || return 1
+
+    printf "  %-12s %-16s %-20s %-16s\n" "Sesiones" "CPU total (ms)" "CPU por sesión (µs)" "Duración (ms)"
+    echo "  ─────────────────────────────────────────────────────────────────"
+    echo "teardown: sesiones cpu_total_ms cpu_us_por_sesion duracion_ms" >> "$RESULTS_FILE"
+
+    local n
+    for n in $TEARDOWN_SESSIONS; do
+        if ! start_idle_sessions $n; then
+            print_result "No se pudieron abrir $n sesiones" "FAIL"
+            break
+        fi
+
+        local before=$(server_cpu_ticks)
+        local t0=$(date +%s%N)
+        # al morir el cliente el kernel cierra todas sus conexiones a la vez
+        kill -9 $HOLD_PID 2>/dev/null
+        wait $HOLD_PID 2>/dev/null
+        HOLD_PID=""
+        while [ "$(server_current_connections)" != "0" ]; do
+            sleep 0.05
+        done
+        local t1=$(date +%s%N)
+        local after=$(server_cpu_ticks)
+
+        local ms=$(awk -v t=$((after - before)) -v hz=$CLK_TCK \
+                   'BEGIN { printf "%.0f", t / hz * 1e3 }')
+        local per=$(awk -v t=$((after - before)) -v hz=$CLK_TCK -v n=$n \
+                    'BEGIN { printf "%.1f", t / hz / n * 1e6 }')
+        local wall=$(( (t1 - t0) / 1000000 ))
+
+        printf "  %-12s %-16s %-20s %-16s\n" "$n" "$ms" "$per" "$wall"
+        echo "teardown: $n $ms $per $wall" >> "$RESULTS_FILE"
+    done
+
+    stop_server
+}
+
+# Benchmark: pedido/respuesta por una sesión
+bench_echo() {
+    print_header "Benchmark: latencia de pedido/respuesta"
+
+    start_server || return 1
+
+    printf "  %-12s %-22s %-20s\n" "Bytes" "CPU servidor (µs/rt)" "Latencia (µs/rt)"
+    echo "  ──────────────────────────────────────────────────────────"
+    echo "echo: bytes cpu_us_por_rt latencia_us_por_rt" >> "$RESULTS_FILE"
+
+    local size
+    for size in $ECHO_SIZES; do
+        local before=$(server_cpu_ticks)
+        local lat=$(python3 "$HELPER" pingpong $PROXY_PORT $TEST_USER $TEST_PASS \
+                    $ECHO_PORT $ECHO_ROUNDTRIPS $size)
+        local after=$(server_cpu_ticks)
+        local cpu=$(awk -v t=$((after - before)) -v hz=$CLK_TCK -v n=$ECHO_ROUNDTRIPS \
+                    'BEGIN { printf "%.1f", t / hz / n * 1e6 }')
+
+        printf "  %-12s %-22s %-20s\n" "$size" "$cpu" "$lat"
+        echo "echo: $size $cpu $lat" >> "$RESULTS_FILE"
+    done
+
+    stop_server
+}
+
+# Benchmark: memoria residente con sesiones ociosas
+bench_memory() {
+    print_header "Benchmark: memoria con sesiones ociosas"
+
+    start_server || return 1
+
+    printf "  %-12s %-20s %-20s\n" "Sesiones" "RSS servidor (MB)" "RSS por sesión (KB)"
+    echo "  ──────────────────────────────────────────────────────"
+    echo "memory: sesiones rss_mb rss_kb_por_sesion" >> "$RESULTS_FILE"
+
+    local base=$(server_rss_kb)
+    local n
+    for n in $MEMORY_SESSIONS; do
+        if ! start_idle_sessions $n 64; then
+            print_result "No se pudieron abrir $n sesiones" "FAIL"
+            break
+        fi
+        local rss=$(server_rss_kb)
+        local mb=$(awk -v k=$rss 'BEGIN { printf "%.1f", k / 1024 }')
+        local per=$(awk -v k=$((rss - base)) -v n=$n 'BEGIN { printf "%.2f", k / n }')
+
+        printf "  %-12s %-20s %-20s\n" "$n" "$mb" "$per"
+        echo "memory: $n $mb $per" >> "$RESULTS_FILE"
+
+        stop_idle_sessions
+    done
+
+    stop_server
+}
+
+# Benchmark: tasa de aceptación ante una avalancha de conexiones
+bench_accept() {
+    print_header "Benchmark: tasa de aceptación de conexiones"
+
+    start_server || return 1
+
+    printf "  %-10s %-14s %-22s %-16s %-10s\n" "En vuelo" "Conexiones" "CPU servidor (µs/conn)" "Tasa (conn/s)" "Fallidas"
+    echo "  ──────────────────────────────────────────────────────────────────────────"
+    echo "accept: en_vuelo conexiones cpu_us_por_conn conn_por_s fallidas" >> "$RESULTS_FILE"
+
+    local b
+    for b in $ACCEPT_BURSTS; do
+        local before=$(server_cpu_ticks)
+        local out=$(python3 "$HELPER" storm $PROXY_PORT $ACCEPT_CONNECTIONS $b)
+        # que el servidor termine de liberar las sesiones
+        while [ "$(server_current_connections)" != "0" ]; do
+            sleep 0.05
+        done
+        local after=$(server_cpu_ticks)
+
+        local rate=${out% *}
+        local failed=${out#* }
+        local cpu=$(awk -v t=$((after - before)) -v hz=$CLK_TCK -v n=$ACCEPT_CONNECTIONS \
+                    'BEGIN { printf "%.1f", t / hz / n * 1e6 }')
+
+        printf "  %-10s %-14s %-22s %-16s %-10s\n" "$b" "$ACCEPT_CONNECTIONS" "$cpu" "$rate" "$failed"
+        echo "accept: $b $ACCEPT_CONNECTIONS $cpu $rate $failed" >> "$RESULTS_FILE"
+    done
+
+    stop_server
+}
+
+# Benchmark: CPU por conexión hasta el HELLO, contra cada binario
+bench_hello() {
+    print_header "Benchmark: costo por conexión hasta el HELLO"
+
+    printf "  %-28s %-14s %-14s %-14s %-14s\n" "Binario" "Conexiones" "Mejor (µs)" "Mediana (µs)" "Tasa (conn/s)"
+    echo "  ──────────────────────────────────────────────────────────────────────────────────"
+    echo "hello: binario conexiones cpu_us_mejor cpu_us_mediana conn_por_s" >> "$RESULTS_FILE"
+
+    local bin
+    for bin in $HELLO_BINARIES; do
+        SERVER_BIN="$bin"
+        start_server || continue
+
+        local r cpus="" rate=0
+        for r in $(seq 1 $HELLO_RUNS); do
+            local before=$(server_cpu_ticks)
+            local out=$(python3 "$HELPER" storm $PROXY_PORT $HELLO_CONNECTIONS 1024)
+            while [ "$(server_current_connections)" != "0" ]; do
+                sleep 0.05
+            done
+            local after=$(server_cpu_ticks)
+            cpus="$cpus $(awk -v t=$((after - before)) -v hz=$CLK_TCK -v n=$HELLO_CONNECTIONS \
+                          'BEGIN { printf "%.2f", t / hz / n * 1e6 }')"
+            [ "${out% *}" -gt "$rate" ] && rate=${out% *}
+        done
+        local sorted=$(echo $cpus | tr ' ' '\n' | sort -n)
+        local best=$(echo "$sorted" | head -1)
+        local median=$(echo "$sorted" | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }')
+
+        printf "  %-28s %-14s %-14s %-14s %-14s\n" "$bin" "$HELLO_CONNECTIONS" "$best" "$median" "$rate"
+        echo "hello: $bin $HELLO_CONNECTIONS $best $median $rate" >> "$RESULTS_FILE"
+        stop_server
+    done
+    SERVER_BIN="./bin/socks5d"
+}
+
+# Benchmark: primera avalancha y memoria con altas y bajas de carga
+bench_churn() {
+    print_header "Benchmark: arranque en frío y altas y bajas de sesiones"
+
+    printf "  %-10s %-16s %-22s %-16s %-16s\n" "Modo" "Tasa (conn/s)" "CPU servidor (µs/conn)" "RSS con carga" "RSS sin carga"
+    echo "  ──────────────────────────────────────────────────────────────────────────────────"
+    echo "churn: modo conn_por_s cpu_us_por_conn rss_mb_con_carga rss_mb_sin_carga" >> "$RESULTS_FILE"
+
+    local m
+    for m in $CHURN_MODES; do
+        local extra=""
+        case "$m" in
+            prealloc)  extra="-A $CHURN_SESSIONS" ;;
+            hugepages) extra="-A $CHURN_SESSIONS -H" ;;
+        esac
+        start_server $extra || continue
+
+        # la primera avalancha encuentra al servidor recién iniciado
+        local before=$(server_cpu_ticks)
+        local out=$(python3 "$HELPER" storm $PROXY_PORT $CHURN_SESSIONS 1024)
+        while [ "$(server_current_connections)" != "0" ]; do
+            sleep 0.05
+        done
+        local after=$(server_cpu_ticks)
+        local rate=${out% *}
+        local cpu=$(awk -v t=$((after - before)) -v hz=$CLK_TCK -v n=$CHURN_SESSIONS \
+                    'BEGIN { printf "%.1f", t / hz / n * 1e6 }')
+
+        local r held=0 idle=0
+        for r in $(seq 1 $CHURN_ROUNDS); do
+            if ! start_idle_sessions $CHURN_SESSIONS 64; then
+                print_result "No se pudieron abrir $CHURN_SESSIONS sesiones" "FAIL"
+                break
+            fi
+            held=$(server_rss_kb)
+            stop_idle_sessions
+            idle=$(server_rss_kb)
+        done
+        held=$(awk -v k=$held 'BEGIN { printf "%.1f", k / 1024 }')
+        idle=$(awk -v k=$idle 'BEGIN { printf "%.1f", k / 1024 }')
+
+        printf "  %-10s %-16s %-22s %-16s %-16s\n" "$m" "$rate" "$cpu" "$held MB" "$idle MB"
+        echo "churn: $m $rate $cpu $held $idle" >> "$RESULTS_FILE"
+        stop_server
+    done
+}
+
+# RSS por sesión (KB) con $1 sesiones en el estado $2 (handshake o copy),
+# sobre un servidor recién iniciado
+session_footprint_kb() {
+    local n=$1
+    start_server > /dev/null || return 1
+    local base=$(server_rss_kb)
+
+    if [ "$2" == "copy" ]; then
+        start_idle_sessions $n 64 || { stop_server; return 1; }
+    else
+        # se mide enseguida: la negociación tiene un plazo (ver -t)
+        python3 "$HELPER" park $PROXY_PORT $n > "$BENCH_DIR/hold.out" 2>&1 &
+        HOLD_PID=$!
+        while ! grep -q ready "$BENCH_DIR/hold.out"; do
+            kill -0 $HOLD_PID 2>/dev/null || { stop_server; return 1; }
+            sleep 0.1
+        done
+    fi
+    local rss=$(server_rss_kb)
+    stop_idle_sessions
+    stop_server
+
+    awk -v k=$((rss - base)) -v n=$n 'BEGIN { printf "%.2f", k / n }'
+}
+
+# Benchmark: memoria por sesión en la negociación y en COPY, por binario
+bench_footprint() {
+    print_header "Benchmark: memoria por sesión según el estado"
+
+    printf "  %-28s %-12s %-26s %-20s
+" "Binario" "Sesiones" "Negociación (KB/sesión)" "COPY (KB/sesión)"
+    echo "  ──────────────────────────────────────────────────────────────────────────────────"
+    echo "footprint: binario sesiones kb_negociacion kb_copy" >> "$RESULTS_FILE"
+
+    local bin
+    for bin in $FOOTPRINT_BINARIES; do
+        SERVER_BIN="$bin"
+        local hs=$(session_footprint_kb $FOOTPRINT_SESSIONS handshake)
+        local cp=$(session_footprint_kb $FOOTPRINT_SESSIONS copy)
+        if [ -z "$hs" ] || [ -z "$cp" ]; then
+            print_result "No se pudieron abrir $FOOTPRINT_SESSIONS sesiones con $bin" "FAIL"
+            continue
+        fi
+
+        printf "  %-28s %-12s %-26s %-20s
+" "$bin" "$FOOTPRINT_SESSIONS" "$hs" "$cp"
+        echo "footprint: $bin $FOOTPRINT_SESSIONS $hs $cp" >> "$RESULTS_FILE"
+    done
+    SERVER_BIN="./bin/socks5d"
+}
+
+# Benchmark: latencia de resolución ante avalanchas de pedidos a un nombre
+bench_resolve() {
+    print_header "Benchmark: resolución de nombres en avalancha"
+
+    printf "  %-24s %-10s %-14s %-12s %-12s %-12s %-8s\n" "Binario" "Pedidos" "Mediana (ms)" "p99 (ms)" "Máx (ms)" "Rechazados" "Hilos"
+    echo "  ──────────────────────────────────────────────────────────────────────────────────────────"
+    echo "resolve: binario pedidos ms_mediana ms_p99 ms_max rechazados pico_hilos" >> "$RESULTS_FILE"
+
+    local bin n
+    for bin in $RESOLVE_BINARIES; do
+        SERVER_BIN="$bin"
+        start_server || continue
+        for n in $RESOLVE_BURSTS; do
+            local out=$(python3 "$HELPER" resolve $PROXY_PORT $TEST_USER $TEST_PASS \
+                        $ECHO_PORT $n $RESOLVE_HOST $SERVER_PID)
+            while [ "$(server_current_connections)" != "0" ]; do
+                sleep 0.05
+            done
+            set -- $out
+            printf "  %-24s %-10s %-14s %-12s %-12s %-12s %-8s\n" "$bin" "$n" "$1" "$2" "$3" "$4" "$5"
+            echo "resolve: $bin $n $out" >> "$RESULTS_FILE"
+        done
+        stop_server
+    done
+    SERVER_BIN="./bin/socks5d"
+}
+
+# Benchmark: resolución de nombres distintos contra un servidor con demora
+bench_dns() {
+    print_header "Benchmark: consultas DNS en avalancha"
+
+    python3 "$HELPER" dnsstub $DNS_STUB_PORT $DNS_DELAY_MS > /dev/null 2>&1 &
+    local stub=$!
+    sleep 0.5
+    if ! kill -0 $stub 2>/dev/null; then
+        print_result "Error al iniciar el servidor de nombres en el puerto $DNS_STUB_PORT" "FAIL"
+        return 1
+    fi
+
+    printf "  %-8s %-10s %-14s %-12s %-12s %-12s %-8s\n" "Modo" "Pedidos" "Mediana (ms)" "p99 (ms)" "Máx (ms)" "Rechazados" "Hilos"
+    echo "  ──────────────────────────────────────────────────────────────────────────────────"
+    echo "dns: modo pedidos ms_mediana ms_p99 ms_max rechazados pico_hilos (demora ${DNS_DELAY_MS} ms)" >> "$RESULTS_FILE"
+
+    local m n
+    for m in $DNS_MODES; do
+        case "$m" in
+            loop) start_server -n 127.0.0.1:$DNS_STUB_PORT || continue ;;
+            pool) start_server -D || continue ;;
+            *)    print_result "Modo desconocido: $m" "FAIL"; continue ;;
+        esac
+        for n in $DNS_BURSTS; do
+            local out=$(python3 "$HELPER" resolve $PROXY_PORT $TEST_USER $TEST_PASS \
+                        $ECHO_PORT $n "n%d.$m.$n.bench" $SERVER_PID)
+            while [ "$(server_current_connections)" != "0" ]; do
+                sleep 0.05
+            done
+            set -- $out
+            printf "  %-8s %-10s %-14s %-12s %-12s %-12s %-8s\n" "$m" "$n" "$1" "$2" "$3" "$4" "$5"
+            echo "dns: $m $n $out" >> "$RESULTS_FILE"
+        done
+        stop_server
+    done
+    kill $stub 2>/dev/null
+    wait $stub 2>/dev/null
+}
+
+# Benchmark: avalanchas de pedidos a pocos nombres, con y sin caché
+bench_dnscache() {
+    print_header "Benchmark: caché de resoluciones"
+
+    python3 "$HELPER" dnsstub $DNS_STUB_PORT $DNS_DELAY_MS > /dev/null 2>&1 &
+    local stub=$!
+    sleep 0.5
+    if ! kill -0 $stub 2>/dev/null; then
+        print_result "Error al iniciar el servidor de nombres en el puerto $DNS_STUB_PORT" "FAIL"
+        return 1
+    fi
+
+    printf "  %-8s %-10s %-14s %-12s %-12s %-12s\n" "Caché" "Avalancha" "Mediana (ms)" "p99 (ms)" "Máx (ms)" "Rechazados"
+    echo "  ──────────────────────────────────────────────────────────────────────────"
+    echo "dnscache: modo avalancha ms_mediana ms_p99 ms_max rechazados pico_hilos ($DNSCACHE_REQUESTS pedidos, $DNSCACHE_NAMES nombres, demora ${DNS_DELAY_MS} ms)" >> "$RESULTS_FILE"
+
+    local m round
+    for m in $DNSCACHE_MODES; do
+        case "$m" in
+            on)  start_server -n 127.0.0.1:$DNS_STUB_PORT || continue ;;
+            off) start_server -n 127.0.0.1:$DNS_STUB_PORT -C 0 || continue ;;
+            *)   print_result "Modo desconocido: $m" "FAIL"; continue ;;
+        esac
+        for round in frío caliente; do
+            local out=$(python3 "$HELPER" resolve $PROXY_PORT $TEST_USER $TEST_PASS \
+                        $ECHO_PORT $DNSCACHE_REQUESTS "n%d.cache.bench" $SERVER_PID \
+                        $DNSCACHE_NAMES)
+            while [ "$(server_current_connections)" != "0" ]; do
+                sleep 0.05
+            done
+            set -- $out
+            printf "  %-8s %-10s %-14s %-12s %-12s %-12s\n" "$m" "$round" "$1" "$2" "$3" "$4"
+            echo "dnscache: $m $round $out" >> "$RESULTS_FILE"
+        done
+        stop_server
+    done
+    kill $stub 2>/dev/null
+    wait $stub 2>/dev/null
+}
+
+# Benchmark: muchos pedidos simultáneos al mismo nombre
+bench_fanout() {
+    print_header "Benchmark: pedidos simultáneos al mismo nombre"
+
+    local counter="$BENCH_DIR/dns_queries"
+    echo 0 > "$counter"
+    python3 "$HELPER" dnsstub $DNS_STUB_PORT $DNS_DELAY_MS "$counter" > /dev/null 2>&1 &
+    local stub=$!
+    sleep 0.5
+    if ! kill -0 $stub 2>/dev/null; then
+        print_result "Error al iniciar el servidor de nombres en el puerto $DNS_STUB_PORT" "FAIL"
+        return 1
+    fi
+
+    printf "  %-22s %-6s %-9s %-10s %-14s %-12s %-12s\n" "Binario" "Modo" "Pedidos" "Preguntas" "Mediana (ms)" "p99 (ms)" "Rechazados"
+    echo "  ────────────────────────────────────────────────────────────────────────────────────────"
+    echo "fanout: binario modo pedidos preguntas ms_mediana ms_p99 ms_max rechazados pico_hilos (demora ${DNS_DELAY_MS} ms)" >> "$RESULTS_FILE"
+
+    local bin m n run=0
+    for bin in $FANOUT_BINARIES; do
+        SERVER_BIN="$bin"
+        for m in $DNS_MODES; do
+            case "$m" in
+                loop) start_server -n 127.0.0.1:$DNS_STUB_PORT -C 0 || continue ;;
+                pool) start_server -D -C 0 || continue ;;
+                *)    print_result "Modo desconocido: $m" "FAIL"; continue ;;
+            esac
+            for n in $FANOUT_CONNECTIONS; do
+                run=$((run + 1))
+                local before=$(cat "$counter")
+                local out=$(python3 "$HELPER" resolve $PROXY_PORT $TEST_USER $TEST_PASS \
+                            $ECHO_PORT $n "fanout$run.bench" $SERVER_PID)
+                while [ "$(server_current_connections)" != "0" ]; do
+                    sleep 0.05
+                done
+                local asked=$(( $(cat "$counter") - before ))
+                set -- $out
+                printf "  %-22s %-6s %-9s %-10s %-14s %-12s %-12s\n" "$bin" "$m" "$n" "$asked" "$1" "$2" "$4"
+                echo "fanout: $bin $m $n $asked $out" >> "$RESULTS_FILE"
+            done
+            stop_server
+        done
+    done
+    SERVER_BIN="./bin/socks5d"
+    kill $stub 2>/dev/null
+    wait $stub 2>/dev/null
+}
+
+# Benchmark: tráfico constante a pocos nombres con TTL corto
+bench_prefetch() {
+    print_header "Benchmark: renovación de nombres frecuentes"
+
+    local counter="$BENCH_DIR/dns_queries"
+    echo 0 > "$counter"
+    python3 "$HELPER" dnsstub $DNS_STUB_PORT $DNS_DELAY_MS "$counter" $PREFETCH_TTL > /dev/null 2>&1 &
+    local stub=$!
+    sleep 0.5
+    if ! kill -0 $stub 2>/dev/null; then
+        print_result "Error al iniciar el servidor de nombres en el puerto $DNS_STUB_PORT" "FAIL"
+        return 1
+    fi
+
+    printf "  %-6s %-9s %-10s %-14s %-10s %-10s %-11s %-12s\n" "Modo" "Pedidos" "Preguntas" "Mediana (ms)" "p99 (ms)" "Máx (ms)" "Renov. ok" "Desperdic."
+    echo "  ────────────────────────────────────────────────────────────────────────────────────"
+    echo "prefetch: modo pedidos preguntas ms_mediana ms_p99 ms_max rechazados renovaciones_usadas desperdiciadas ($PREFETCH_NAMES nombres, TTL ${PREFETCH_TTL} s, demora ${DNS_DELAY_MS} ms)" >> "$RESULTS_FILE"
+
+    local m
+    for m in off on; do
+        case "$m" in
+            off) start_server -n 127.0.0.1:$DNS_STUB_PORT -F 0 || continue ;;
+            on)  start_server -n 127.0.0.1:$DNS_STUB_PORT -F $PREFETCH_HOT \
+                              -W $PREFETCH_WINDOW || continue ;;
+        esac
+        local before=$(cat "$counter")
+        local out=$(python3 "$HELPER" steady $PROXY_PORT $TEST_USER $TEST_PASS \
+                    $ECHO_PORT "n%d.$m.prefetch.bench" $PREFETCH_NAMES \
+                    $PREFETCH_RATE $PREFETCH_SECONDS)
+        local asked=$(( $(cat "$counter") - before ))
+        local stats=$(./bin/socks5_client -P $MONITOR_PORT dnscache 2>/dev/null)
+        local used=$(echo "$stats" | awk -F: '/Prefetch hits/ { gsub(/ /, "", $2); print $2 }')
+        local wasted=$(echo "$stats" | awk -F: '/Wasted prefetches/ { gsub(/ /, "", $2); print $2 }')
+        set -- $out
+        printf "  %-6s %-9s %-10s %-14s %-10s %-10s %-11s %-12s\n" "$m" "$1" "$asked" "$2" "$3" "$4" "$used" "$wasted"
+        echo "prefetch: $m $1 $asked $2 $3 $4 $5 $used $wasted" >> "$RESULTS_FILE"
+        stop_server
+    done
+    kill $stub 2>/dev/null
+    wait $stub 2>/dev/null
+}
+
+# Benchmark: nombres con IPv6 que no responde e IPv4 que sí
+bench_eyeballs() {
+    print_header "Benchmark: conexión con una familia caída"
+
+    python3 "$HELPER" dnsstub $DNS_STUB_PORT $DNS_DELAY_MS "" 60 v6 > /dev/null 2>&1 &
+    local stub=$!
+    python3 "$HELPER" blackhole $EYEBALLS_PORT ::1 > /dev/null 2>&1 &
+    local hole=$!
+    python3 "$HELPER" echo $EYEBALLS_PORT > /dev/null 2>&1 &
+    local echo4=$!
+    sleep 0.5
+    if ! kill -0 $stub $hole $echo4 2>/dev/null; then
+        print_result "Error al iniciar los servidores del puerto $EYEBALLS_PORT" "FAIL"
+        kill $stub $hole $echo4 2>/dev/null
+        wait $stub $hole $echo4 2>/dev/null
+        return 1
+    fi
+
+    printf "  %-22s %-9s %-14s %-12s %-12s %-12s\n" "Binario" "Pedidos" "Mediana (ms)" "p99 (ms)" "Máx (ms)" "Rechazados"
+    echo "  ──────────────────────────────────────────────────────────────────────────────"
+    echo "eyeballs: binario pedidos ms_mediana ms_p99 ms_max rechazados pico_hilos (demora ${DNS_DELAY_MS} ms)" >> "$RESULTS_FILE"
+
+    local bin run=0
+    for bin in $EYEBALLS_BINARIES; do
+        SERVER_BIN="$bin"
+        start_server -n 127.0.0.1:$DNS_STUB_PORT || continue
+        run=$((run + 1))
+        local out=$(python3 "$HELPER" resolve $PROXY_PORT $TEST_USER $TEST_PASS \
+                    $EYEBALLS_PORT $EYEBALLS_CONNECTIONS "n%d.eyeballs$run.bench" $SERVER_PID)
+        set -- $out
+        printf "  %-22s %-9s %-14s %-12s %-12s %-12s\n" "$bin" "$EYEBALLS_CONNECTIONS" "$1" "$2" "$3" "$4"
+        echo "eyeballs: $bin $EYEBALLS_CONNECTIONS $out" >> "$RESULTS_FILE"
+        stop_server
+    done
+    SERVER_BIN="./bin/socks5d"
+    kill $stub $hole $echo4 2>/dev/null
+    wait $stub $hole $echo4 2>/dev/null
+}
+
+# Benchmark: CPU por GB retransmitido con cada multiplexor
+bench_relay() {
+    print_header "Benchmark: CPU por GB retransmitido"
+
+    [ -z "$DISCARD_PID" ] && { start_discard_server || return 1; }
+
+    printf "  %-12s %-10s %-10s %-18s %-16s\n" "Multiplexor" "Modo" "Sesiones" "CPU (ms/GB)" "Throughput (MB/s)"
+    echo "  ──────────────────────────────────────────────────────────────────────"
+    echo "relay: multiplexor modo sesiones cpu_ms_por_gb mb_por_s" >> "$RESULTS_FILE"
+
+    local b m st
+    for b in $RELAY_BACKENDS; do
+    for m in $RELAY_MODES; do
+        local extra=""
+        case "$m" in
+            splice)   extra="-S -N" ;;
+            zerocopy) extra="-N -Z $ZEROCOPY_KB" ;;
+        esac
+        start_server -b $b $extra || continue
+        local real=$(awk '/I\/O multiplexer/ { print $3 }' "$LOG_FILE")
+        if [ "$real" != "$b" ]; then
+            print_result "$b no disponible (se usó $real)" "WARN"
+            stop_server
+            continue
+        fi
+        for st in $RELAY_STREAMS; do
+            local mb=$((RELAY_MB / st))
+            local before=$(server_cpu_ticks)
+            local t0=$(date +%s%N)
+            python3 "$HELPER" blast $PROXY_PORT $TEST_USER $TEST_PASS \
+                $DISCARD_PORT $mb $st
+            # la sesión termina cuando el servidor entregó todo al origen
+            while [ "$(server_current_connections)" != "0" ]; do
+                sleep 0.05
+            done
+            local t1=$(date +%s%N)
+            local after=$(server_cpu_ticks)
+
+            local total=$((mb * st))
+            local cpu=$(awk -v t=$((after - before)) -v hz=$CLK_TCK -v mb=$total \
+                        'BEGIN { printf "%.0f", t / hz * 1e3 / (mb / 1024) }')
+            local tput=$(awk -v ns=$((t1 - t0)) -v mb=$total \
+                         'BEGIN { printf "%.0f", mb / (ns / 1e9) }')
+
+            printf "  %-12s %-10s %-10s %-18s %-16s\n" "$b" "$m" "$st" "$cpu" "$tput"
+            echo "relay: $b $m $st $cpu $tput" >> "$RESULTS_FILE"
+        done
+        stop_server
+    done
+    done
+}
+
+main() {
+    echo -e "${BLUE}"
+    echo "╔═══════════════════════════════════════════════════════════════╗"
+    echo "║         BENCHMARKS - Servidor SOCKSv5                         ║"
+    echo "║         ITBA - Protocolos de Comunicación 2025/2              ║"
+    echo "╚═══════════════════════════════════════════════════════════════╝"
+    echo -e "${NC}"
+
+    echo "RESULTADOS DE BENCHMARKS" > "$RESULTS_FILE"
+    echo "Fecha: $(date)" >> "$RESULTS_FILE"
+    echo "Sistema: $(uname -a)" >> "$RESULTS_FILE"
+    echo "" >> "$RESULTS_FILE"
+
+    ulimit -n "$(ulimit -Hn)" 2>/dev/null
+
+    write_helper
+    start_echo_server || exit 1
+
+    local benchs="$*"
+    [ -z "$benchs" ] && benchs="idle teardown echo memory accept hello churn footprint resolve dns dnscache fanout prefetch eyeballs relay"
+
+    for b in $benchs; do
+        case "$b" in
+            idle)     bench_idle ;;
+            teardown) bench_teardown ;;
+            echo)     bench_echo ;;
+            memory)   bench_memory ;;
+            accept)   bench_accept ;;
+            hello)    bench_hello ;;
+            churn)    bench_churn ;;
+            footprint) bench_footprint ;;
+            resolve)  bench_resolve ;;
+            dns)      bench_dns ;;
+            dnscache) bench_dnscache ;;
+            fanout)   bench_fanout ;;
+            prefetch) bench_prefetch ;;
+            eyeballs) bench_eyeballs ;;
+            relay)    bench_relay ;;
+            *)    print_result "Benchmark desconocido: $b" "FAIL" ;;
+        esac
+    done
+
+    echo -e "\n${GREEN}Resultados guardados en: $RESULTS_FILE${NC}"
+}
+
+# Ejecutar si se llama directamente
+if [ "${BASH_SOURCE[0]}" == "${0}" ]; then
+    main "$@"
+fi
@@ -0,0 +1,433 @@
+#!/bin/bash
+#
+# Prueba del cliente DNS del servidor contra un servidor de nombres de
+# prueba local (UDP y TCP), que responde según el nombre consultado:
+#
+#   *.ok.test     A 127.0.0.1 y AAAA ::1
+#   v6.test       solo AAAA ::1
+#   cname.test    CNAME a a.ok.test, con su A
+#   long253.test  CNAME a un nombre de 253 caracteres (el máximo), con su A
+#   long254.test  CNAME a un nombre de 254 caracteres, con su A
+#   stray.test    solo un A a nombre de otro (no es respuesta)
+#   drop.test     descarta la primera consulta de cada tipo (reintento)
+#   flaky.test    SERVFAIL la primera vez (reintento inmediato)
+#   tc.test       respuesta truncada por UDP; la completa por TCP
+#   nx.test       NXDOMAIN
+#   silent.test   nunca responde (vence el plazo)
+#   ttl1.test     A 127.0.0.1 con TTL de 1 s
+#   hot.test      A 127.0.0.1 con TTL de 2 s (renovación antes de vencer)
+#   slow.test     A 127.0.0.1, 300 ms después (pedidos simultáneos)
+#
+# Los pedidos SOCKS se hacen con ATYP = FQDN hacia un servidor de eco local.
+# Al final se prueba la carrera de conexiones entre familias, que empieza por
+# IPv6, con un puerto que en ::1 no responde (la cola del listen llena
+# descarta los SYN) o rechaza, y en 127.0.0.1 tiene eco.
+# Uso: ./test_dns.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+PROXY_PORT=${PROXY_PORT:-1090}
+MONITOR_PORT=${MONITOR_PORT:-8090}
+DNS_PORT=${DNS_PORT:-15353}
+ECHO_PORT=${ECHO_PORT:-9996}
+# un puerto sin nadie escuchando: el servidor lo rechaza con ICMP
+CLOSED_PORT=${CLOSED_PORT:-15354}
+# en ::1 sin respuesta y en 127.0.0.1 con eco
+BLACKHOLE_PORT=${BLACKHOLE_PORT:-9994}
+# en ::1 sin nadie escuchando y en 127.0.0.1 con eco
+REFUSED_PORT=${REFUSED_PORT:-9993}
+# plazo por intento (s) e intentos por servidor, vía RES_OPTIONS
+export RES_OPTIONS="timeout:1 attempts:2"
+
+HELPER=$(mktemp /tmp/test_dns.XXXXXX.py)
+DNS_LOG=$(mktemp /tmp/test_dns.XXXXXX.log)
+SERVER_PID=
+PIDS=
+FAILS=0
+
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null
+    [ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+    wait 2>/dev/null
+    rm -f "$HELPER" "$DNS_LOG"
+}
+trap cleanup EXIT
+
+cat > "$HELPER" <<'EOF'
+import socket, struct, sys, threading, time
+
+def dns_server(port, log):
+    seen = {}
+    lock = threading.Lock()
+    out = open(log, 'a', buffering=1)
+
+    def parse(q):
+        off, labels = 12, []
+        while q[off]:
+            labels.append(q[off + 1:off + 1 + q[off]].decode())
+            off += 1 + q[off]
+        qtype = struct.unpack('!H', q[off + 1:off + 3])[0]
+        return '.'.join(labels), qtype, q[12:off + 5]
+
+    def rr(name_ptr, rtype, data, ttl=60):
+        return name_ptr + struct.pack('!HHIH', rtype, 1, ttl, len(data)) + data
+
+    def answer(q, tcp, port):
+        name, qtype, question = parse(q)
+        key = (name.lower(), qtype)
+        with lock:
+            seen[key] = seen.get(key, 0) + 1
+            first = seen[key] == 1
+        out.write('%s %s %d %d\n' % ('tcp' if tcp else 'udp', name.lower(), qtype, port))
+        base, ptr = name.lower(), b'\xc0\x0c'
+        flags, answers = 0x8180, []
+        a, aaaa = socket.inet_pton(socket.AF_INET, '127.0.0.1'), \
+                  socket.inet_pton(socket.AF_INET6, '::1')
+        if base.endswith('.ok.test') or base == 'slow.test':
+            answers = [rr(ptr, 1, a)] if qtype == 1 else [rr(ptr, 28, aaaa)]
+        elif base == 'ttl1.test':
+            answers = [rr(ptr, 1, a, ttl=1)] if qtype == 1 else []
+        elif base == 'hot.test':
+            answers = [rr(ptr, 1, a, ttl=2)] if qtype == 1 else []
+        elif base == 'v6.test':
+            answers = [rr(ptr, 28, aaaa)] if qtype == 28 else []
+        elif base == 'cname.test':
+            target = b'\x01a\x02ok\x04test\x00'
+            answers = [rr(ptr, 5, target)]
+            if qtype == 1:
+                answers.append(rr(target, 1, a))
+        elif base in ('long253.test', 'long254.test'):
+            last = 61 if base == 'long253.test' else 62
+            target = b''.join(bytes([len(l)]) + l for l in
+                              (b'a' * 63, b'b' * 63, b'c' * 63, b'd' * last)) + b'\x00'
+            answers = [rr(ptr, 5, target)]
+            if qtype == 1:
+                # el A apunta al destino del CNAME, que empieza después de
+                # la pregunta y del encabezado del registro
+                at = struct.pack('!H', 0xc000 | (12 + len(question) + 12))
+                answers.append(rr(at, 1, a))
+        elif base == 'stray.test':
+            other = b'\x01a\x02ok\x04test\x00'
+            answers = [rr(other, 1, a)] if qtype == 1 else []
+        elif base == 'drop.test':
+            if first:
+                return None
+            answers = [rr(ptr, 1, a)] if qtype == 1 else []
+        elif base == 'flaky.test':
+            if first:
+                flags |= 2
+            elif qtype == 1:
+                answers = [rr(ptr, 1, a)]
+        elif base == 'tc.test':
+            if not tcp:
+                flags |= 0x0200
+            elif qtype == 1:
+                answers = [rr(ptr, 1, a)] * 40
+        elif base == 'nx.test':
+            flags |= 3
+        else:
+            return None
+        return q[:2] + struct.pack('!HHHHH', flags, 1, len(answers), 0, 0) \
+            + question + b''.join(answers)
+
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    udp.bind(('127.0.0.1', port))
+    tcp = socket.socket()
+    tcp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    tcp.bind(('127.0.0.1', port))
+    tcp.listen(64)
+
+    def serve_tcp():
+        while True:
+            c, peer = tcp.accept()
+            with c:
+                n = struct.unpack('!H', c.recv(2, socket.MSG_WAITALL))[0]
+                r = answer(c.recv(n, socket.MSG_WAITALL), True, peer[1])
+                if r is not None:
+                    c.sendall(struct.pack('!H', len(r)) + r)
+    threading.Thread(target=serve_tcp, daemon=True).start()
+    while True:
+        q, addr = udp.recvfrom(512)
+        r = answer(q, False, addr[1])
+        if r is None:
+            continue
+        if b'\x04slow\x04test\x00' in q.lower():
+            threading.Timer(0.3, udp.sendto, (r, addr)).start()
+        else:
+            udp.sendto(r, addr)
+
+def echo_server(port, addr='::'):
+    srv = socket.socket(socket.AF_INET6 if ':' in addr else socket.AF_INET)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if ':' in addr:
+        srv.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_V6ONLY, addr != '::')
+    srv.bind((addr, port))
+    srv.listen(1024)
+    def serve(c):
+        with c:
+            while True:
+                d = c.recv(4096)
+                if not d:
+                    return
+                c.sendall(d)
+    while True:
+        c, _ = srv.accept()
+        threading.Thread(target=serve, args=(c,), daemon=True).start()
+
+def blackhole(addr, port):
+    """acepta en `addr' sin atender: con la cola llena los SYN se descartan"""
+    family = socket.AF_INET6 if ':' in addr else socket.AF_INET
+    srv = socket.socket(family)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind((addr, port))
+    srv.listen(0)
+    fill = []
+    for _ in range(4):
+        c = socket.socket(family)
+        c.setblocking(False)
+        c.connect_ex((addr, port))
+        fill.append(c)
+    time.sleep(3600)
+
+def lookup(proxy, host, port):
+    """(código de respuesta SOCKS, segundos, eco correcto, familia conectada)"""
+    t = time.monotonic()
+    s = socket.create_connection(('127.0.0.1', proxy))
+    s.settimeout(30)
+    s.sendall(b'\x05\x01\x02')
+    s.recv(2, socket.MSG_WAITALL)
+    s.sendall(b'\x01\x01u\x01p')
+    s.recv(2, socket.MSG_WAITALL)
+    h = host.encode()
+    s.sendall(b'\x05\x01\x00\x03' + bytes([len(h)]) + h + struct.pack('!H', port))
+    rep = s.recv(4, socket.MSG_WAITALL)
+    elapsed = time.monotonic() - t
+    ok, family = False, '-'
+    if len(rep) == 4 and rep[1] == 0:
+        family = 'v4' if rep[3] == 1 else 'v6'
+        s.recv(4 if rep[3] == 1 else 16, socket.MSG_WAITALL)
+        s.recv(2, socket.MSG_WAITALL)
+        s.sendall(b'ping')
+        ok = s.recv(4, socket.MSG_WAITALL) == b'ping'
+    s.close()
+    return (rep[1] if len(rep) == 4 else -1), elapsed, ok, family
+
+cmd = sys.argv[1]
+if cmd == 'dns':
+    dns_server(int(sys.argv[2]), sys.argv[3])
+elif cmd == 'echo':
+    echo_server(int(sys.argv[2]), *sys.argv[3:])
+elif cmd == 'blackhole':
+    blackhole(sys.argv[2], int(sys.argv[3]))
+elif cmd == 'lookup':
+    # lookup <proxy> <puerto> <nombre> -> "<rep> <ms> <eco> <familia>"
+    rep, elapsed, ok, family = lookup(int(sys.argv[2]), sys.argv[4], int(sys.argv[3]))
+    print(rep, int(elapsed * 1000), 'echo' if ok else '-', family)
+elif cmd == 'burst':
+    # burst <proxy> <puerto> <n> [nombre]: n pedidos a la vez, a nombres
+    # distintos o todos al mismo -> cuántos OK
+    n = int(sys.argv[4])
+    name = sys.argv[5] if len(sys.argv) > 5 else 'n%d.ok.test'
+    results = [None] * n
+    def one(i):
+        try:
+            host = name % i if '%d' in name else name
+            results[i] = lookup(int(sys.argv[2]), host, int(sys.argv[3]))
+        except OSError:
+            results[i] = (-1, 0, False, '-')
+    threads = [threading.Thread(target=one, args=(i,)) for i in range(n)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    print(sum(1 for r in results if r[0] == 0 and r[2]))
+EOF
+
+start_server() {
+    ./bin/socks5d -p "$PROXY_PORT" -P "$MONITOR_PORT" -u u:p "$@" > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+}
+
+stop_server() {
+    kill -INT "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+    SERVER_PID=
+}
+
+ok() {
+    echo -e "${GREEN}OK: $1${NC}"
+}
+
+fail() {
+    echo -e "${RED}FALLO: $1${NC}"
+    FAILS=$((FAILS + 1))
+}
+
+# expect <nombre> <rep esperado> <ms mínimos> <ms máximos> <descripción>
+# (con PORT=<puerto> se conecta a ese puerto en lugar de ECHO_PORT, y con
+# FAMILY=v4|v6 verifica por cuál familia se conectó)
+expect() {
+    local out rep ms echo family
+    out=$(python3 "$HELPER" lookup "$PROXY_PORT" "${PORT:-$ECHO_PORT}" "$1")
+    read -r rep ms echo family <<< "$out"
+    if [ "$rep" != "$2" ] || [ "$ms" -lt "$3" ] || [ "$ms" -gt "$4" ]; then
+        fail "$5 ($1: rep=$rep en ${ms} ms)"
+    elif [ "$2" = 0 ] && [ "$echo" != echo ]; then
+        fail "$5 ($1: sin eco)"
+    elif [ -n "$FAMILY" ] && [ "$family" != "$FAMILY" ]; then
+        fail "$5 ($1: conectó por $family)"
+    else
+        ok "$5 ($1: rep=$rep en ${ms} ms)"
+    fi
+}
+
+# asked <proto> <nombre> <tipo>: cuántas veces llegó esa pregunta
+asked() {
+    grep -c "^$1 $2 $3 " "$DNS_LOG"
+}
+
+# ports <nombre>: puertos de origen de las preguntas A por UDP del nombre
+ports() {
+    awk -v n="$1" '$1 == "udp" && $2 == n && $3 == 1 { print $4 }' "$DNS_LOG"
+}
+
+echo -e "${BLUE}=== PRUEBA DEL CLIENTE DNS ===${NC}"
+
+make all > /dev/null || { echo -e "${RED}Error de compilación${NC}"; exit 1; }
+
+python3 "$HELPER" dns "$DNS_PORT" "$DNS_LOG" & PIDS="$PIDS $!"
+python3 "$HELPER" echo "$ECHO_PORT" & PIDS="$PIDS $!"
+python3 "$HELPER" echo "$BLACKHOLE_PORT" 127.0.0.1 & PIDS="$PIDS $!"
+python3 "$HELPER" blackhole ::1 "$BLACKHOLE_PORT" & PIDS="$PIDS $!"
+python3 "$HELPER" echo "$REFUSED_PORT" 127.0.0.1 & PIDS="$PIDS $!"
+sleep 0.5
+
+echo -e "\n${BLUE}[1/5] Respuestas${NC}"
+start_server -n "127.0.0.1:$DNS_PORT"
+
+expect a.ok.test      0 0 500 "A y AAAA"
+[ "$(asked udp a.ok.test 1)" = 1 ] && [ "$(asked udp a.ok.test 28)" = 1 ] \
+    && ok "pregunta A y AAAA una vez cada una" \
+    || fail "preguntas de a.ok.test: A=$(asked udp a.ok.test 1) AAAA=$(asked udp a.ok.test 28)"
+expect MiXeD.Ok.TeSt. 0 0 500 "mayúsculas y punto final"
+expect v6.test        0 0 500 "solo IPv6"
+expect cname.test     0 0 500 "CNAME"
+expect long253.test   0 0 500 "nombre de 253 caracteres"
+expect long254.test   4 0 500 "nombre de 254 caracteres: se descarta"
+expect stray.test     4 0 500 "registros a nombre de otro: se ignoran"
+p1=$(ports a.ok.test); p2=$(ports v6.test); p3=$(ports cname.test)
+[ -n "$p1" ] && [ "$p1" != "$p2" ] && [ "$p2" != "$p3" ] && [ "$p1" != "$p3" ] \
+    && ok "cada consulta sale de otro puerto" \
+    || fail "puertos de origen: a.ok.test=$p1 v6.test=$p2 cname.test=$p3"
+expect tc.test        0 0 500 "respuesta truncada"
+[ "$(asked tcp tc.test 1)" = 1 ] && ok "repite por TCP" || fail "tc.test no se repitió por TCP"
+expect nx.test        4 0 500 "NXDOMAIN"
+expect flaky.test     0 0 500 "SERVFAIL y reintento"
+expect localhost      0 0 500 "/etc/hosts"
+[ "$(grep -c localhost "$DNS_LOG")" = 0 ] && ok "/etc/hosts sin consultar" || fail "consultó localhost"
+expect 127.0.0.1      0 0 500 "dirección literal"
+
+echo -e "\n${BLUE}[2/5] Plazos${NC}"
+expect drop.test      0 900 1900 "reintento al vencer el plazo"
+expect silent.test    4 1900 3000 "sin respuesta: 2 intentos de 1 s"
+expect "bad..name"    4 0 500 "nombre inválido"
+
+echo -e "\n${BLUE}[3/5] Caché${NC}"
+expect a.ok.test      0 0 500 "respuesta del caché"
+[ "$(asked udp a.ok.test 1)" = 1 ] && ok "sin volver a consultar" \
+    || fail "a.ok.test consultado $(asked udp a.ok.test 1) veces"
+expect nx.test        4 0 500 "NXDOMAIN del caché"
+[ "$(asked udp nx.test 1)" = 1 ] && ok "caché negativo" \
+    || fail "nx.test consultado $(asked udp nx.test 1) veces"
+expect ttl1.test      0 0 500 "TTL de 1 s"
+expect ttl1.test      0 0 500 "TTL de 1 s, del caché"
+sleep 1.2
+expect ttl1.test      0 0 500 "TTL de 1 s, vencido"
+[ "$(asked udp ttl1.test 1)" = 2 ] && ok "consulta de nuevo al vencer el TTL" \
+    || fail "ttl1.test consultado $(asked udp ttl1.test 1) veces"
+./bin/socks5_client -P "$MONITOR_PORT" dnscache | grep -q "a.ok.test .* 127.0.0.1 ::1" \
+    && ok "monitoreo: lista las entradas" || fail "monitoreo: a.ok.test no aparece"
+./bin/socks5_client -P "$MONITOR_PORT" dnsflush a.ok.test | grep -q "Flushed 1" \
+    && ok "monitoreo: descarta un nombre" || fail "monitoreo: dnsflush a.ok.test"
+expect a.ok.test      0 0 500 "tras descartarlo"
+[ "$(asked udp a.ok.test 1)" = 2 ] && ok "consulta de nuevo tras descartarlo" \
+    || fail "a.ok.test consultado $(asked udp a.ok.test 1) veces"
+
+# con -F 2 -W 50, hot.test (TTL 2 s) se renueva si se pide 2 veces y una de
+# ellas en su último segundo
+stop_server
+start_server -n "127.0.0.1:$DNS_PORT" -F 2 -W 50
+expect hot.test       0 0 500 "nombre frecuente"
+expect hot.test       0 0 500 "nombre frecuente, del caché"
+sleep 1.2
+expect hot.test       0 0 500 "nombre frecuente, por vencer"
+sleep 0.2
+[ "$(asked udp hot.test 1)" = 2 ] && ok "se renueva en segundo plano" \
+    || fail "hot.test consultado $(asked udp hot.test 1) veces"
+sleep 1
+expect hot.test       0 0 500 "nombre frecuente, tras el TTL original"
+[ "$(asked udp hot.test 1)" = 2 ] && ok "sin esperar una consulta" \
+    || fail "hot.test consultado $(asked udp hot.test 1) veces"
+./bin/socks5_client -P "$MONITOR_PORT" dnscache | grep -q "Prefetch hits: *1$" \
+    && ok "monitoreo: cuenta la renovación usada" || fail "monitoreo: Prefetch hits"
+# la renovación se vuelve a pedir y se descarta antes de usarla
+expect hot.test       0 0 500 "nombre frecuente, por vencer otra vez"
+sleep 0.2
+./bin/socks5_client -P "$MONITOR_PORT" dnsflush hot.test > /dev/null
+./bin/socks5_client -P "$MONITOR_PORT" dnscache | grep -q "Wasted prefetches: *1$" \
+    && ok "monitoreo: cuenta la renovación desperdiciada" \
+    || fail "monitoreo: Wasted prefetches"
+
+echo -e "\n${BLUE}[4/5] Servidores y ráfagas${NC}"
+stop_server
+start_server -n "127.0.0.1:$CLOSED_PORT" -n "127.0.0.1:$DNS_PORT"
+expect b.ok.test      0 0 500 "servidor que rechaza: pasa al siguiente"
+
+threads_before=$(awk '/^Threads:/ {print $2}' /proc/$SERVER_PID/status)
+got=$(python3 "$HELPER" burst "$PROXY_PORT" "$ECHO_PORT" 500)
+threads_after=$(awk '/^Threads:/ {print $2}' /proc/$SERVER_PID/status)
+[ "$got" = 500 ] && ok "500 nombres distintos a la vez" || fail "ráfaga: $got de 500"
+[ "$threads_before" = "$threads_after" ] \
+    && ok "sin hilos extra ($threads_after)" \
+    || fail "hilos: $threads_before -> $threads_after"
+kill -0 "$SERVER_PID" 2>/dev/null || fail "el servidor terminó"
+stop_server
+
+# con un solo worker, todos los pedidos esperan la misma consulta
+start_server -n "127.0.0.1:$DNS_PORT" -C 0
+got=$(python3 "$HELPER" burst "$PROXY_PORT" "$ECHO_PORT" 50 slow.test)
+[ "$got" = 50 ] && ok "50 pedidos del mismo nombre a la vez" || fail "mismo nombre: $got de 50"
+a=$(asked udp slow.test 1)
+aaaa=$(asked udp slow.test 28)
+[ "$a" = 1 ] && [ "$aaaa" = 1 ] \
+    && ok "una sola consulta para los 50" \
+    || fail "mismo nombre: $a preguntas A y $aaaa AAAA"
+stop_server
+
+# *.ok.test resuelve primero a 127.0.0.1 y después a ::1
+echo -e "\n${BLUE}[5/5] Conexión a ambas familias${NC}"
+start_server -n "127.0.0.1:$DNS_PORT"
+FAMILY=v6            expect c.ok.test 0 0 200    "con las dos familias, primero IPv6"
+# ya con el timer del cliente DNS abierto; el caché responde los siguientes
+fds_before=$(ls /proc/$SERVER_PID/fd | wc -l)
+PORT=$REFUSED_PORT   FAMILY=v4 expect c.ok.test 0 0 200 "IPv6 rechaza: pasa a IPv4 enseguida"
+PORT=$BLACKHOLE_PORT FAMILY=v4 expect c.ok.test 0 200 1500 "IPv6 sin respuesta: gana IPv4 a los 250 ms"
+got=$(python3 "$HELPER" burst "$PROXY_PORT" "$BLACKHOLE_PORT" 50)
+[ "$got" = 50 ] && ok "50 carreras a la vez" || fail "carreras: $got de 50"
+sleep 0.2
+fds_after=$(ls /proc/$SERVER_PID/fd | wc -l)
+[ "$fds_before" = "$fds_after" ] && ok "los intentos perdedores se cierran ($fds_after fds)" \
+    || fail "fds: $fds_before -> $fds_after"
+stop_server
+
+echo
+if [ "$FAILS" = 0 ]; then
+    echo -e "${GREEN}=== TODAS LAS PRUEBAS PASARON ===${NC}"
+else
+    echo -e "${RED}=== $FAILS PRUEBAS FALLARON ===${NC}"
+    exit 1
+fi
@@ -0,0 +1,221 @@
+#!/bin/bash
+#
+# Prueba de integridad de los túneles: varias conexiones a la vez envían
+# datos aleatorios a un servidor de eco local a través del proxy y comparan
+# el sha256 de lo enviado con el de lo que vuelve, con cada modo del relay:
+#
+#   buffers     anillos con readv/sendmsg, prestados y con cut-through
+#   clases      anillos chicos (-B 8) que se llenan y dan la vuelta seguido
+#   memoria     tope de memoria de buffers bajo (-M 1)
+#   splice      -S -N
+#   zerocopy    -Z 1, con anillos chicos y grandes, y hacia un origen que
+#               no lee al principio mientras el cliente hace escrituras
+#               chicas (más envíos pendientes de los que entran)
+#   multiplexor pselect, io_uring y varios workers
+#
+# Cada conexión empieza a leer el eco un rato después de empezar a enviar,
+# así los sockets y los anillos se llenan y el relay tiene que esperar al
+# otro extremo. Al terminar de enviar cierra su mitad (SHUT_WR): el eco
+# tiene que llegar completo antes del FIN.
+# Uso: ./test_relay.sh
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+PROXY_PORT=${PROXY_PORT:-1091}
+MONITOR_PORT=${MONITOR_PORT:-8091}
+ECHO_PORT=${ECHO_PORT:-9992}
+# eco que no lee durante el primer segundo, con una ventana chica
+SLOW_PORT=${SLOW_PORT:-9991}
+RELAY_STREAMS=${RELAY_STREAMS:-8}
+RELAY_MB=${RELAY_MB:-8}
+
+HELPER=$(mktemp /tmp/test_relay.XXXXXX.py)
+SERVER_PID=
+PIDS=
+FAILS=0
+
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null
+    [ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+    wait 2>/dev/null
+    rm -f "$HELPER"
+}
+trap cleanup EXIT
+
+cat > "$HELPER" <<'EOF'
+import hashlib, os, random, socket, struct, sys, threading, time
+
+def echo_server(port, slow=False):
+    srv = socket.socket()
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if slow:
+        # ventana chica y sin leer al principio: los envíos del proxy quedan
+        # en su socket sin confirmar
+        srv.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    srv.bind(('127.0.0.1', port))
+    srv.listen(1024)
+    def serve(c):
+        if slow:
+            time.sleep(1)
+            c.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+        with c:
+            while True:
+                d = c.recv(65536)
+                if not d:
+                    c.shutdown(socket.SHUT_WR)
+                    return
+                c.sendall(d)
+    while True:
+        c, _ = srv.accept()
+        threading.Thread(target=serve, args=(c,), daemon=True).start()
+
+def stream(proxy, port, size, seed, trickle):
+    """
+    envía `size' bytes por el proxy y lee el eco: (enviado, recibido, ok).
+    Con `trickle' antes hace `trickle' escrituras chicas, cada una en su
+    propio segmento, para que el proxy haga un envío por cada una.
+    """
+    s = socket.create_connection(('127.0.0.1', proxy))
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    s.settimeout(60)
+    s.sendall(b'\x05\x01\x02')
+    s.recv(2, socket.MSG_WAITALL)
+    s.sendall(b'\x01\x01u\x01p')
+    s.recv(2, socket.MSG_WAITALL)
+    s.sendall(b'\x05\x01\x00\x01' + socket.inet_aton('127.0.0.1') + struct.pack('!H', port))
+    rep = s.recv(10, socket.MSG_WAITALL)
+    if len(rep) != 10 or rep[1] != 0:
+        s.close()
+        return 0, 0, False
+    rng = random.Random(seed)
+    sent, echoed = hashlib.sha256(), hashlib.sha256()
+    got = [0]
+    def reader():
+        time.sleep(0.3)
+        while True:
+            d = s.recv(random.choice((1, 512, 4096, 65536)))
+            if not d:
+                return
+            echoed.update(d)
+            got[0] += len(d)
+    t = threading.Thread(target=reader)
+    t.start()
+    total = size
+    for k in range(trickle):
+        chunk = os.urandom(2048 if k % 10 == 0 else 100)
+        sent.update(chunk)
+        s.sendall(chunk)
+        total += len(chunk)
+        time.sleep(0.002)
+    left = size
+    while left > 0:
+        chunk = os.urandom(min(left, rng.randint(1, 128 * 1024)))
+        sent.update(chunk)
+        s.sendall(chunk)
+        left -= len(chunk)
+    s.shutdown(socket.SHUT_WR)
+    t.join()
+    s.close()
+    return total, got[0], sent.digest() == echoed.digest()
+
+cmd = sys.argv[1]
+if cmd == 'echo':
+    echo_server(int(sys.argv[2]), len(sys.argv) > 3 and sys.argv[3] == 'slow')
+elif cmd == 'streams':
+    # streams <proxy> <puerto> <n> <MB> [escrituras chicas]: n conexiones a
+    # la vez -> cuántas recibieron el eco completo e idéntico
+    n, size = int(sys.argv[4]), int(sys.argv[5]) << 20
+    trickle = int(sys.argv[6]) if len(sys.argv) > 6 else 0
+    results = [None] * n
+    def one(i):
+        try:
+            results[i] = stream(int(sys.argv[2]), int(sys.argv[3]), size, i, trickle)
+        except OSError:
+            results[i] = (size, 0, False)
+    threads = [threading.Thread(target=one, args=(i,)) for i in range(n)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    print(sum(1 for r in results if r[2] and r[0] == r[1]))
+EOF
+
+start_server() {
+    ./bin/socks5d -p "$PROXY_PORT" -P "$MONITOR_PORT" -u u:p "$@" > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+}
+
+stop_server() {
+    kill -INT "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+    SERVER_PID=
+}
+
+ok() {
+    echo -e "${GREEN}OK: $1${NC}"
+}
+
+fail() {
+    echo -e "${RED}FALLO: $1${NC}"
+    FAILS=$((FAILS + 1))
+}
+
+# relay <descripción> <opciones de socks5d>...
+# (con PORT=<puerto> se conecta a ese puerto en lugar de ECHO_PORT, con
+# MB=<MB> envía eso en lugar de RELAY_MB y con TRICKLE=<n> empieza con n
+# escrituras chicas)
+relay() {
+    local desc=$1 got
+    shift
+    start_server "$@"
+    got=$(python3 "$HELPER" streams "$PROXY_PORT" "${PORT:-$ECHO_PORT}" \
+          "$RELAY_STREAMS" "${MB:-$RELAY_MB}" "${TRICKLE:-0}")
+    if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+        fail "$desc: el servidor terminó"
+    elif [ "$got" = "$RELAY_STREAMS" ]; then
+        ok "$desc ($got de $RELAY_STREAMS con eco idéntico)"
+    else
+        fail "$desc ($got de $RELAY_STREAMS con eco idéntico)"
+    fi
+    stop_server
+}
+
+echo -e "${BLUE}=== PRUEBA DE INTEGRIDAD DEL RELAY ===${NC}"
+echo "$RELAY_STREAMS conexiones a la vez, $RELAY_MB MB de ida y vuelta cada una"
+
+make all > /dev/null || { echo -e "${RED}Error de compilación${NC}"; exit 1; }
+
+python3 "$HELPER" echo "$ECHO_PORT" & PIDS="$PIDS $!"
+python3 "$HELPER" echo "$SLOW_PORT" slow & PIDS="$PIDS $!"
+sleep 0.5
+
+echo -e "\n${BLUE}[1/3] Buffers${NC}"
+relay "buffers"
+relay "clases de tamaño chicas (-B 8)"      -B 8
+relay "tope de memoria (-M 1)"              -M 1
+relay "splice (-S -N)"                      -S -N
+
+echo -e "\n${BLUE}[2/3] MSG_ZEROCOPY${NC}"
+relay "zerocopy (-Z 1)"                     -Z 1
+relay "zerocopy con anillos chicos (-Z 1 -B 8)" -Z 1 -B 8
+relay "zerocopy con anillos grandes (-Z 1 -B 4096)" -Z 1 -B 4096
+# más envíos sin confirmar de los que se pueden registrar
+PORT=$SLOW_PORT MB=0 TRICKLE=40 relay "zerocopy hacia un origen lento" -Z 1
+
+echo -e "\n${BLUE}[3/3] Multiplexores${NC}"
+relay "pselect"                             -b pselect
+relay "io_uring"                            -b io_uring
+relay "4 workers, zerocopy"                 -w 4 -Z 1
+relay "4 workers, splice"                   -w 4 -S -N
+
+echo
+if [ "$FAILS" = 0 ]; then
+    echo -e "${GREEN}=== TODAS LAS PRUEBAS PASARON ===${NC}"
+else
+    echo -e "${RED}=== $FAILS PRUEBAS FALLARON ===${NC}"
+    exit 1
+fi